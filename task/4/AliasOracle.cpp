@@ -0,0 +1,105 @@
+#include "AliasOracle.hpp"
+#include <llvm/Analysis/ValueTracking.h>
+
+using namespace llvm;
+
+bool AliasOracle::mayAlias(Value *a, Type *aType, Value *b, Type *bType)
+{
+    if (a == b)
+        return true;
+    const Value *objA = getObject(a);
+    const Value *objB = getObject(b);
+    if (objA != objB)
+    {
+        // 两个不同的栈变量或全局变量不会重叠
+        if (isIdentified(objA) && isIdentified(objB))
+            return false;
+        // 地址没有泄露的栈变量只能通过它自己访问
+        if (isLocal(objA) || isLocal(objB))
+            return false;
+        return true;
+    }
+
+    // 同一个对象：常量偏移不重叠时不别名
+    APInt offsetA(mDL.getIndexTypeSizeInBits(a->getType()), 0);
+    APInt offsetB(mDL.getIndexTypeSizeInBits(b->getType()), 0);
+    const Value *baseA = a->stripAndAccumulateConstantOffsets(mDL, offsetA, true);
+    const Value *baseB = b->stripAndAccumulateConstantOffsets(mDL, offsetB, true);
+    if (baseA != baseB)
+        return true;
+    int64_t beginA = offsetA.getSExtValue(), beginB = offsetB.getSExtValue();
+    int64_t endA = beginA + mDL.getTypeStoreSize(aType).getKnownMinValue();
+    int64_t endB = beginB + mDL.getTypeStoreSize(bType).getKnownMinValue();
+    return beginA < endB && beginB < endA;
+}
+
+bool AliasOracle::mustAlias(Value *a, Type *aType, Value *b, Type *bType)
+{
+    if (mDL.getTypeStoreSize(aType) != mDL.getTypeStoreSize(bType))
+        return false;
+    if (a == b)
+        return true;
+    APInt offsetA(mDL.getIndexTypeSizeInBits(a->getType()), 0);
+    APInt offsetB(mDL.getIndexTypeSizeInBits(b->getType()), 0);
+    const Value *baseA = a->stripAndAccumulateConstantOffsets(mDL, offsetA, true);
+    const Value *baseB = b->stripAndAccumulateConstantOffsets(mDL, offsetB, true);
+    return baseA == baseB && offsetA == offsetB;
+}
+
+bool AliasOracle::mayBeWrittenByCall(Value *ptr)
+{
+    return !isLocal(getObject(ptr));
+}
+
+const Value *AliasOracle::getObject(const Value *ptr)
+{
+    // 循环中递增的指针 phi 的各个来源都指向同一个对象
+    SmallVector<const Value *, 4> objects;
+    getUnderlyingObjects(ptr, objects);
+    return objects.size() == 1 ? objects.front() : getUnderlyingObject(ptr);
+}
+
+bool AliasOracle::isIdentified(const Value *obj)
+{
+    return isa<AllocaInst>(obj) || isa<GlobalVariable>(obj);
+}
+
+bool AliasOracle::isLocal(const Value *obj)
+{
+    auto *alloca = dyn_cast<AllocaInst>(obj);
+    if (!alloca)
+        return false;
+    auto it = mLocal.find(alloca);
+    if (it != mLocal.end())
+        return it->second;
+    SmallPtrSet<const Value *, 8> visited;
+    return mLocal[alloca] = !escapes(alloca, alloca, visited);
+}
+
+bool AliasOracle::escapes(const AllocaInst *alloca, const Value *ptr, SmallPtrSetImpl<const Value *> &visited)
+{
+    if (!visited.insert(ptr).second)
+        return false;
+    for (const User *user : ptr->users())
+    {
+        if (isa<LoadInst>(user))
+            continue;
+        if (auto *store = dyn_cast<StoreInst>(user))
+        {
+            if (store->getValueOperand() == ptr)
+                return true;
+            continue;
+        }
+        // 汇合了其它对象的 phi 或 select 使 alloca 可以通过别名访问
+        if ((isa<PHINode>(user) || isa<SelectInst>(user)) && getObject(user) != alloca)
+            return true;
+        if (isa<GetElementPtrInst>(user) || isa<BitCastInst>(user) || isa<PHINode>(user) || isa<SelectInst>(user))
+        {
+            if (escapes(alloca, user, visited))
+                return true;
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
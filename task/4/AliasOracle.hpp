@@ -0,0 +1,39 @@
+#pragma once
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Instructions.h>
+
+// 内存访问的别名判断，只区分分配在栈上的局部变量、全局变量以及它们的常量偏移
+class AliasOracle
+{
+  public:
+    explicit AliasOracle(const llvm::DataLayout &dl) : mDL(dl)
+    {
+    }
+
+    // 从 a 开始的 aType 与从 b 开始的 bType 可能重叠
+    bool mayAlias(llvm::Value *a, llvm::Type *aType, llvm::Value *b, llvm::Type *bType);
+
+    // 从 a 开始的 aType 与从 b 开始的 bType 恰好是同一块内存
+    bool mustAlias(llvm::Value *a, llvm::Type *aType, llvm::Value *b, llvm::Type *bType);
+
+    // 调用可能读写除地址未泄露的栈变量以外的所有内存
+    bool mayBeWrittenByCall(llvm::Value *ptr);
+
+  private:
+    // 指针指向的对象，穿过各来源都指向同一个对象的 phi 与 select
+    static const llvm::Value *getObject(const llvm::Value *ptr);
+
+    static bool isIdentified(const llvm::Value *obj);
+
+    // 只被 load、store（作为地址）、GEP 以及只指向它自己的 phi、select 使用的 alloca
+    bool isLocal(const llvm::Value *obj);
+
+    static bool escapes(const llvm::AllocaInst *alloca, const llvm::Value *ptr,
+                        llvm::SmallPtrSetImpl<const llvm::Value *> &visited);
+
+    const llvm::DataLayout &mDL;
+    llvm::DenseMap<const llvm::AllocaInst *, bool> mLocal;
+};
@@ -0,0 +1,387 @@
+#include "BitIdiomRecognition.hpp"
+#include "LoopInduction.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/PatternMatch.h>
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+namespace {
+
+// 整数值的非负性：先假设所有整数指令都非负，反复去掉不满足规则的指令直到不动点，循环中的 phi 因此也能被证明
+class SignAnalysis
+{
+  public:
+    SignAnalysis(Function &func, DominatorTree &DT) : mDT(DT), mDL(func.getParent()->getDataLayout())
+    {
+        for (auto &bb : func)
+            for (auto &inst : bb)
+                if (inst.getType()->isIntegerTy())
+                    mNonNegative.insert(&inst);
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto &bb : func)
+                for (auto &inst : bb)
+                    if (mNonNegative.count(&inst) && !check(&inst))
+                    {
+                        mNonNegative.erase(&inst);
+                        changed = true;
+                    }
+        }
+    }
+
+    bool isNonNegative(Value *value) const
+    {
+        if (auto *constInt = dyn_cast<ConstantInt>(value))
+            return !constInt->isNegative();
+        if (isa<Instruction>(value))
+            return mNonNegative.count(value);
+        return isKnownNonNegative(value, mDL);
+    }
+
+    // 数据流之外再看支配 at 的分支：只从 x > c（c >= -1）或 x >= c（c >= 0）为真的一侧到达时 x 非负
+    bool isNonNegativeAt(Value *value, Instruction *at) const
+    {
+        if (isNonNegative(value))
+            return true;
+        for (DomTreeNode *node = mDT.getNode(at->getParent()); node; node = node->getIDom())
+        {
+            BasicBlock *bb = node->getBlock();
+            BasicBlock *pred = bb->getSinglePredecessor();
+            if (!pred)
+                continue;
+            auto *br = dyn_cast<BranchInst>(pred->getTerminator());
+            if (!br || !br->isConditional() || br->getSuccessor(0) == br->getSuccessor(1))
+                continue;
+            auto *cmp = dyn_cast<ICmpInst>(br->getCondition());
+            if (!cmp)
+                continue;
+            CmpInst::Predicate pred0 = br->getSuccessor(0) == bb ? cmp->getPredicate() : cmp->getInversePredicate();
+            Value *lhs = cmp->getOperand(0);
+            auto *rhs = dyn_cast<ConstantInt>(cmp->getOperand(1));
+            if (!rhs)
+            {
+                rhs = dyn_cast<ConstantInt>(lhs);
+                lhs = cmp->getOperand(1);
+                pred0 = CmpInst::getSwappedPredicate(pred0);
+            }
+            if (!rhs || lhs != value)
+                continue;
+            int64_t bound = rhs->getSExtValue();
+            if ((pred0 == CmpInst::ICMP_SGT && bound >= -1) ||
+                ((pred0 == CmpInst::ICMP_SGE || pred0 == CmpInst::ICMP_EQ) && bound >= 0))
+                return true;
+        }
+        return false;
+    }
+
+  private:
+    bool check(Instruction *inst) const
+    {
+        auto nonNegative = [&](unsigned i) { return isNonNegative(inst->getOperand(i)); };
+        switch (inst->getOpcode())
+        {
+        case Instruction::ZExt:
+        case Instruction::UDiv:
+            return true;
+        case Instruction::LShr: {
+            auto *shift = dyn_cast<ConstantInt>(inst->getOperand(1));
+            return (shift && !shift->isZero()) || nonNegative(0);
+        }
+        case Instruction::URem:
+            return nonNegative(0) || nonNegative(1);
+        case Instruction::And:
+            return nonNegative(0) || nonNegative(1);
+        case Instruction::Or:
+        case Instruction::Xor:
+            return nonNegative(0) && nonNegative(1);
+        case Instruction::Add:
+        case Instruction::Mul:
+            return inst->hasNoSignedWrap() && nonNegative(0) && nonNegative(1);
+        case Instruction::Shl:
+            return inst->hasNoSignedWrap() && nonNegative(0);
+        // 商和余数的符号由被除数决定，除数为负时商变号
+        case Instruction::SDiv:
+            return nonNegative(0) && nonNegative(1);
+        case Instruction::SRem:
+        case Instruction::AShr:
+        case Instruction::SExt:
+            return nonNegative(0);
+        case Instruction::Select:
+            return nonNegative(1) && nonNegative(2);
+        case Instruction::PHI:
+            return all_of(cast<PHINode>(inst)->incoming_values(), [&](Value *v) { return isNonNegative(v); });
+        case Instruction::Call:
+            if (auto *intrinsic = dyn_cast<IntrinsicInst>(inst))
+                if (intrinsic->getIntrinsicID() == Intrinsic::ctpop)
+                    return true;
+            return false;
+        default:
+            return false;
+        }
+    }
+
+    DominatorTree &mDT;
+    const DataLayout &mDL;
+    DenseSet<Value *> mNonNegative;
+};
+
+// 常数 c 为 ±2^k（k >= 1）时返回 k
+bool getPowerOf2(Value *value, unsigned &k)
+{
+    auto *constInt = dyn_cast<ConstantInt>(value);
+    if (!constInt || constInt->getBitWidth() > 64)
+        return false;
+    APInt abs = constInt->getValue().abs();
+    if (!abs.isPowerOf2() || abs == 1)
+        return false;
+    k = abs.logBase2();
+    return true;
+}
+
+// x % ±2^k == c：余数与 x 同号，非零余数要求 x 的符号位与 c 一致，且低 k 位与 c 的补码低 k 位相同；
+// c 为 0 时只看低 k 位。c 超出余数的范围时不处理，留给常量折叠
+Value *buildRemCompare(IRBuilder<> &builder, ICmpInst *cmp, Value *x, unsigned k, const APInt &c)
+{
+    unsigned bits = c.getBitWidth();
+    APInt limit = APInt::getOneBitSet(bits, k);
+    if (c.sge(limit) || c.sle(-limit))
+        return nullptr;
+    APInt mask = limit - 1;
+    APInt expected = c & mask;
+    if (!c.isZero())
+    {
+        mask.setSignBit();
+        if (c.isNegative())
+            expected.setSignBit();
+    }
+    Value *masked = builder.CreateAnd(x, ConstantInt::get(x->getType(), mask));
+    return builder.CreateICmp(cmp->getPredicate(), masked, ConstantInt::get(x->getType(), expected));
+}
+
+// 乘以 2^k 或左移 k 位
+bool matchShl(Value *value, Value *&base, unsigned &k)
+{
+    const APInt *amount;
+    unsigned bits = value->getType()->getScalarSizeInBits();
+    if (match(value, m_Shl(m_Value(base), m_APInt(amount))))
+        k = amount->getLimitedValue(bits);
+    else if (match(value, m_Mul(m_Value(base), m_APInt(amount))) && amount->isPowerOf2())
+        k = amount->logBase2();
+    else
+        return false;
+    return k > 0 && k < bits;
+}
+
+// (a << k) 与 (b >>> (W - k)) 的位互不重叠，相加与按位或相同，都是 fshl(a, b, k)
+Value *buildFunnelShift(IRBuilder<> &builder, BinaryOperator *binOp)
+{
+    unsigned bits = binOp->getType()->getScalarSizeInBits();
+    for (unsigned i = 0; i < 2; ++i)
+    {
+        Value *high;
+        Value *low;
+        unsigned k;
+        const APInt *amount;
+        if (!matchShl(binOp->getOperand(i), high, k) ||
+            !match(binOp->getOperand(1 - i), m_LShr(m_Value(low), m_APInt(amount))) || *amount != bits - k)
+            continue;
+        Function *fshl = Intrinsic::getDeclaration(binOp->getModule(), Intrinsic::fshl, {binOp->getType()});
+        return builder.CreateCall(fshl, {high, low, ConstantInt::get(binOp->getType(), k)});
+    }
+    return nullptr;
+}
+
+// 对 x 的最低位计数：x & 1、zext(x & 1 != 0)、zext(x & 1 == 1)
+bool isLowBitTest(Value *cond, Value *x)
+{
+    ICmpInst::Predicate pred;
+    return (match(cond, m_ICmp(pred, m_And(m_Specific(x), m_One()), m_Zero())) && pred == ICmpInst::ICMP_NE) ||
+           (match(cond, m_ICmp(pred, m_And(m_Specific(x), m_One()), m_One())) && pred == ICmpInst::ICMP_EQ);
+}
+
+bool isLowBit(Value *value, Value *x)
+{
+    Value *cond;
+    return match(value, m_And(m_Specific(x), m_One())) ||
+           (match(value, m_ZExt(m_Value(cond))) && isLowBitTest(cond, x));
+}
+
+// 回边上的计数：c + bit，或 select(bit, c + 1, c)
+bool isBitCount(Value *next, PHINode *count, Value *x)
+{
+    Value *bit;
+    if (match(next, m_c_Add(m_Specific(count), m_Value(bit))) && isLowBit(bit, x))
+        return true;
+    Value *cond;
+    return match(next, m_Select(m_Value(cond), m_Add(m_Specific(count), m_One()), m_Specific(count))) &&
+           isLowBitTest(cond, x);
+}
+
+// while (x != 0 或 x > 0) { c += x & 1; x >>= 1; } 退出时 c 多出 popcount(x)、x 为 0
+int recognizePopCount(Loop *LP, const SignAnalysis &signs)
+{
+    BasicBlock *header = LP->getHeader();
+    BasicBlock *preheader = LP->getLoopPreheader();
+    BasicBlock *latch = LP->getLoopLatch();
+    if (!preheader || !latch || !LP->isInnermost() || LP->getExitingBlock() != header || !LP->getExitBlock())
+        return 0;
+    auto *br = dyn_cast<BranchInst>(header->getTerminator());
+    if (!br || !br->isConditional())
+        return 0;
+    auto *cmp = dyn_cast<ICmpInst>(br->getCondition());
+    if (!cmp || !match(cmp->getOperand(1), m_Zero()))
+        return 0;
+    auto *x = dyn_cast<PHINode>(cmp->getOperand(0));
+    if (!x || x->getParent() != header)
+        return 0;
+    CmpInst::Predicate pred = LP->contains(br->getSuccessor(0)) ? cmp->getPredicate() : cmp->getInversePredicate();
+    Value *next = x->getIncomingValueForBlock(latch);
+    // x 不为 0 时只有逻辑右移能走到 0；x > 0 时循环中 x 为正，算术右移也一样
+    bool shifted = match(next, m_LShr(m_Specific(x), m_One())) ||
+                   (pred == CmpInst::ICMP_SGT && match(next, m_AShr(m_Specific(x), m_One())));
+    if (!shifted || (pred != CmpInst::ICMP_NE && pred != CmpInst::ICMP_SGT))
+        return 0;
+
+    SmallVector<PHINode *, 2> counts;
+    for (PHINode &phi : header->phis())
+        if (&phi != x && isBitCount(phi.getIncomingValueForBlock(latch), &phi, x))
+            counts.push_back(&phi);
+    if (counts.empty())
+        return 0;
+
+    // x > 0 的循环在初值不为正时一次都不执行
+    IRBuilder<> builder(preheader->getTerminator());
+    Value *start = x->getIncomingValueForBlock(preheader);
+    Value *entered = nullptr;
+    if (pred == CmpInst::ICMP_SGT && !signs.isNonNegative(start))
+        entered = builder.CreateICmpSGT(start, ConstantInt::get(start->getType(), 0));
+    Function *ctpop = Intrinsic::getDeclaration(header->getModule(), Intrinsic::ctpop, {start->getType()});
+    Value *bits = builder.CreateCall(ctpop, {start}, "popcount");
+    if (entered)
+        bits = builder.CreateSelect(entered, bits, ConstantInt::get(start->getType(), 0));
+
+    auto outside = [&](Use &use) { return !LP->contains(cast<Instruction>(use.getUser())); };
+    for (PHINode *count : counts)
+    {
+        Value *init = count->getIncomingValueForBlock(preheader);
+        Value *result = builder.CreateAdd(init, builder.CreateZExtOrTrunc(bits, init->getType()), "popcount.sum");
+        count->replaceUsesWithIf(result, outside);
+    }
+    Value *last = ConstantInt::get(start->getType(), 0);
+    if (entered)
+        last = builder.CreateSelect(entered, last, start);
+    x->replaceUsesWithIf(last, outside);
+    return counts.size();
+}
+
+} // namespace
+
+PreservedAnalyses BitIdiomRecognition::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int shiftTimes = 0;
+    int maskTimes = 0;
+    int funnelTimes = 0;
+    int popCountTimes = 0;
+
+    auto &DT = fam.getResult<DominatorTreeAnalysis>(func);
+    auto &LI = fam.getResult<LoopAnalysis>(func);
+    SignAnalysis signs(func, DT);
+
+    for (auto &bb : func)
+    {
+        for (auto &inst : bb)
+        {
+            // 已经没有使用者的指令留给死代码消除
+            if (inst.use_empty())
+                continue;
+            IRBuilder<> builder(&inst);
+            Value *replacement = nullptr;
+            unsigned k;
+            switch (inst.getOpcode())
+            {
+            // 非负数 / 2^k -> x >>> k
+            case Instruction::SDiv: {
+                if (getPowerOf2(inst.getOperand(1), k) && !cast<ConstantInt>(inst.getOperand(1))->isNegative() &&
+                    signs.isNonNegativeAt(inst.getOperand(0), &inst))
+                {
+                    replacement = builder.CreateLShr(inst.getOperand(0), k, "", cast<BinaryOperator>(inst).isExact());
+                    ++shiftTimes;
+                }
+                break;
+            }
+            // 非负数 % ±2^k -> x & (2^k - 1)
+            case Instruction::SRem: {
+                if (getPowerOf2(inst.getOperand(1), k) && signs.isNonNegativeAt(inst.getOperand(0), &inst))
+                {
+                    unsigned bits = inst.getType()->getScalarSizeInBits();
+                    replacement = builder.CreateAnd(inst.getOperand(0), APInt::getLowBitsSet(bits, k));
+                    ++maskTimes;
+                }
+                break;
+            }
+            // x % 2^k == c -> 掩码比较
+            case Instruction::ICmp: {
+                auto *cmp = cast<ICmpInst>(&inst);
+                auto *rem = dyn_cast<BinaryOperator>(cmp->getOperand(0));
+                auto *c = dyn_cast<ConstantInt>(cmp->getOperand(1));
+                if (!c)
+                {
+                    rem = dyn_cast<BinaryOperator>(cmp->getOperand(1));
+                    c = dyn_cast<ConstantInt>(cmp->getOperand(0));
+                }
+                if (cmp->isEquality() && rem && c && rem->getOpcode() == Instruction::SRem &&
+                    getPowerOf2(rem->getOperand(1), k) &&
+                    (replacement = buildRemCompare(builder, cmp, rem->getOperand(0), k, c->getValue())))
+                    ++maskTimes;
+                break;
+            }
+            // (a << k) + (b >>> (W - k)) -> fshl(a, b, k)
+            case Instruction::Add:
+            case Instruction::Or:
+                if ((replacement = buildFunnelShift(builder, cast<BinaryOperator>(&inst))))
+                    ++funnelTimes;
+                break;
+            default:
+                break;
+            }
+            if (replacement)
+                inst.replaceAllUsesWith(replacement);
+        }
+    }
+
+    SmallVector<Loop *, 4> popCountLoops;
+    for (Loop *LP : LI.getLoopsInPreorder())
+        if (int counts = recognizePopCount(LP, signs))
+        {
+            popCountTimes += counts;
+            popCountLoops.push_back(LP);
+        }
+    // 所有循环都识别完之后再删除，LoopInfo 在删除前一直有效
+    int deletedLoops = 0;
+    for (Loop *LP : popCountLoops)
+        if (deleteDeadLoop(LP))
+            ++deletedLoops;
+
+    if (!shiftTimes && !maskTimes && !funnelTimes && !popCountTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("divisions turned into shifts", shiftTimes);
+    PassStatistics::count("remainders turned into masks", maskTimes);
+    PassStatistics::count("funnel shifts formed", funnelTimes);
+    PassStatistics::count("bit counts formed", popCountTimes);
+    PassStatistics::count("loops deleted", deletedLoops);
+    mOut << "BitIdiomRecognition running on " << func.getName() << "...\n\rTo form " << shiftTimes << " shifts, "
+         << maskTimes << " masks, " << funnelTimes << " funnel shifts and " << popCountTimes
+         << " popcounts, deleting " << deletedLoops << " loops\n\r";
+    if (deletedLoops)
+        return PreservedAnalyses::none();
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 位运算惯用法识别：SysY 没有位运算符，移位、取位只能写成乘除和取模。先用数据流（phi 上乐观迭代）
+// 和支配当前指令的 x > c 分支条件证明值非负，再
+//   - 非负数除以 2^k 换成 lshr，对 2^k 取模换成 and；可能为负的留给 StrengthReduction 生成带符号修正的 ashr；
+//   - x % 2^k == c 的比较不论 x 的符号都换成掩码比较；
+//   - (a << k) + (b >>> (W - k)) 换成 llvm.fshl，a 与 b 相同时即为循环左移；
+//   - 每次把 x 右移一位、累加最低位直到 x 为 0 的循环换成一次 llvm.ctpop，循环随之删除。
+class BitIdiomRecognition : public llvm::PassInfoMixin<BitIdiomRecognition>
+{
+  public:
+    explicit BitIdiomRecognition(llvm::raw_ostream &out) : mOut(out)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+};
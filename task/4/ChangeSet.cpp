@@ -0,0 +1,36 @@
+#include "ChangeSet.hpp"
+
+using namespace llvm;
+
+ChangeSet::ChangeSet(Module &mod, ModuleAnalysisManager &mam)
+    : mFAM(mam.getResult<FunctionAnalysisManagerModuleProxy>(mod).getManager())
+{
+}
+
+void ChangeSet::eraseFunction(Function &func)
+{
+    mChanged.erase(&func);
+    mCFGChanged.erase(&func);
+    mModuleChanged = true;
+    mFAM.clear(func, func.getName());
+}
+
+PreservedAnalyses ChangeSet::result()
+{
+    if (empty())
+        return PreservedAnalyses::all();
+
+    for (auto *func : mChanged)
+    {
+        PreservedAnalyses pa;
+        if (!mCFGChanged.count(func))
+            pa.preserveSet<CFGAnalyses>();
+        mFAM.invalidate(const_cast<Function &>(*func), pa);
+    }
+
+    // 函数级分析已经在上面逐个处理过了
+    PreservedAnalyses pa = mModulePA;
+    pa.preserveSet<AllAnalysesOn<Function>>();
+    pa.preserve<FunctionAnalysisManagerModuleProxy>();
+    return pa;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+
+// 记录一次模块级 pass 运行中改动过的函数，并据此生成精确的 PreservedAnalyses：
+// 只有被改动的函数的分析结果会在函数分析管理器中失效，未改动的函数保留缓存。
+class ChangeSet
+{
+  public:
+    ChangeSet(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+
+    // 函数体内的指令被改动，控制流图不变
+    void changeInstructions(llvm::Function &func)
+    {
+        mChanged.insert(&func);
+    }
+
+    // 函数的控制流图被改动（增删基本块或修改跳转）
+    void changeCFG(llvm::Function &func)
+    {
+        mChanged.insert(&func);
+        mCFGChanged.insert(&func);
+    }
+
+    // 模块级改动：全局变量、函数的增删或调用关系变化
+    void changeModule()
+    {
+        mModuleChanged = true;
+    }
+
+    // 在删除函数之前调用，丢弃该函数的缓存分析结果
+    void eraseFunction(llvm::Function &func);
+
+    // pass 保证不会影响的模块级分析
+    template <typename AnalysisT> void preserve()
+    {
+        mModulePA.preserve<AnalysisT>();
+    }
+
+    bool empty() const
+    {
+        return mChanged.empty() && !mModuleChanged;
+    }
+
+    bool contains(const llvm::Function &func) const
+    {
+        return mChanged.count(&func);
+    }
+
+    // 使被改动函数的分析结果失效，返回交给模块分析管理器的 PreservedAnalyses
+    llvm::PreservedAnalyses result();
+
+  private:
+    llvm::FunctionAnalysisManager &mFAM;
+    llvm::SmallPtrSet<const llvm::Function *, 16> mChanged;
+    llvm::SmallPtrSet<const llvm::Function *, 16> mCFGChanged;
+    bool mModuleChanged = false;
+    llvm::PreservedAnalyses mModulePA;
+};
@@ -1,55 +1,225 @@
 #include "CommonSubexpressionElimination.hpp"
+#include "AliasOracle.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/ADT/ScopedHashTable.h>
 
 using namespace llvm;
 
-PreservedAnalyses CommonSubexpressionElimination::run(Module &mod, ModuleAnalysisManager &mam)
+namespace {
+
+// 表达式的键：操作码、结果类型、比较谓词/GEP 源类型，以及操作数
+struct ExprKey
 {
-    int cseTimes = 0;
+    unsigned opcode;
+    Type *type;
+    unsigned predicate;
+    Type *sourceType;
+    SmallVector<Value *, 4> ops;
+};
+
+struct ExprKeyInfo
+{
+    static ExprKey getEmptyKey()
+    {
+        return {~0U, nullptr, 0, nullptr, {}};
+    }
 
-    for (auto &func : mod)
+    static ExprKey getTombstoneKey()
     {
-        for (auto &bb : func)
+        return {~0U - 1, nullptr, 0, nullptr, {}};
+    }
+
+    static unsigned getHashValue(const ExprKey &key)
+    {
+        return hash_combine(key.opcode, key.type, key.predicate, key.sourceType,
+                            hash_combine_range(key.ops.begin(), key.ops.end()));
+    }
+
+    static bool isEqual(const ExprKey &lhs, const ExprKey &rhs)
+    {
+        return lhs.opcode == rhs.opcode && lhs.type == rhs.type && lhs.predicate == rhs.predicate &&
+               lhs.sourceType == rhs.sourceType && lhs.ops == rhs.ops;
+    }
+};
+
+using ExprTable = ScopedHashTable<ExprKey, Instruction *, ExprKeyInfo>;
+using ExprScope = ScopedHashTableScope<ExprKey, Instruction *, ExprKeyInfo>;
+
+// 可以参与值编号的表达式：没有副作用，结果只取决于操作数
+bool buildKey(Instruction &inst, ExprKey &key)
+{
+    if (!isa<BinaryOperator>(inst) && !isa<CmpInst>(inst) && !isa<CastInst>(inst) && !isa<GetElementPtrInst>(inst) &&
+        !isa<SelectInst>(inst) && !isa<UnaryOperator>(inst))
+        return false;
+    key.opcode = inst.getOpcode();
+    key.type = inst.getType();
+    key.predicate = 0;
+    key.sourceType = nullptr;
+    key.ops.assign(inst.op_begin(), inst.op_end());
+
+    if (auto *cmp = dyn_cast<CmpInst>(&inst))
+    {
+        // a > b 与 b < a 是同一个表达式
+        CmpInst::Predicate pred = cmp->getPredicate();
+        if (key.ops[1] < key.ops[0])
+        {
+            std::swap(key.ops[0], key.ops[1]);
+            pred = CmpInst::getSwappedPredicate(pred);
+        }
+        key.predicate = pred;
+    }
+    else if (inst.isCommutative())
+    {
+        if (key.ops[1] < key.ops[0])
+            std::swap(key.ops[0], key.ops[1]);
+    }
+    else if (auto *gep = dyn_cast<GetElementPtrInst>(&inst))
+    {
+        key.sourceType = gep->getSourceElementType();
+    }
+    return true;
+}
+
+// 某个地址上当前可用的值
+struct AvailableLoad
+{
+    Value *ptr;
+    Type *type;
+    Value *value;
+    bool killed;
+};
+
+struct StackNode
+{
+    DomTreeNode *node;
+    DomTreeNode::const_iterator child;
+    std::unique_ptr<ExprScope> scope;
+    size_t loads;
+    size_t kills;
+};
+
+} // namespace
+
+PreservedAnalyses CommonSubexpressionElimination::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int cseTimes = 0;
+    int loadTimes = 0;
+
+    auto &DT = fam.getResult<DominatorTreeAnalysis>(func);
+    AliasOracle alias(func.getParent()->getDataLayout());
+    ExprTable exprs;
+    // 可用的 load 按作用域入栈，被写入“杀死”的记录在 kills 中，离开作用域时恢复
+    std::vector<AvailableLoad> loads;
+    std::vector<size_t> kills;
+
+    auto kill = [&](auto &&pred) {
+        for (size_t i = 0; i < loads.size(); ++i)
+            if (!loads[i].killed && pred(loads[i]))
+            {
+                loads[i].killed = true;
+                kills.push_back(i);
+            }
+    };
+
+    auto processBlock = [&](BasicBlock &bb, BasicBlock *domParent) {
+        // 有其它前驱时，支配者之后的内存状态不再可信
+        if (bb.getSinglePredecessor() != domParent)
+            kill([](const AvailableLoad &) { return true; });
+
+        for (auto &inst : make_early_inc_range(bb))
         {
-            std::map<std::pair<Instruction::BinaryOps, std::pair<Value *, Value *>>, Value *> seenExprs;
-            std::map<std::pair<Value *, std::vector<Value *>>, GetElementPtrInst *> seenGEPs;
-            for (auto &inst : bb)
+            ExprKey key;
+            if (buildKey(inst, key))
             {
-                if (auto binOp = dyn_cast<BinaryOperator>(&inst))
+                if (Instruction *leader = exprs.lookup(key))
                 {
-                    // 创建一个键，表示这个表达式
-                    Value *lhs = binOp->getOperand(0);
-                    Value *rhs = binOp->getOperand(1);
-                    auto key = std::make_pair(binOp->getOpcode(), std::make_pair(lhs, rhs));
-                    auto it = seenExprs.find(key);
-                    if (it != seenExprs.end())
-                    {
-                        binOp->replaceAllUsesWith(it->second);
-                        ++cseTimes;
-                    }
-                    else
-                    {
-                        seenExprs[key] = binOp;
-                    }
+                    // 两者都成立的标志（nsw、inbounds 等）才能保留
+                    leader->andIRFlags(&inst);
+                    inst.replaceAllUsesWith(leader);
+                    inst.eraseFromParent();
+                    ++cseTimes;
                 }
-                else if (auto *gepInst = dyn_cast<GetElementPtrInst>(&inst))
+                else
                 {
-                    // 创建一个键，表示这个GEP表达式
-                    std::vector<Value *> operands(gepInst->op_begin(), gepInst->op_end());
-                    auto key = std::make_pair(gepInst->getPointerOperand(), operands);
-                    auto it = seenGEPs.find(key);
-                    if (it != seenGEPs.end())
-                    {
-                        gepInst->replaceAllUsesWith(it->second);
-                        ++cseTimes;
-                    }
-                    else
-                    {
-                        seenGEPs[key] = gepInst;
-                    }
+                    exprs.insert(key, &inst);
                 }
+                continue;
+            }
+
+            if (auto *load = dyn_cast<LoadInst>(&inst))
+            {
+                if (load->isVolatile())
+                    continue;
+                Value *ptr = load->getPointerOperand();
+                auto it = std::find_if(loads.rbegin(), loads.rend(), [&](const AvailableLoad &a) {
+                    return !a.killed && a.ptr == ptr && a.type == load->getType();
+                });
+                if (it != loads.rend())
+                {
+                    load->replaceAllUsesWith(it->value);
+                    load->eraseFromParent();
+                    ++loadTimes;
+                }
+                else
+                {
+                    loads.push_back({ptr, load->getType(), load, false});
+                }
+            }
+            else if (auto *store = dyn_cast<StoreInst>(&inst))
+            {
+                Value *ptr = store->getPointerOperand();
+                Type *type = store->getValueOperand()->getType();
+                if (store->isVolatile())
+                    kill([](const AvailableLoad &) { return true; });
+                else
+                    kill([&](const AvailableLoad &a) { return alias.mayAlias(a.ptr, a.type, ptr, type); });
+                // 写入之后读同一地址得到写入的值
+                loads.push_back({ptr, type, store->getValueOperand(), false});
+            }
+            else if (auto *call = dyn_cast<CallBase>(&inst))
+            {
+                if (!call->onlyReadsMemory())
+                    kill([&](const AvailableLoad &a) { return alias.mayBeWrittenByCall(a.ptr); });
+            }
+            else if (inst.mayWriteToMemory())
+            {
+                kill([](const AvailableLoad &) { return true; });
             }
         }
+    };
+
+    // 支配树先序遍历，用显式栈避免深层递归
+    std::vector<StackNode> stack;
+    auto enter = [&](DomTreeNode *node) {
+        stack.push_back({node, node->begin(), std::make_unique<ExprScope>(exprs), loads.size(), kills.size()});
+        DomTreeNode *parent = node->getIDom();
+        processBlock(*node->getBlock(), parent ? parent->getBlock() : nullptr);
+    };
+    enter(DT.getRootNode());
+    while (!stack.empty())
+    {
+        StackNode &top = stack.back();
+        if (top.child != top.node->end())
+        {
+            DomTreeNode *child = *top.child++;
+            enter(child);
+            continue;
+        }
+        for (size_t i = top.kills; i < kills.size(); ++i)
+            if (kills[i] < top.loads)
+                loads[kills[i]].killed = false;
+        kills.resize(top.kills);
+        loads.resize(top.loads);
+        stack.pop_back();
     }
-    mOut << "CommonSubexpressionElimination running...\n\rTo eliminate " << cseTimes << " instructions\n\r";
-    return PreservedAnalyses::all();
+
+    if (!cseTimes && !loadTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("instructions eliminated", cseTimes);
+    PassStatistics::count("loads eliminated", loadTimes);
+    mOut << "CommonSubexpressionElimination running on " << func.getName() << "...\n\rTo eliminate " << cseTimes
+         << " instructions and " << loadTimes << " loads\n\r";
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
 }
@@ -1,8 +1,12 @@
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Support/raw_ostream.h"
 #include "map"
 
+// 沿支配树的全局值编号：按支配树先序遍历基本块，用带作用域的哈希表记录可用的表达式，
+// 被支配的块中相同的表达式（交换律操作数规范化后）直接替换为支配者中的结果。
+// 同时消除冗余的 load：在到达当前块的路径上没有可能别名的写入时，复用之前 load 或 store 的值。
 class CommonSubexpressionElimination : public llvm::PassInfoMixin<CommonSubexpressionElimination>
 {
   public:
@@ -10,7 +14,7 @@ class CommonSubexpressionElimination : public llvm::PassInfoMixin<CommonSubexpre
     {
     }
 
-    llvm::PreservedAnalyses run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
 
   private:
     llvm::raw_ostream &mOut;
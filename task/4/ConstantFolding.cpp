@@ -1,395 +1,424 @@
 #include "ConstantFolding.hpp"
+#include "PassStatistics.hpp"
 
 using namespace llvm;
 
-PreservedAnalyses ConstantFolding::run(Module &mod, ModuleAnalysisManager &mam)
+PreservedAnalyses ConstantFolding::run(Function &func, FunctionAnalysisManager &fam)
 {
     int constFoldTimes = 0;
+    // 交换操作数不计入折叠次数，但同样改动了IR
+    bool changed = false;
+    bool cfgChanged = false;
 
-    for (auto &func : mod)
+    for (auto &bb : func)
     {
-        for (auto &bb : func)
+        for (auto &inst : bb)
         {
-            for (auto &inst : bb)
+            // 判断当前指令是否是二元运算指令
+            if (auto binOp = dyn_cast<BinaryOperator>(&inst))
             {
-                // 判断当前指令是否是二元运算指令
-                if (auto binOp = dyn_cast<BinaryOperator>(&inst))
+                // 已经没有使用者的指令留给死代码消除
+                if (binOp->use_empty())
+                    continue;
+                // 获取二元运算指令的左右操作数，并尝试转换为常整数
+                Value *lhs = binOp->getOperand(0);
+                Value *rhs = binOp->getOperand(1);
+                auto constLhs = dyn_cast<ConstantInt>(lhs);
+                auto constRhs = dyn_cast<ConstantInt>(rhs);
+                switch (binOp->getOpcode())
                 {
-                    // 获取二元运算指令的左右操作数，并尝试转换为常整数
-                    Value *lhs = binOp->getOperand(0);
-                    Value *rhs = binOp->getOperand(1);
-                    auto constLhs = dyn_cast<ConstantInt>(lhs);
-                    auto constRhs = dyn_cast<ConstantInt>(rhs);
-                    switch (binOp->getOpcode())
+                case Instruction::Add: {
+                    // a = x + a -> a = a + x
+                    if (constLhs && !constRhs)
                     {
-                    case Instruction::Add: {
-                        // a = x + a -> a = a + x
-                        if (constLhs && !constRhs)
-                        {
-                            binOp->setOperand(0, rhs);
-                            binOp->setOperand(1, lhs);
-                            constLhs = dyn_cast<ConstantInt>(rhs);
-                            constRhs = dyn_cast<ConstantInt>(lhs);
-                        }
-                        // a = x + y -> a = z
-                        else if (constLhs && constRhs)
+                        binOp->setOperand(0, rhs);
+                        binOp->setOperand(1, lhs);
+                        constLhs = dyn_cast<ConstantInt>(rhs);
+                        constRhs = dyn_cast<ConstantInt>(lhs);
+                        changed = true;
+                    }
+                    // a = x + y -> a = z
+                    else if (constLhs && constRhs)
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(
+                            binOp->getType(), constLhs->getSExtValue() + constRhs->getSExtValue()));
+                        ++constFoldTimes;
+                    }
+                    else if (constRhs)
+                    {
+                        // a = a + 0 -> a = a
+                        if (constRhs->isZero())
                         {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(
-                                binOp->getType(), constLhs->getSExtValue() + constRhs->getSExtValue()));
+                            binOp->replaceAllUsesWith(lhs);
                             ++constFoldTimes;
+                            break;
                         }
-                        else if (constRhs)
+                        // a = a + x + y -> a = a + z
+                        if (auto *lhsBinOp = dyn_cast<BinaryOperator>(lhs))
                         {
-                            // a = a + 0 -> a = a
-                            if (constRhs->isZero())
-                            {
-                                binOp->replaceAllUsesWith(lhs);
-                                ++constFoldTimes;
-                                break;
-                            }
-                            // a = a + x + y -> a = a + z
-                            if (auto *lhsBinOp = dyn_cast<BinaryOperator>(lhs))
+                            if (auto *lhsRhs = dyn_cast<ConstantInt>(lhsBinOp->getOperand(1)))
                             {
-                                if (auto *lhsRhs = dyn_cast<ConstantInt>(lhsBinOp->getOperand(1)))
+                                if (lhsBinOp->getOpcode() == Instruction::Add)
                                 {
-                                    if (lhsBinOp->getOpcode() == Instruction::Add)
-                                    {
-                                        binOp->setOperand(0, lhsBinOp->getOperand(0));
-                                        binOp->setOperand(
-                                            1, ConstantInt::getSigned(binOp->getType(), lhsRhs->getSExtValue() +
-                                                                                            constRhs->getSExtValue()));
-                                        ++constFoldTimes;
-                                    }
-                                    else if (lhsBinOp->getOpcode() == Instruction::Sub)
-                                    {
-                                        binOp->setOperand(0, lhsBinOp->getOperand(0));
-                                        binOp->setOperand(
-                                            1, ConstantInt::getSigned(binOp->getType(), 0 - lhsRhs->getSExtValue() +
-                                                                                            constRhs->getSExtValue()));
-                                        ++constFoldTimes;
-                                    }
+                                    binOp->setOperand(0, lhsBinOp->getOperand(0));
+                                    binOp->setOperand(
+                                        1, ConstantInt::getSigned(binOp->getType(), lhsRhs->getSExtValue() +
+                                                                                        constRhs->getSExtValue()));
+                                    ++constFoldTimes;
+                                }
+                                else if (lhsBinOp->getOpcode() == Instruction::Sub)
+                                {
+                                    binOp->setOperand(0, lhsBinOp->getOperand(0));
+                                    binOp->setOperand(
+                                        1, ConstantInt::getSigned(binOp->getType(), 0 - lhsRhs->getSExtValue() +
+                                                                                        constRhs->getSExtValue()));
+                                    ++constFoldTimes;
                                 }
                             }
                         }
-                        break;
                     }
-                    case Instruction::Sub: {
-                        // a = x - y -> a = z
-                        if (constLhs && constRhs)
+                    break;
+                }
+                case Instruction::Sub: {
+                    // a = x - y -> a = z
+                    if (constLhs && constRhs)
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(
+                            binOp->getType(), constLhs->getSExtValue() - constRhs->getSExtValue()));
+                        ++constFoldTimes;
+                    }
+                    else if (constRhs)
+                    {
+                        // a = a - 0 -> a = a
+                        if (constRhs->isZero())
                         {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(
-                                binOp->getType(), constLhs->getSExtValue() - constRhs->getSExtValue()));
+                            binOp->replaceAllUsesWith(lhs);
                             ++constFoldTimes;
+                            break;
                         }
-                        else if (constRhs)
+                        // a = a - x - y -> a = a - z
+                        if (auto *lhsBinOp = dyn_cast<BinaryOperator>(lhs))
                         {
-                            // a = a - 0 -> a = a
-                            if (constRhs->isZero())
+                            if (auto *lhsRhs = dyn_cast<ConstantInt>(lhsBinOp->getOperand(1)))
                             {
-                                binOp->replaceAllUsesWith(lhs);
-                                ++constFoldTimes;
-                                break;
-                            }
-                            // a = a - x - y -> a = a - z
-                            if (auto *lhsBinOp = dyn_cast<BinaryOperator>(lhs))
-                            {
-                                if (auto *lhsRhs = dyn_cast<ConstantInt>(lhsBinOp->getOperand(1)))
+                                if (lhsBinOp->getOpcode() == Instruction::Add)
+                                {
+                                    binOp->setOperand(0, lhsBinOp->getOperand(0));
+                                    binOp->setOperand(
+                                        1, ConstantInt::getSigned(binOp->getType(), constRhs->getSExtValue() -
+                                                                                        lhsRhs->getSExtValue()));
+                                    ++constFoldTimes;
+                                }
+                                else if (lhsBinOp->getOpcode() == Instruction::Sub)
                                 {
-                                    if (lhsBinOp->getOpcode() == Instruction::Add)
-                                    {
-                                        binOp->setOperand(0, lhsBinOp->getOperand(0));
-                                        binOp->setOperand(
-                                            1, ConstantInt::getSigned(binOp->getType(), lhsRhs->getSExtValue() -
-                                                                                            constRhs->getSExtValue()));
-                                        ++constFoldTimes;
-                                    }
-                                    else if (lhsBinOp->getOpcode() == Instruction::Sub)
-                                    {
-                                        binOp->setOperand(0, lhsBinOp->getOperand(0));
-                                        binOp->setOperand(
-                                            1, ConstantInt::getSigned(binOp->getType(), 0 - lhsRhs->getSExtValue() -
-                                                                                            constRhs->getSExtValue()));
-                                        ++constFoldTimes;
-                                    }
+                                    binOp->setOperand(0, lhsBinOp->getOperand(0));
+                                    binOp->setOperand(
+                                        1, ConstantInt::getSigned(binOp->getType(), lhsRhs->getSExtValue() +
+                                                                                        constRhs->getSExtValue()));
+                                    ++constFoldTimes;
                                 }
                             }
                         }
-                        break;
-                    }
-                    case Instruction::Mul: {
-                        // a = x * a -> a = a * x
-                        if (constLhs && !constRhs)
-                        {
-                            binOp->setOperand(0, rhs);
-                            binOp->setOperand(1, lhs);
-                            constLhs = dyn_cast<ConstantInt>(rhs);
-                            constRhs = dyn_cast<ConstantInt>(lhs);
-                        }
-                        // a = x * y -> a = z
-                        else if (constLhs && constRhs)
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(
-                                binOp->getType(), constLhs->getSExtValue() * constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                        }
-                        // a = x * 0 -> a = 0
-                        else if (constRhs && constRhs->isZero())
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
-                            ++constFoldTimes;
-                        }
-                        break;
                     }
-                    case Instruction::UDiv:
-                    case Instruction::SDiv: {
-                        // a = x / y -> a = z
-                        if (constLhs && constRhs)
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(
-                                binOp->getType(), constLhs->getSExtValue() / constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                        }
-                        // a = b / 1 -> a = b
-                        else if (constRhs && constRhs->isOne())
-                        {
-                            binOp->replaceAllUsesWith(lhs);
-                            ++constFoldTimes;
-                        }
-                        // a = b / -1 -> a = -b
-                        else if (constRhs && constRhs->isMinusOne())
-                        {
-                            binOp->replaceAllUsesWith(
-                                ConstantInt::getSigned(binOp->getType(), -constLhs->getSExtValue()));
-                            ++constFoldTimes;
-                        }
-                        // a = 0 / x -> a = 0
-                        else if (constLhs && constLhs->isZero())
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
-                            ++constFoldTimes;
-                        }
-                        break;
+                    break;
+                }
+                case Instruction::Mul: {
+                    // a = x * a -> a = a * x
+                    if (constLhs && !constRhs)
+                    {
+                        binOp->setOperand(0, rhs);
+                        binOp->setOperand(1, lhs);
+                        constLhs = dyn_cast<ConstantInt>(rhs);
+                        constRhs = dyn_cast<ConstantInt>(lhs);
+                        changed = true;
                     }
-                    case Instruction::Shl: {
-                        // a = x << y -> a = z
-                        if (constLhs && constRhs)
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(
-                                binOp->getType(), constLhs->getSExtValue() << constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                        }
-                        // a = 0 << x -> a = 0
-                        else if (constLhs && constLhs->isZero())
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
-                            ++constFoldTimes;
-                        }
-                        // a = x << 0 -> a = x
-                        else if (constRhs && constRhs->isZero())
-                        {
-                            binOp->replaceAllUsesWith(lhs);
-                            ++constFoldTimes;
-                        }
-                        break;
+                    // a = x * y -> a = z
+                    else if (constLhs && constRhs)
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(
+                            binOp->getType(), constLhs->getSExtValue() * constRhs->getSExtValue()));
+                        ++constFoldTimes;
                     }
-                    case Instruction::LShr:
-                    case Instruction::AShr: {
-                        // a = x >> y -> a = z
-                        if (constLhs && constRhs)
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(
-                                binOp->getType(), constLhs->getSExtValue() >> constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                        }
-                        // a = 0 >> x -> a = 0
-                        else if (constLhs && constLhs->isZero())
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
-                            ++constFoldTimes;
-                        }
-                        // a = x >> 0 -> a = x
-                        else if (constRhs && constRhs->isZero())
-                        {
-                            binOp->replaceAllUsesWith(lhs);
-                            ++constFoldTimes;
-                        }
-                        break;
+                    // a = x * 0 -> a = 0
+                    else if (constRhs && constRhs->isZero())
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
+                        ++constFoldTimes;
                     }
-                    case Instruction::And: {
-                        // a = x & a -> a = a & x
-                        if (constLhs && !constRhs)
-                        {
-                            binOp->setOperand(0, rhs);
-                            binOp->setOperand(1, lhs);
-                            constLhs = dyn_cast<ConstantInt>(rhs);
-                            constRhs = dyn_cast<ConstantInt>(lhs);
-                        }
-                        // a = x & y -> a = z
-                        else if (constLhs && constRhs)
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(
-                                binOp->getType(), constLhs->getSExtValue() & constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                        }
-                        // a = x & 0 -> a = 0
-                        else if (constRhs && constRhs->isZero())
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
-                            ++constFoldTimes;
-                        }
-                        // a = x & -1 -> a = x
-                        else if (constRhs && constRhs->isAllOnesValue())
-                        {
-                            binOp->replaceAllUsesWith(lhs);
-                            ++constFoldTimes;
-                        }
-                        break;
+                    break;
+                }
+                case Instruction::UDiv:
+                case Instruction::SDiv: {
+                    bool isSigned = binOp->getOpcode() == Instruction::SDiv;
+                    // a = x / y -> a = z，除以 0 和有符号溢出是未定义行为，保留原指令
+                    if (constLhs && constRhs)
+                    {
+                        const APInt &x = constLhs->getValue();
+                        const APInt &y = constRhs->getValue();
+                        if (y.isZero() || (isSigned && x.isMinSignedValue() && y.isAllOnes()))
+                            break;
+                        binOp->replaceAllUsesWith(ConstantInt::get(binOp->getType(), isSigned ? x.sdiv(y) : x.udiv(y)));
+                        ++constFoldTimes;
                     }
-                    case Instruction::Or: {
-                        // a = x | a -> a = a | x
-                        if (constLhs && !constRhs)
-                        {
-                            binOp->setOperand(0, rhs);
-                            binOp->setOperand(1, lhs);
-                            constLhs = dyn_cast<ConstantInt>(rhs);
-                            constRhs = dyn_cast<ConstantInt>(lhs);
-                        }
-                        // a = x | y -> a = z
-                        else if (constLhs && constRhs)
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(
-                                binOp->getType(), constLhs->getSExtValue() | constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                        }
-                        // a = x | 0 -> a = x
-                        else if (constRhs && constRhs->isZero())
-                        {
-                            binOp->replaceAllUsesWith(lhs);
-                            ++constFoldTimes;
-                        }
-                        // a = x | -1 -> a = -1
-                        else if (constRhs && constRhs->isAllOnesValue())
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), -1));
-                            ++constFoldTimes;
-                        }
-                        break;
+                    // a = b / 1 -> a = b
+                    else if (constRhs && constRhs->isOne())
+                    {
+                        binOp->replaceAllUsesWith(lhs);
+                        ++constFoldTimes;
                     }
-                    case Instruction::Xor: {
-                        // a = x ^ a -> a = a ^ x
-                        if (constLhs && !constRhs)
-                        {
-                            binOp->setOperand(0, rhs);
-                            binOp->setOperand(1, lhs);
-                            constLhs = dyn_cast<ConstantInt>(rhs);
-                            constRhs = dyn_cast<ConstantInt>(lhs);
-                        }
-                        // a = x ^ y -> a = z
-                        else if (constLhs && constRhs)
-                        {
-                            binOp->replaceAllUsesWith(ConstantInt::getSigned(
-                                binOp->getType(), constLhs->getSExtValue() ^ constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                        }
-                        // a = x ^ 0 -> a = x
-                        else if (constRhs && constRhs->isZero())
-                        {
-                            binOp->replaceAllUsesWith(lhs);
-                            ++constFoldTimes;
-                        }
-                        // a = x ^ -1 -> a = ~x
-                        else if (constRhs && constRhs->isAllOnesValue())
-                        {
-                            binOp->replaceAllUsesWith(
-                                ConstantInt::getSigned(binOp->getType(), ~constLhs->getSExtValue()));
-                            ++constFoldTimes;
-                        }
-                        break;
+                    // a = b / -1 -> a = -b（仅有符号除法）
+                    else if (isSigned && constRhs && constRhs->isMinusOne())
+                    {
+                        binOp->replaceAllUsesWith(BinaryOperator::CreateNeg(lhs, "", binOp));
+                        ++constFoldTimes;
                     }
-                    default:
-                        break;
+                    // a = 0 / x -> a = 0
+                    else if (constLhs && constLhs->isZero())
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
+                        ++constFoldTimes;
                     }
+                    break;
                 }
-                else if (auto icmp = dyn_cast<ICmpInst>(&inst))
-                {
-                    Value *lhs = icmp->getOperand(0);
-                    Value *rhs = icmp->getOperand(1);
-                    auto constLhs = dyn_cast<ConstantInt>(lhs);
-                    auto constRhs = dyn_cast<ConstantInt>(rhs);
+                case Instruction::Shl: {
+                    // a = x << y -> a = z
                     if (constLhs && constRhs)
                     {
-                        switch (icmp->getPredicate())
-                        {
-                        case CmpInst::ICMP_EQ:
-                            icmp->replaceAllUsesWith(ConstantInt::getFalse(mod.getContext()));
-                            ++constFoldTimes;
-                            break;
-                        case CmpInst::ICMP_NE:
-                            icmp->replaceAllUsesWith(ConstantInt::getTrue(mod.getContext()));
-                            ++constFoldTimes;
-                            break;
-                        case CmpInst::ICMP_UGT:
-                            icmp->replaceAllUsesWith(ConstantInt::getSigned(
-                                icmp->getType(), constLhs->getZExtValue() > constRhs->getZExtValue()));
-                            ++constFoldTimes;
+                        if (constRhs->getValue().uge(constLhs->getBitWidth()))
                             break;
-                        case CmpInst::ICMP_UGE:
-                            icmp->replaceAllUsesWith(ConstantInt::getSigned(
-                                icmp->getType(), constLhs->getZExtValue() >= constRhs->getZExtValue()));
-                            ++constFoldTimes;
-                            break;
-                        case CmpInst::ICMP_ULT:
-                            icmp->replaceAllUsesWith(ConstantInt::getSigned(
-                                icmp->getType(), constLhs->getZExtValue() < constRhs->getZExtValue()));
-                            ++constFoldTimes;
-                            break;
-                        case CmpInst::ICMP_ULE:
-                            icmp->replaceAllUsesWith(ConstantInt::getSigned(
-                                icmp->getType(), constLhs->getZExtValue() <= constRhs->getZExtValue()));
-                            ++constFoldTimes;
-                            break;
-                        case CmpInst::ICMP_SGT:
-                            icmp->replaceAllUsesWith(ConstantInt::getSigned(
-                                icmp->getType(), constLhs->getSExtValue() > constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                            break;
-                        case CmpInst::ICMP_SGE:
-                            icmp->replaceAllUsesWith(ConstantInt::getSigned(
-                                icmp->getType(), constLhs->getSExtValue() >= constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                            break;
-                        case CmpInst::ICMP_SLT:
-                            icmp->replaceAllUsesWith(ConstantInt::getSigned(
-                                icmp->getType(), constLhs->getSExtValue() < constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                            break;
-                        case CmpInst::ICMP_SLE:
-                            icmp->replaceAllUsesWith(ConstantInt::getSigned(
-                                icmp->getType(), constLhs->getSExtValue() <= constRhs->getSExtValue()));
-                            ++constFoldTimes;
-                            break;
-                        default:
+                        binOp->replaceAllUsesWith(
+                            ConstantInt::get(binOp->getType(), constLhs->getValue().shl(constRhs->getZExtValue())));
+                        ++constFoldTimes;
+                    }
+                    // a = 0 << x -> a = 0
+                    else if (constLhs && constLhs->isZero())
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
+                        ++constFoldTimes;
+                    }
+                    // a = x << 0 -> a = x
+                    else if (constRhs && constRhs->isZero())
+                    {
+                        binOp->replaceAllUsesWith(lhs);
+                        ++constFoldTimes;
+                    }
+                    break;
+                }
+                case Instruction::LShr:
+                case Instruction::AShr: {
+                    // a = x >> y -> a = z
+                    if (constLhs && constRhs)
+                    {
+                        // 移位量不小于位宽时结果为 poison，不折叠
+                        if (constRhs->getValue().uge(constLhs->getBitWidth()))
                             break;
-                        }
+                        unsigned amount = constRhs->getZExtValue();
+                        const APInt &x = constLhs->getValue();
+                        binOp->replaceAllUsesWith(ConstantInt::get(
+                            binOp->getType(), binOp->getOpcode() == Instruction::LShr ? x.lshr(amount) : x.ashr(amount)));
+                        ++constFoldTimes;
+                    }
+                    // a = 0 >> x -> a = 0
+                    else if (constLhs && constLhs->isZero())
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
+                        ++constFoldTimes;
+                    }
+                    // a = x >> 0 -> a = x
+                    else if (constRhs && constRhs->isZero())
+                    {
+                        binOp->replaceAllUsesWith(lhs);
+                        ++constFoldTimes;
+                    }
+                    break;
+                }
+                case Instruction::And: {
+                    // a = x & a -> a = a & x
+                    if (constLhs && !constRhs)
+                    {
+                        binOp->setOperand(0, rhs);
+                        binOp->setOperand(1, lhs);
+                        constLhs = dyn_cast<ConstantInt>(rhs);
+                        constRhs = dyn_cast<ConstantInt>(lhs);
+                        changed = true;
+                    }
+                    // a = x & y -> a = z
+                    else if (constLhs && constRhs)
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(
+                            binOp->getType(), constLhs->getSExtValue() & constRhs->getSExtValue()));
+                        ++constFoldTimes;
+                    }
+                    // a = x & 0 -> a = 0
+                    else if (constRhs && constRhs->isZero())
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), 0));
+                        ++constFoldTimes;
+                    }
+                    // a = x & -1 -> a = x
+                    else if (constRhs && constRhs->isAllOnesValue())
+                    {
+                        binOp->replaceAllUsesWith(lhs);
+                        ++constFoldTimes;
+                    }
+                    break;
+                }
+                case Instruction::Or: {
+                    // a = x | a -> a = a | x
+                    if (constLhs && !constRhs)
+                    {
+                        binOp->setOperand(0, rhs);
+                        binOp->setOperand(1, lhs);
+                        constLhs = dyn_cast<ConstantInt>(rhs);
+                        constRhs = dyn_cast<ConstantInt>(lhs);
+                        changed = true;
+                    }
+                    // a = x | y -> a = z
+                    else if (constLhs && constRhs)
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(
+                            binOp->getType(), constLhs->getSExtValue() | constRhs->getSExtValue()));
+                        ++constFoldTimes;
+                    }
+                    // a = x | 0 -> a = x
+                    else if (constRhs && constRhs->isZero())
+                    {
+                        binOp->replaceAllUsesWith(lhs);
+                        ++constFoldTimes;
+                    }
+                    // a = x | -1 -> a = -1
+                    else if (constRhs && constRhs->isAllOnesValue())
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(binOp->getType(), -1));
+                        ++constFoldTimes;
+                    }
+                    break;
+                }
+                case Instruction::Xor: {
+                    // a = x ^ a -> a = a ^ x
+                    if (constLhs && !constRhs)
+                    {
+                        binOp->setOperand(0, rhs);
+                        binOp->setOperand(1, lhs);
+                        constLhs = dyn_cast<ConstantInt>(rhs);
+                        constRhs = dyn_cast<ConstantInt>(lhs);
+                        changed = true;
+                    }
+                    // a = x ^ y -> a = z
+                    else if (constLhs && constRhs)
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::getSigned(
+                            binOp->getType(), constLhs->getSExtValue() ^ constRhs->getSExtValue()));
+                        ++constFoldTimes;
+                    }
+                    // a = x ^ 0 -> a = x
+                    else if (constRhs && constRhs->isZero())
+                    {
+                        binOp->replaceAllUsesWith(lhs);
+                        ++constFoldTimes;
                     }
+                    break;
                 }
-                else if (auto br = dyn_cast<BranchInst>(&inst))
+                default:
+                    break;
+                }
+            }
+            else if (auto icmp = dyn_cast<ICmpInst>(&inst))
+            {
+                if (icmp->use_empty())
+                    continue;
+                Value *lhs = icmp->getOperand(0);
+                Value *rhs = icmp->getOperand(1);
+                auto constLhs = dyn_cast<ConstantInt>(lhs);
+                auto constRhs = dyn_cast<ConstantInt>(rhs);
+                if (constLhs && constRhs)
                 {
-                    if (br->isConditional())
+                    switch (icmp->getPredicate())
                     {
-                        if (auto constCond = dyn_cast<ConstantInt>(br->getCondition()))
-                        {
-                            BranchInst::Create(br->getSuccessor(constCond->isZero() ? 1 : 0), br);
-                            ++constFoldTimes;
-                            br->eraseFromParent();
-                            break;
-                        }
+                    case CmpInst::ICMP_EQ:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getZExtValue() == constRhs->getZExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    case CmpInst::ICMP_NE:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getZExtValue() != constRhs->getZExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    case CmpInst::ICMP_UGT:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getZExtValue() > constRhs->getZExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    case CmpInst::ICMP_UGE:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getZExtValue() >= constRhs->getZExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    case CmpInst::ICMP_ULT:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getZExtValue() < constRhs->getZExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    case CmpInst::ICMP_ULE:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getZExtValue() <= constRhs->getZExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    case CmpInst::ICMP_SGT:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getSExtValue() > constRhs->getSExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    case CmpInst::ICMP_SGE:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getSExtValue() >= constRhs->getSExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    case CmpInst::ICMP_SLT:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getSExtValue() < constRhs->getSExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    case CmpInst::ICMP_SLE:
+                        icmp->replaceAllUsesWith(ConstantInt::getSigned(
+                            icmp->getType(), constLhs->getSExtValue() <= constRhs->getSExtValue()));
+                        ++constFoldTimes;
+                        break;
+                    default:
+                        break;
+                    }
+                }
+            }
+            else if (auto br = dyn_cast<BranchInst>(&inst))
+            {
+                if (br->isConditional())
+                {
+                    if (auto constCond = dyn_cast<ConstantInt>(br->getCondition()))
+                    {
+                        BasicBlock *taken = br->getSuccessor(constCond->isZero() ? 1 : 0);
+                        BasicBlock *notTaken = br->getSuccessor(constCond->isZero() ? 0 : 1);
+                        if (notTaken != taken)
+                            notTaken->removePredecessor(&bb);
+                        BranchInst::Create(taken, br);
+                        ++constFoldTimes;
+                        cfgChanged = true;
+                        br->eraseFromParent();
+                        break;
                     }
                 }
             }
         }
     }
 
-    mOut << "ConstantFolding running...\n\rTo eliminate " << constFoldTimes << " instructions\n\r";
-    return PreservedAnalyses::all();
+    if (!constFoldTimes && !changed)
+        return PreservedAnalyses::all();
+    PassStatistics::count("instructions folded", constFoldTimes);
+    if (constFoldTimes)
+        mOut << "ConstantFolding running on " << func.getName() << "...\n\rTo eliminate " << constFoldTimes
+             << " instructions\n\r";
+    PreservedAnalyses pa;
+    if (!cfgChanged)
+        pa.preserveSet<CFGAnalyses>();
+    return pa;
 }
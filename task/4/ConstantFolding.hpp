@@ -11,7 +11,7 @@ class ConstantFolding : public llvm::PassInfoMixin<ConstantFolding>
     {
     }
 
-    llvm::PreservedAnalyses run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
 
   private:
     llvm::raw_ostream &mOut;
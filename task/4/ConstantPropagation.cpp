@@ -1,314 +1,490 @@
 #include "ConstantPropagation.hpp"
-#include "map"
+#include "PassStatistics.hpp"
+#include "ChangeSet.hpp"
+#include "StaticCallCounter.hpp"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Operator.h>
 
 using namespace llvm;
 
-PreservedAnalyses ConstantPropagation::run(Module &mod, ModuleAnalysisManager &mam)
+namespace {
+
+// 格上的值：未知（尚未见到定义）< 常量 < 不确定
+struct LatticeValue
 {
-    int cpTimes = 0;
-    std::map<Value *, ConstantInt *> constantMap;
+    enum Kind
+    {
+        Unknown,
+        Const,
+        Overdefined
+    };
+    Kind kind = Unknown;
+    Constant *value = nullptr;
+
+    static LatticeValue constant(Constant *c)
+    {
+        return {Const, c};
+    }
+
+    static LatticeValue overdefined()
+    {
+        return {Overdefined, nullptr};
+    }
+
+    bool isUnknown() const
+    {
+        return kind == Unknown;
+    }
+
+    bool isConstant() const
+    {
+        return kind == Const;
+    }
+
+    bool isOverdefined() const
+    {
+        return kind == Overdefined;
+    }
 
-    // 遍历所有全局变量
-    for (auto &globalVar : mod.globals())
+    // 与 other 求并，返回自身是否变化
+    bool merge(const LatticeValue &other)
     {
-        // 检查全局变量是否是常量
-        if (auto *constVal = dyn_cast<ConstantInt>(globalVar.getInitializer()))
+        if (isOverdefined() || other.isUnknown())
+            return false;
+        if (isUnknown())
         {
-            constantMap[&globalVar] = constVal;
+            *this = other;
+            return true;
         }
+        if (other.isConstant() && other.value == value)
+            return false;
+        *this = overdefined();
+        return true;
     }
+};
 
-    // 遍历所有函数，找到全局常量
-    for (auto &func : mod)
+// 可以直接替换到IR中的常量
+bool isFoldable(const LatticeValue &lv)
+{
+    return lv.isConstant() && (isa<ConstantInt>(lv.value) || isa<ConstantFP>(lv.value));
+}
+
+// 函数的所有使用都是直接调用时，才能跨过程追踪它的实参与返回值
+bool isTracked(const Function &func)
+{
+    if (func.isDeclaration() || func.isVarArg() || func.getName() == "main")
+        return false;
+    for (const Use &use : func.uses())
     {
-        for (auto &bb : func)
+        auto *call = dyn_cast<CallInst>(use.getUser());
+        if (!call || !call->isCallee(&use))
+            return false;
+    }
+    return true;
+}
+
+// 全局变量（经过 GEP、bitcast 后）只被读取
+bool isOnlyLoaded(const Value *ptr)
+{
+    for (const User *user : ptr->users())
+    {
+        if (auto *load = dyn_cast<LoadInst>(user))
         {
-            for (auto &inst : bb)
+            if (load->isVolatile())
+                return false;
+        }
+        else if (auto *gep = dyn_cast<GEPOperator>(user))
+        {
+            if (gep->getPointerOperand() != ptr || !isOnlyLoaded(gep))
+                return false;
+        }
+        else if (auto *cast = dyn_cast<BitCastOperator>(user))
+        {
+            if (!isOnlyLoaded(cast))
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+class SCCPSolver
+{
+  public:
+    explicit SCCPSolver(Module &mod) : mDL(mod.getDataLayout())
+    {
+        for (auto &func : mod)
+        {
+            if (func.isDeclaration())
+                continue;
+            if (isTracked(func))
             {
-                if (auto *instPtr = dyn_cast<Instruction>(&inst))
-                {
-                    if (auto *constInst = dyn_cast<StoreInst>(instPtr))
-                    {
-                        auto *ptr = constInst->getPointerOperand();
-                        if (auto *constInt = dyn_cast<ConstantInt>(constInst->getValueOperand()))
-                        {
-                            // 将常量赋值到左值
-                            if (!constantMap[ptr])
-                            {
-                                constantMap[ptr] = constInt;
-                            }
-                            // 如果左值已经有值，且不等于右值，值在执行过程中被修改
-                            else if (constantMap[ptr]->getSExtValue() != 114514 && constantMap[ptr] != constInt)
-                            {
-                                constantMap[ptr] =
-                                    llvm::ConstantInt::get(constInst->getContext(), llvm::APInt(32, 114514));
-                            }
-                        }
-                        else
-                        {
-                            constantMap[ptr] = llvm::ConstantInt::get(constInst->getContext(), llvm::APInt(32, 114514));
-                        }
-                    }
-                }
+                mTracked.insert(&func);
+                if (!func.getReturnType()->isVoidTy())
+                    mReturns[&func];
+            }
+            else
+            {
+                // 可能从模块外被调用：入口可执行，参数不确定
+                for (auto &arg : func.args())
+                    mValues[&arg] = LatticeValue::overdefined();
+                markBlock(&func.getEntryBlock());
             }
         }
     }
 
-    for (auto &func : mod)
+    void solve()
     {
-        std::map<Value *, ConstantInt *> argMap;
-        for (auto *user : func.users())
+        while (!mBlockWorklist.empty() || !mInstWorklist.empty())
         {
-            if (auto *callInst = dyn_cast<CallInst>(user))
+            while (!mInstWorklist.empty())
             {
-                for (unsigned i = 0; i < callInst->arg_size(); i++)
-                {
-                    Value *arg = callInst->getArgOperand(i);
-                    Value *calleeArg = func.getArg(i);
-                    if (auto *constArg = dyn_cast<ConstantInt>(arg))
-                    {
-                        if (argMap[calleeArg] && argMap[calleeArg] != constArg)
-                        {
-                            argMap[calleeArg] = ConstantInt::get(arg->getContext(), APInt(32, 114514));
-                        }
-                        else
-                        {
-                            argMap[calleeArg] = constArg;
-                        }
-                    }
-                    else
-                    {
-                        argMap[calleeArg] = ConstantInt::get(calleeArg->getContext(), APInt(32, 114514));
-                    }
-                }
+                Instruction *inst = mInstWorklist.back();
+                mInstWorklist.pop_back();
+                if (mExecutable.count(inst->getParent()))
+                    visit(*inst);
+            }
+            while (!mBlockWorklist.empty())
+            {
+                BasicBlock *bb = mBlockWorklist.back();
+                mBlockWorklist.pop_back();
+                for (auto &inst : *bb)
+                    visit(inst);
             }
         }
-        for (auto &bb : func)
+    }
+
+    LatticeValue get(Value *value)
+    {
+        if (auto *c = dyn_cast<Constant>(value))
         {
-            for (auto &inst : bb)
-            {
-                for (unsigned i = 0; i < inst.getNumOperands(); i++)
-                {
-                    if (argMap[inst.getOperand(i)] && argMap[inst.getOperand(i)]->getSExtValue() != 114514)
-                    {
-                        inst.setOperand(i, argMap[inst.getOperand(i)]);
-                        cpTimes++;
-                    }
-                }
+            // undef 与 poison 保守地视为不确定
+            if (isa<UndefValue>(c))
+                return LatticeValue::overdefined();
+            return LatticeValue::constant(c);
+        }
+        auto it = mValues.find(value);
+        return it == mValues.end() ? LatticeValue() : it->second;
+    }
 
-                // constantMap 传播到 Load 指令
-                if (auto *instPtr = dyn_cast<Instruction>(&inst))
-                {
-                    if (auto *constInst = dyn_cast<LoadInst>(instPtr))
-                    {
-                        auto *ptr = constInst->getPointerOperand();
-                        if (constantMap[ptr] && constantMap[ptr]->getSExtValue() != 114514)
-                        {
-                            instPtr->replaceAllUsesWith(constantMap[ptr]);
-                            cpTimes++;
-                        }
-                    }
-                }
-            }
+    bool isExecutable(BasicBlock *bb) const
+    {
+        return mExecutable.count(bb);
+    }
+
+  private:
+    void markBlock(BasicBlock *bb)
+    {
+        if (mExecutable.insert(bb).second)
+            mBlockWorklist.push_back(bb);
+    }
+
+    void markEdge(BasicBlock *from, BasicBlock *to)
+    {
+        if (!mExecutableEdges.insert({from, to}).second)
+            return;
+        if (mExecutable.count(to))
+        {
+            // 新的可执行入边只影响 phi
+            for (auto &phi : to->phis())
+                mInstWorklist.push_back(&phi);
+        }
+        else
+        {
+            markBlock(to);
         }
     }
 
-    for (auto &func : mod)
+    void update(Value *value, const LatticeValue &lv)
+    {
+        if (!mValues[value].merge(lv))
+            return;
+        for (User *user : value->users())
+            if (auto *inst = dyn_cast<Instruction>(user))
+                mInstWorklist.push_back(inst);
+    }
+
+    void visit(Instruction &inst)
     {
-        std::set<Value *> unknownGep;
-        std::map<std::pair<Value *, std::vector<int>>, ConstantInt *> gepMap;
+        if (auto *phi = dyn_cast<PHINode>(&inst))
+            visitPHI(*phi);
+        else if (auto *br = dyn_cast<BranchInst>(&inst))
+            visitBranch(*br);
+        else if (auto *sw = dyn_cast<SwitchInst>(&inst))
+            visitSwitch(*sw);
+        else if (auto *ret = dyn_cast<ReturnInst>(&inst))
+            visitReturn(*ret);
+        else if (auto *call = dyn_cast<CallInst>(&inst))
+            visitCall(*call);
+        else if (auto *load = dyn_cast<LoadInst>(&inst))
+            visitLoad(*load);
+        else if (auto *select = dyn_cast<SelectInst>(&inst))
+            visitSelect(*select);
+        else if (inst.isTerminator() || inst.getType()->isVoidTy())
+            return;
+        else if (isa<BinaryOperator>(inst) || isa<CastInst>(inst) || isa<CmpInst>(inst) ||
+                 isa<GetElementPtrInst>(inst) || isa<UnaryOperator>(inst))
+            visitPure(inst);
+        else
+            update(&inst, LatticeValue::overdefined());
+    }
+
+    void visitPHI(PHINode &phi)
+    {
+        LatticeValue result;
+        for (unsigned i = 0; i < phi.getNumIncomingValues(); ++i)
+        {
+            if (!mExecutableEdges.count({phi.getIncomingBlock(i), phi.getParent()}))
+                continue;
+            result.merge(get(phi.getIncomingValue(i)));
+            if (result.isOverdefined())
+                break;
+        }
+        update(&phi, result);
+    }
+
+    void visitBranch(BranchInst &br)
+    {
+        if (br.isUnconditional())
+        {
+            markEdge(br.getParent(), br.getSuccessor(0));
+            return;
+        }
+        LatticeValue cond = get(br.getCondition());
+        if (cond.isUnknown())
+            return;
+        if (auto *ci = dyn_cast_or_null<ConstantInt>(cond.value))
+        {
+            markEdge(br.getParent(), br.getSuccessor(ci->isZero() ? 1 : 0));
+            return;
+        }
+        markEdge(br.getParent(), br.getSuccessor(0));
+        markEdge(br.getParent(), br.getSuccessor(1));
+    }
+
+    void visitSwitch(SwitchInst &sw)
+    {
+        LatticeValue cond = get(sw.getCondition());
+        if (cond.isUnknown())
+            return;
+        if (auto *ci = dyn_cast_or_null<ConstantInt>(cond.value))
+        {
+            markEdge(sw.getParent(), sw.findCaseValue(ci)->getCaseSuccessor());
+            return;
+        }
+        for (auto *succ : successors(sw.getParent()))
+            markEdge(sw.getParent(), succ);
+    }
+
+    void visitReturn(ReturnInst &ret)
+    {
+        Function *func = ret.getFunction();
+        auto it = mReturns.find(func);
+        if (it == mReturns.end() || !ret.getReturnValue())
+            return;
+        if (!it->second.merge(get(ret.getReturnValue())))
+            return;
+        for (User *user : func->users())
+            mInstWorklist.push_back(cast<Instruction>(user));
+    }
+
+    void visitCall(CallInst &call)
+    {
+        Function *callee = call.getCalledFunction();
+        if (!callee || !mTracked.count(callee))
+        {
+            if (!call.getType()->isVoidTy())
+                update(&call, LatticeValue::overdefined());
+            return;
+        }
+        for (unsigned i = 0; i < call.arg_size(); ++i)
+            update(callee->getArg(i), get(call.getArgOperand(i)));
+        markBlock(&callee->getEntryBlock());
+        if (!call.getType()->isVoidTy())
+            update(&call, mReturns[callee]);
+    }
+
+    void visitLoad(LoadInst &load)
+    {
+        LatticeValue ptr = get(load.getPointerOperand());
+        if (ptr.isUnknown())
+            return;
+        Constant *folded = nullptr;
+        if (ptr.isConstant() && !load.isVolatile())
+            folded = ConstantFoldLoadFromConstPtr(ptr.value, load.getType(), mDL);
+        updateFolded(load, folded);
+    }
+
+    void visitSelect(SelectInst &select)
+    {
+        LatticeValue cond = get(select.getCondition());
+        if (cond.isUnknown())
+            return;
+        if (auto *ci = dyn_cast_or_null<ConstantInt>(cond.value))
+        {
+            update(&select, get(ci->isZero() ? select.getFalseValue() : select.getTrueValue()));
+            return;
+        }
+        LatticeValue result = get(select.getTrueValue());
+        result.merge(get(select.getFalseValue()));
+        update(&select, result);
+    }
 
-        for (auto &globalVar : mod.globals())
+    void visitPure(Instruction &inst)
+    {
+        SmallVector<Constant *, 4> ops;
+        for (Value *op : inst.operands())
         {
-            if (auto *constVal = dyn_cast<ConstantDataArray>(globalVar.getInitializer()))
+            LatticeValue lv = get(op);
+            if (lv.isOverdefined())
             {
-                for (unsigned i = 0; i < constVal->getNumElements(); i++)
-                {
-                    gepMap[std::make_pair(&globalVar, std::vector<int>{(int)0, (int)i})] =
-                        ConstantInt::get(Type::getInt32Ty(mod.getContext()), constVal->getElementAsInteger(i));
-                }
+                update(&inst, lv);
+                return;
             }
+            if (lv.isUnknown())
+                return;
+            ops.push_back(lv.value);
         }
+        Constant *folded = nullptr;
+        if (auto *cmp = dyn_cast<CmpInst>(&inst))
+            folded = ConstantFoldCompareInstOperands(cmp->getPredicate(), ops[0], ops[1], mDL);
+        else
+            folded = ConstantFoldInstOperands(&inst, ops, mDL);
+        updateFolded(inst, folded);
+    }
 
-        for (auto &bb : func)
+    void updateFolded(Instruction &inst, Constant *folded)
+    {
+        // 除以零等未定义行为会折叠成 poison，不参与传播
+        if (!folded || isa<UndefValue>(folded))
+            update(&inst, LatticeValue::overdefined());
+        else
+            update(&inst, LatticeValue::constant(folded));
+    }
+
+    const DataLayout &mDL;
+    DenseMap<Value *, LatticeValue> mValues;
+    DenseMap<Function *, LatticeValue> mReturns;
+    DenseSet<Function *> mTracked;
+    DenseSet<BasicBlock *> mExecutable;
+    DenseSet<std::pair<BasicBlock *, BasicBlock *>> mExecutableEdges;
+    std::vector<BasicBlock *> mBlockWorklist;
+    std::vector<Instruction *> mInstWorklist;
+};
+
+} // namespace
+
+PreservedAnalyses ConstantPropagation::run(Module &mod, ModuleAnalysisManager &mam)
+{
+    int cpTimes = 0;
+    int branchTimes = 0;
+    int constGlobalTimes = 0;
+    ChangeSet changes(mod, mam);
+
+    // 从不被写入的全局变量标记为常量，对它的读取才能折叠
+    for (auto &global : mod.globals())
+    {
+        if (global.isConstant() || !global.hasDefinitiveInitializer() || !isOnlyLoaded(&global))
+            continue;
+        global.setConstant(true);
+        changes.changeModule();
+        constGlobalTimes++;
+    }
+
+    SCCPSolver solver(mod);
+    solver.solve();
+
+    bool cfgChanged = false;
+    for (auto &func : mod)
+    {
+        if (func.isDeclaration() || !solver.isExecutable(&func.getEntryBlock()))
+            continue;
+        int lastCpTimes = cpTimes;
+        int lastBranchTimes = branchTimes;
+
+        for (auto &arg : func.args())
         {
-            for (auto &inst : bb)
+            LatticeValue lv = solver.get(&arg);
+            if (isFoldable(lv) && !arg.use_empty())
             {
-                // 遍历指令的操作数
-                if (GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(&inst))
-                {
-                    if (unknownGep.find(gep->getPointerOperand()) != unknownGep.end())
-                    {
-                        continue;
-                    }
-                    std::vector<int> idxs;
-                    for (int i = 1; i < gep->getNumOperands(); i++)
-                    {
-                        if (ConstantInt *ci = dyn_cast<ConstantInt>(gep->getOperand(i)))
-                        {
-                            idxs.push_back(ci->getSExtValue());
-                        }
-                        else if (SExtInst *sext = dyn_cast<SExtInst>(gep->getOperand(i)))
-                        {
-                            if (ConstantInt *ci = dyn_cast<ConstantInt>(sext->getOperand(0)))
-                            {
-                                idxs.push_back(ci->getValue().getSExtValue());
-                            }
-                        }
-                        else
-                        {
-                            break;
-                        }
-                    }
-                    if (idxs.size() == gep->getNumOperands() - 1)
-                    {
-                        bool hasStore = false;
-                        bool hasUnknown = false;
-                        int storeNum = 0;
-                        for (const auto &user : gep->users())
-                        {
-                            if (StoreInst *store = dyn_cast<StoreInst>(user))
-                            {
-                                if (ConstantInt *ci = dyn_cast<ConstantInt>(store->getValueOperand()))
-                                {
-                                    if (!hasStore)
-                                    {
-                                        storeNum = ci->getSExtValue();
-                                        hasStore = true;
-                                    }
-                                    else if (storeNum != ci->getSExtValue())
-                                    {
-                                        hasStore = true;
-                                        hasUnknown = true;
-                                        break;
-                                    }
-                                }
-                                else
-                                {
-                                    hasUnknown = true;
-                                    hasStore = true;
-                                    break;
-                                }
-                            }
-                        }
-                        if (!hasUnknown && hasStore)
-                        {
-                            gepMap[std::make_pair(gep->getPointerOperand(), idxs)] =
-                                ConstantInt::get(gep->getContext(), APInt(32, storeNum));
-                        }
-                        else if (hasUnknown && hasStore)
-                        {
-                            gepMap[std::make_pair(gep->getPointerOperand(), idxs)] =
-                                ConstantInt::get(gep->getContext(), APInt(32, 114514));
-                        }
-                    }
-                    else
-                    {
-                        unknownGep.insert(gep->getPointerOperand());
-                    }
-                }
+                arg.replaceAllUsesWith(lv.value);
+                cpTimes++;
             }
         }
 
+        std::vector<BasicBlock *> deadBlocks;
         for (auto &bb : func)
         {
+            if (!solver.isExecutable(&bb))
+            {
+                deadBlocks.push_back(&bb);
+                continue;
+            }
             for (auto &inst : bb)
             {
-                // gep
-                // load
-                if (GetElementPtrInst *gep = dyn_cast<GetElementPtrInst>(&inst))
+                if (inst.use_empty())
+                    continue;
+                LatticeValue lv = solver.get(&inst);
+                if (isFoldable(lv))
                 {
-                    if (unknownGep.find(gep) != unknownGep.end())
-                    {
-                        continue;
-                    }
-                    std::vector<int> idxs;
-                    for (int i = 1; i < gep->getNumOperands(); i++)
-                    {
-                        if (ConstantInt *ci = dyn_cast<ConstantInt>(gep->getOperand(i)))
-                        {
-                            idxs.push_back(ci->getSExtValue());
-                        }
-                        else if (SExtInst *sext = dyn_cast<SExtInst>(gep->getOperand(i)))
-                        {
-                            if (ConstantInt *ci = dyn_cast<ConstantInt>(sext->getOperand(0)))
-                            {
-                                idxs.push_back(ci->getValue().getSExtValue());
-                            }
-                        }
-                        else
-                        {
-                            break;
-                        }
-                    }
-                    if (idxs.size() == gep->getNumOperands() - 1)
-                    {
-                        if (gepMap[std::make_pair(gep->getPointerOperand(), idxs)] &&
-                            gepMap[std::make_pair(gep->getPointerOperand(), idxs)]->getSExtValue() != 114514)
-                        {
-                            for (const auto &user : gep->users())
-                            {
-                                if (LoadInst *load = dyn_cast<LoadInst>(user))
-                                {
-                                    load->replaceAllUsesWith(gepMap[std::make_pair(gep->getPointerOperand(), idxs)]);
-                                    cpTimes++;
-                                }
-                            }
-                        }
-                    }
-                }
-                // load gep
-                else if (auto *load = dyn_cast<LoadInst>(&inst))
-                {
-                    if (auto *gep = dyn_cast<ConstantExpr>(load->getPointerOperand()))
-                    {
-                        if (gep->getOpcode() == Instruction::GetElementPtr)
-                        {
-                            std::vector<int> idxs;
-                            for (int i = 1; i < gep->getNumOperands(); i++)
-                            {
-                                if (ConstantInt *ci = dyn_cast<ConstantInt>(gep->getOperand(i)))
-                                {
-                                    idxs.push_back(ci->getSExtValue());
-                                }
-                                else if (SExtInst *sext = dyn_cast<SExtInst>(gep->getOperand(i)))
-                                {
-                                    if (ConstantInt *ci = dyn_cast<ConstantInt>(sext->getOperand(0)))
-                                    {
-                                        idxs.push_back(ci->getValue().getSExtValue());
-                                    }
-                                }
-                                else
-                                {
-                                    break;
-                                }
-                            }
-                            if (idxs.size() == gep->getNumOperands() - 1)
-                            {
-                                if (gepMap[std::make_pair(gep->getOperand(0), idxs)] &&
-                                    gepMap[std::make_pair(gep->getOperand(0), idxs)]->getSExtValue() != 114514)
-                                {
-                                    load->replaceAllUsesWith(gepMap[std::make_pair(gep->getOperand(0), idxs)]);
-                                    cpTimes++;
-                                }
-                            }
-                        }
-                    }
-                    else if (auto *globalVar = dyn_cast<GlobalVariable>(load->getPointerOperand()))
-                    {
-                        // 处理全局变量的情况
-                        if (gepMap[std::make_pair(globalVar, std::vector<int>{0, 0})] &&
-                            gepMap[std::make_pair(globalVar, std::vector<int>{0, 0})]->getSExtValue() != 114514)
-                        {
-                            load->replaceAllUsesWith(gepMap[std::make_pair(globalVar, std::vector<int>{0, 0})]);
-                            cpTimes++;
-                        }
-                    }
+                    inst.replaceAllUsesWith(lv.value);
+                    cpTimes++;
                 }
             }
+
+            // 条件恒定的分支改为无条件跳转
+            auto *br = dyn_cast<BranchInst>(bb.getTerminator());
+            if (!br || br->isUnconditional())
+                continue;
+            auto *cond = dyn_cast_or_null<ConstantInt>(solver.get(br->getCondition()).value);
+            if (!cond)
+                continue;
+            BasicBlock *taken = br->getSuccessor(cond->isZero() ? 1 : 0);
+            BasicBlock *notTaken = br->getSuccessor(cond->isZero() ? 0 : 1);
+            if (notTaken != taken)
+                notTaken->removePredecessor(&bb);
+            BranchInst::Create(taken, br);
+            br->eraseFromParent();
+            branchTimes++;
+        }
+
+        // 不可执行的基本块：先断开与可执行块的 phi 关联，再整体删除
+        for (auto *bb : deadBlocks)
+            for (auto *succ : successors(bb))
+                if (solver.isExecutable(succ))
+                    succ->removePredecessor(bb);
+        for (auto *bb : deadBlocks)
+            bb->dropAllReferences();
+        for (auto *bb : deadBlocks)
+            bb->eraseFromParent();
+        branchTimes += deadBlocks.size();
+
+        if (branchTimes != lastBranchTimes)
+        {
+            changes.changeCFG(func);
+            cfgChanged = true;
+        }
+        else if (cpTimes != lastCpTimes)
+        {
+            changes.changeInstructions(func);
         }
     }
 
-    mOut << "ConstantPropagation running...\n\rPropagated " << cpTimes << " constants\n\r";
-    return PreservedAnalyses::all();
+    if (changes.empty())
+        return PreservedAnalyses::all();
+    PassStatistics::count("constants propagated", cpTimes);
+    PassStatistics::count("branches folded", branchTimes);
+    PassStatistics::count("globals marked constant", constGlobalTimes);
+    mOut << "ConstantPropagation running...\n\rPropagated " << cpTimes << " constants, folded " << branchTimes
+         << " branches and blocks, marked " << constGlobalTimes << " globals constant\n\r";
+    // 删除不可执行的基本块可能删掉调用
+    if (!cfgChanged)
+        changes.preserve<StaticCallCounter>();
+    return changes.result();
 }
@@ -3,8 +3,10 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/PassManager.h>
 #include <llvm/Support/raw_ostream.h>
-#include "set"
 
+// 稀疏条件常量传播（SCCP）：在 SSA 上对每个值维护 未知/常量/不确定 三层格，
+// 只沿可执行的控制流边传播，从而能证明分支不会被执行。
+// 对只被直接调用的函数跨过程传播实参和返回值；从不被写入的全局变量标记为常量，对它的读取直接折叠。
 class ConstantPropagation : public llvm::PassInfoMixin<ConstantPropagation>
 {
   public:
@@ -16,4 +18,4 @@ class ConstantPropagation : public llvm::PassInfoMixin<ConstantPropagation>
 
   private:
     llvm::raw_ostream &mOut;
-};
\ No newline at end of file
+};
@@ -1,327 +1,210 @@
 #include "DeadCodeElimination.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Analysis/CFG.h>
+#include <llvm/Analysis/PostDominators.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Local.h>
 
 using namespace llvm;
 
-PreservedAnalyses DeadCodeElimination::run(Module &mod, ModuleAnalysisManager &mam)
+namespace {
+
+// 标记-清扫式的死代码删除：所有指令先假定是死的，从返回、store 和有副作用的调用出发标记活指令。
+//   - 活指令的操作数是活的；
+//   - 活指令所在的块控制依赖于哪些分支，这些分支就是活的；
+//   - 活 phi 的取值取决于从哪条边进入，各来路块的跳转是活的；
+//   - 环中的分支总是活的，避免把不终止的循环删成终止的。
+// 没有活值依赖的条件分支改为直接跳向一个后继，其间的块里没有活指令，走哪条路都一样。
+class AggressiveDeadCodeElimination
 {
-    int deadCodeEliminationTimes = 0;
-    int lastDeadCodeEliminationTimes = -1;
+  public:
+    AggressiveDeadCodeElimination(Function &func, PostDominatorTree &PDT) : mFunc(func), mPDT(PDT)
+    {
+    }
 
-    while (lastDeadCodeEliminationTimes != deadCodeEliminationTimes)
+    // 返回删除的指令数，deadBranches 为改成无条件跳转的分支数
+    int run(int &deadBranches)
     {
-        lastDeadCodeEliminationTimes = deadCodeEliminationTimes;
-        for (auto &func : mod)
+        computeControlDependences();
+        markRoots();
+        while (!mWorklist.empty())
         {
-            for (auto &bb : func)
-            {
-                std::vector<Instruction *> instToErase;
-                for (auto &inst : bb)
-                {
-                    if (inst.use_empty() && !isa<StoreInst>(inst) && !isa<CallInst>(inst) && !isa<ReturnInst>(inst) &&
-                        !isa<BranchInst>(inst) && !isa<SwitchInst>(inst))
-                    {
-                        instToErase.push_back(&inst);
-                        deadCodeEliminationTimes++;
-                    }
-                }
-                for (auto &i : instToErase)
-                    i->eraseFromParent();
-            }
+            Instruction *inst = mWorklist.pop_back_val();
+            for (Value *op : inst->operands())
+                if (auto *opInst = dyn_cast<Instruction>(op))
+                    markLive(opInst);
+            if (auto *phi = dyn_cast<PHINode>(inst))
+                for (BasicBlock *incoming : phi->blocks())
+                    markLive(incoming->getTerminator());
         }
+        deadBranches = removeDeadBranches();
+        return sweep();
+    }
 
-        // 如果全局变量只被 store，将其删除
-        std::vector<GlobalVariable *> globalsToErase;
-        std::vector<Instruction *> instToErase;
-        for (auto &global : mod.globals())
-        {
-            bool onlyStored = true;
-            for (const auto &user : global.users())
-                if (!isa<StoreInst>(user))
-                {
-                    onlyStored = false;
-                    break;
-                }
-            if (onlyStored)
-            {
-                globalsToErase.push_back(&global);
-                for (const auto &user : global.users())
-                    instToErase.push_back(cast<Instruction>(user));
-                deadCodeEliminationTimes++;
-            }
-        }
-        for (auto &g : globalsToErase)
-            g->eraseFromParent();
-        for (auto &i : instToErase)
-            i->eraseFromParent();
-
-        // 指针为常量的GEP指令替换
-        // 基址到GEP指令的映射
-        std::map<Value *, std::vector<GetElementPtrInst *>> pointerToGEPs;
-        for (auto &func : mod)
-        {
-            for (auto &bb : func)
-            {
-                for (auto &inst : bb)
-                {
-                    if (auto *gep = dyn_cast<GetElementPtrInst>(&inst))
-                    {
-                        pointerToGEPs[gep->getPointerOperand()].push_back(gep);
-                    }
-                }
-            }
-        }
+  private:
+    BasicBlock *getIPDom(BasicBlock *bb)
+    {
+        auto *node = mPDT.getNode(bb);
+        if (!node || !node->getIDom())
+            return nullptr;
+        return node->getIDom()->getBlock();
+    }
 
-        for (auto &pair : pointerToGEPs)
+    // 边 A->S 上，从 S 沿后支配树向上直到 A 的直接后支配者，途经的块都控制依赖于 A
+    void computeControlDependences()
+    {
+        for (auto &bb : mFunc)
         {
-            // 相同基址的所有GEP指令
-            auto &geps = pair.second;
-            bool allConstant = true;
-            for (auto *gep : geps)
-            {
-                for (auto &idx : gep->indices())
+            if (bb.getTerminator()->getNumSuccessors() < 2)
+                continue;
+            BasicBlock *stop = getIPDom(&bb);
+            for (BasicBlock *succ : successors(&bb))
+                for (BasicBlock *runner = succ; runner && runner != stop; runner = getIPDom(runner))
                 {
-                    if (!isa<ConstantInt>(idx))
-                    {
-                        allConstant = false;
+                    auto &deps = mControlDeps[runner];
+                    if (deps.empty() || deps.back() != &bb)
+                        deps.push_back(&bb);
+                    if (runner == &bb)
                         break;
-                    }
                 }
-                if (!allConstant)
-                    break;
-            }
-
-            // 这个数组的所有索引都是常量
-            if (allConstant)
-            {
-                for (auto &func : mod)
-                {
-                    for (auto &bb : func)
-                    {
-                        for (auto &inst : bb)
-                        {
-                            if (auto *gep = dyn_cast<GetElementPtrInst>(&inst))
-                            {
-                                if (gep->getPointerOperand() == pair.first)
-                                {
-                                    int offset = gep->getPointerOperandIndex();
-                                    // 遍历pair.second中的GEP指令
-                                    for (auto *gep2 : geps)
-                                    {
-                                        if (gep == gep2)
-                                            continue;
-                                        // gep的使用者有且只有一个store指令
-                                        StoreInst *gepStore = nullptr;
-                                        int gepStoreCount = 0;
-                                        for (auto *user : gep->users())
-                                        {
-                                            if (auto *store = dyn_cast<StoreInst>(user))
-                                            {
-                                                gepStore = store;
-                                                gepStoreCount++;
-                                            }
-                                        }
-                                        // gep2的使用者有且只有一个load指令
-                                        LoadInst *gep2Load = nullptr;
-                                        int gep2LoadCount = 0;
-                                        for (auto *user : gep2->users())
-                                        {
-                                            if (auto *load = dyn_cast<LoadInst>(user))
-                                            {
-                                                gep2Load = load;
-                                                gep2LoadCount++;
-                                            }
-                                        }
-                                        // 将gep2之后load的使用替换为gep之后store的值
-                                        if (gepStore && gepStoreCount == 1 && gep2Load && gep2LoadCount == 1)
-                                        {
-                                            gep2Load->replaceAllUsesWith(gepStore->getValueOperand());
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
         }
+    }
 
-        // 函数中只被 store 的数组删除
-        // 函数参数和调用不优化
-        std::vector<Value *> arraysToErase;
-        std::vector<Value *> arraysToKeep;
-        for (auto &func : mod)
-        {
-            // 函数参数不动
-            for (auto &arg : func.args())
-            {
-                arraysToKeep.push_back(&arg);
-            }
-            for (auto &bb : func)
-            {
-                for (auto &inst : bb)
-                {
-                    if (auto *gep = dyn_cast<GetElementPtrInst>(&inst))
-                    {
-                        // 如果在 arraysToKeep 中，不再处理
-                        if (std::find(arraysToKeep.begin(), arraysToKeep.end(), gep) != arraysToKeep.end())
-                            continue;
-                        // 如果不在 arraysToErase 中，加入
-                        if (std::find(arraysToErase.begin(), arraysToErase.end(), gep) == arraysToErase.end())
-                        {
-                            if (auto *array = dyn_cast<AllocaInst>(gep->getPointerOperand()))
-                            {
-                                arraysToErase.push_back(gep->getPointerOperand());
-                            }
-                        }
-                        // 查找 gep 的使用者
-                        for (auto *user : gep->users())
-                        {
-                            if (!isa<StoreInst>(user))
-                            {
-                                arraysToKeep.push_back(gep->getPointerOperand());
-                                break;
-                            }
-                        }
-                    }
-                    else if (auto *call = dyn_cast<CallInst>(&inst))
-                    {
-                        for (auto &arg : call->args())
-                        {
-                            arraysToKeep.push_back(arg);
-                        }
-                    }
-                }
-            }
-        }
-        for (auto &array : arraysToErase)
-        {
-            if (std::find(arraysToKeep.begin(), arraysToKeep.end(), array) == arraysToKeep.end())
-            {
-                for (auto &func : mod)
-                {
-                    for (auto &bb : func)
-                    {
-                        std::vector<Instruction *> instToErase;
-                        for (auto &inst : bb)
-                        {
-                            if (auto *gep = dyn_cast<GetElementPtrInst>(&inst))
-                            {
-                                if (gep->getPointerOperand() == array)
-                                {
-                                    instToErase.push_back(gep);
-                                    for (auto *user : gep->users())
-                                    {
-                                        instToErase.push_back(cast<Instruction>(user));
-                                        deadCodeEliminationTimes++;
-                                    }
-                                    deadCodeEliminationTimes++;
-                                }
-                            }
-                        }
-                        for (auto &i : instToErase)
-                            i->eraseFromParent();
-                    }
-                }
-            }
-        }
+    void markRoots()
+    {
+        for (auto &bb : mFunc)
+            for (auto &inst : bb)
+                if (inst.mayHaveSideEffects() || isa<ReturnInst>(inst) || isa<UnreachableInst>(inst))
+                    markLive(&inst);
+        for (auto it = scc_begin(&mFunc); !it.isAtEnd(); ++it)
+            if (it.hasCycle())
+                for (BasicBlock *bb : *it)
+                    markLive(bb->getTerminator());
+    }
 
-        std::vector<Function *> funcsToErase;
-        for (auto &func : mod)
-        {
-            if (func.getName() != "main" && func.use_empty())
-            {
-                funcsToErase.push_back(&func);
-                deadCodeEliminationTimes++;
-            }
-        }
-        for (auto &f : funcsToErase)
-            f->eraseFromParent();
+    void markLive(Instruction *inst)
+    {
+        if (!mLive.insert(inst).second)
+            return;
+        mWorklist.push_back(inst);
+        BasicBlock *bb = inst->getParent();
+        if (!mLiveBlocks.insert(bb).second)
+            return;
+        auto it = mControlDeps.find(bb);
+        if (it != mControlDeps.end())
+            for (BasicBlock *branch : it->second)
+                markLive(branch->getTerminator());
+    }
 
-        // 函数内未被使用的参数删除
-        for (auto &func : mod)
+    int removeDeadBranches()
+    {
+        int times = 0;
+        for (auto &bb : mFunc)
         {
-            if (func.isDeclaration())
+            Instruction *term = bb.getTerminator();
+            if (mLive.count(term) || term->getNumSuccessors() < 2)
                 continue;
-            std::vector<int> argsToErase;
-            for (auto &arg : func.args())
-            {
-                if (arg.use_empty())
-                {
-                    argsToErase.push_back(arg.getArgNo());
-                }
-            }
-            for (auto *user : func.users())
+            // 直接后支配者是后继时直接跳过去，否则任选一个后继
+            BasicBlock *target = term->getSuccessor(0);
+            BasicBlock *ipdom = getIPDom(&bb);
+            for (BasicBlock *succ : successors(&bb))
+                if (succ == ipdom)
+                    target = succ;
+            bool kept = false;
+            for (BasicBlock *succ : successors(&bb))
             {
-                if (auto *callInst = dyn_cast<CallInst>(user))
-                {
-                    for (auto i : argsToErase)
-                    {
-                        callInst->setArgOperand(i, UndefValue::get(func.getFunctionType()->getParamType(i)));
-                    }
-                }
+                if (succ == target && !kept)
+                    kept = true;
+                else
+                    succ->removePredecessor(&bb);
             }
+            BranchInst::Create(target, term);
+            term->eraseFromParent();
+            ++times;
         }
+        return times;
+    }
 
-        for (auto &func : mod)
-        {
-            for (auto &bb : func)
-            {
-                // 只有一个跳转指令的基本块
-                if (auto *br = dyn_cast<BranchInst>(&bb.front()))
-                {
-                    auto *pred = bb.getSinglePredecessor();
-                    auto *succ = bb.getSingleSuccessor();
-                    if (pred && succ)
-                    {
-                        // 检查后继是否存在 phi 指令
-                        bool hasPhi = false;
-                        for (auto &inst : *succ)
-                        {
-                            if (isa<PHINode>(&inst))
-                            {
-                                hasPhi = true;
-                                break;
-                            }
-                        }
+    int sweep()
+    {
+        std::vector<Instruction *> dead;
+        for (auto &bb : mFunc)
+            for (auto &inst : bb)
+                if (!inst.isTerminator() && !mLive.count(&inst))
+                    dead.push_back(&inst);
+        for (Instruction *inst : dead)
+            inst->dropAllReferences();
+        for (Instruction *inst : dead)
+            inst->eraseFromParent();
+        return dead.size();
+    }
 
-                        // 后继不存在 phi 指令才进行优化
-                        if (!hasPhi)
-                        {
-                            // 将前驱基本块的跳转目标改为当前基本块的跳转目标
-                            auto *predBr = cast<BranchInst>(pred->getTerminator());
-                            for (int i = 0; i < predBr->getNumSuccessors(); ++i)
-                            {
-                                if (predBr->getSuccessor(i) == &bb)
-                                {
-                                    predBr->setSuccessor(i, succ);
-                                    deadCodeEliminationTimes++;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    Function &mFunc;
+    PostDominatorTree &mPDT;
+    DenseMap<BasicBlock *, SmallVector<BasicBlock *, 2>> mControlDeps;
+    SmallPtrSet<Instruction *, 32> mLive;
+    SmallPtrSet<BasicBlock *, 16> mLiveBlocks;
+    SmallVector<Instruction *, 64> mWorklist;
+};
+
+// 一趟线性的控制流化简：折叠常量条件分支，删除不可达块，合并直线相连的块，绕过只有跳转的空块。
+// 不动循环头和跳向循环头的块，保留循环的前置块。
+int simplifyCFG(Function &func)
+{
+    int times = 0;
+    for (auto &bb : func)
+        if (ConstantFoldTerminator(&bb, true))
+            ++times;
+
+    size_t blockCount = func.size();
+    removeUnreachableBlocks(func);
+    times += blockCount - func.size();
 
-        // 删除不是入口块，且没有前驱块的基本块
-        std::vector<BasicBlock *> bbsToErase;
-        for (auto &func : mod)
+    SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 8> backEdges;
+    FindFunctionBackedges(func, backEdges);
+    SmallPtrSet<const BasicBlock *, 8> loopHeaders;
+    for (auto &edge : backEdges)
+        loopHeaders.insert(edge.second);
+
+    for (auto &bb : make_early_inc_range(func))
+    {
+        if (&bb == &func.getEntryBlock())
+            continue;
+        if (MergeBlockIntoPredecessor(&bb))
         {
-            for (auto &bb : func)
-            {
-                if (bb.getName() == "entry")
-                    continue;
-                if (pred_begin(&bb) == pred_end(&bb))
-                {
-                    bbsToErase.push_back(&bb);
-                    deadCodeEliminationTimes++;
-                }
-            }
+            ++times;
+            continue;
         }
-        for (auto &bb : bbsToErase)
-            bb->eraseFromParent();
+        auto *br = dyn_cast<BranchInst>(bb.getTerminator());
+        if (!br || br->isConditional() || br->getSuccessor(0) == &bb || &*bb.getFirstNonPHIOrDbg() != br ||
+            loopHeaders.count(&bb) || loopHeaders.count(br->getSuccessor(0)))
+            continue;
+        if (TryToSimplifyUncondBranchFromEmptyBlock(&bb))
+            ++times;
     }
+    return times;
+}
+
+} // namespace
+
+PreservedAnalyses DeadCodeElimination::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int deadBranches = 0;
+    AggressiveDeadCodeElimination adce(func, fam.getResult<PostDominatorTreeAnalysis>(func));
+    int deadCodeEliminationTimes = adce.run(deadBranches);
+    int simplifiedBlocks = simplifyCFG(func);
 
-    mOut << "DeadCodeElimination running...\n\rTo eliminate " << deadCodeEliminationTimes << " instructions\n\r";
-    return PreservedAnalyses::all();
+    if (!deadCodeEliminationTimes && !deadBranches && !simplifiedBlocks)
+        return PreservedAnalyses::all();
+    PassStatistics::count("instructions eliminated", deadCodeEliminationTimes);
+    PassStatistics::count("dead branches eliminated", deadBranches);
+    PassStatistics::count("blocks simplified", simplifiedBlocks);
+    mOut << "DeadCodeElimination running on " << func.getName() << "...\n\rTo eliminate " << deadCodeEliminationTimes
+         << " instructions, " << deadBranches << " branches, and simplify " << simplifiedBlocks << " blocks\n\r";
+    PreservedAnalyses pa;
+    if (!deadBranches && !simplifiedBlocks)
+        pa.preserveSet<CFGAnalyses>();
+    return pa;
 }
@@ -6,6 +6,9 @@
 #include "set"
 #include "map"
 
+// 激进死代码删除：标记-清扫，指令先假定为死，从返回、store 和有副作用的调用出发标记活指令，
+// 没有活值依赖的条件分支改为无条件跳转。之后一趟线性的控制流化简：折叠常量分支、删除不可达块、
+// 合并直线相连的块、绕过空的跳转块。
 class DeadCodeElimination : public llvm::PassInfoMixin<DeadCodeElimination>
 {
   public:
@@ -13,7 +16,7 @@ class DeadCodeElimination : public llvm::PassInfoMixin<DeadCodeElimination>
     {
     }
 
-    llvm::PreservedAnalyses run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
 
   private:
     llvm::raw_ostream &mOut;
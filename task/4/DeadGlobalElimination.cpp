@@ -0,0 +1,95 @@
+#include "DeadGlobalElimination.hpp"
+#include "PassStatistics.hpp"
+#include "ChangeSet.hpp"
+
+using namespace llvm;
+
+PreservedAnalyses DeadGlobalElimination::run(Module &mod, ModuleAnalysisManager &mam)
+{
+    int deadGlobalEliminationTimes = 0;
+    int lastDeadGlobalEliminationTimes = -1;
+    ChangeSet changes(mod, mam);
+
+    while (lastDeadGlobalEliminationTimes != deadGlobalEliminationTimes)
+    {
+        lastDeadGlobalEliminationTimes = deadGlobalEliminationTimes;
+
+        // 如果全局变量只被 store，将其删除
+        std::vector<GlobalVariable *> globalsToErase;
+        std::vector<Instruction *> instToErase;
+        for (auto &global : mod.globals())
+        {
+            bool onlyStored = true;
+            for (const auto &user : global.users())
+                if (!isa<StoreInst>(user))
+                {
+                    onlyStored = false;
+                    break;
+                }
+            if (onlyStored)
+            {
+                globalsToErase.push_back(&global);
+                for (const auto &user : global.users())
+                {
+                    instToErase.push_back(cast<Instruction>(user));
+                    changes.changeInstructions(*cast<Instruction>(user)->getFunction());
+                }
+                changes.changeModule();
+                deadGlobalEliminationTimes++;
+            }
+        }
+        for (auto &g : globalsToErase)
+            g->eraseFromParent();
+        for (auto &i : instToErase)
+            i->eraseFromParent();
+
+        std::vector<Function *> funcsToErase;
+        for (auto &func : mod)
+        {
+            if (func.getName() != "main" && func.use_empty())
+            {
+                funcsToErase.push_back(&func);
+                deadGlobalEliminationTimes++;
+            }
+        }
+        for (auto &f : funcsToErase)
+        {
+            changes.eraseFunction(*f);
+            f->eraseFromParent();
+        }
+
+        // 函数内未被使用的参数删除
+        for (auto &func : mod)
+        {
+            if (func.isDeclaration())
+                continue;
+            std::vector<int> argsToErase;
+            for (auto &arg : func.args())
+            {
+                if (arg.use_empty())
+                {
+                    argsToErase.push_back(arg.getArgNo());
+                }
+            }
+            for (auto *user : func.users())
+            {
+                if (auto *callInst = dyn_cast<CallInst>(user))
+                {
+                    for (auto i : argsToErase)
+                    {
+                        if (isa<UndefValue>(callInst->getArgOperand(i)))
+                            continue;
+                        callInst->setArgOperand(i, UndefValue::get(func.getFunctionType()->getParamType(i)));
+                        changes.changeInstructions(*callInst->getFunction());
+                        deadGlobalEliminationTimes++;
+                    }
+                }
+            }
+        }
+    }
+
+    PassStatistics::count("globals eliminated", deadGlobalEliminationTimes);
+    if (deadGlobalEliminationTimes)
+        mOut << "DeadGlobalElimination running...\n\rTo eliminate " << deadGlobalEliminationTimes << " globals\n\r";
+    return changes.result();
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 删除只被写入的全局变量、没有调用者的函数，以及实参中未被使用的参数
+class DeadGlobalElimination : public llvm::PassInfoMixin<DeadGlobalElimination>
+{
+  public:
+    explicit DeadGlobalElimination(llvm::raw_ostream &out) : mOut(out)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+
+  private:
+    llvm::raw_ostream &mOut;
+};
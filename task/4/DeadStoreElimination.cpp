@@ -0,0 +1,234 @@
+#include "DeadStoreElimination.hpp"
+#include "AliasOracle.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CFG.h>
+
+using namespace llvm;
+
+namespace {
+
+// 单次查询最多访问的基本块数
+constexpr unsigned kMaxVisitedBlocks = 64;
+
+// 为一条 load 向上查找可用的值：块内倒序扫描，到块首后转到前驱，结果按块缓存
+class StoreForwarder
+{
+  public:
+    StoreForwarder(AliasOracle &alias, std::vector<PHINode *> &phis) : mAlias(alias), mPhis(phis)
+    {
+    }
+
+    Value *find(LoadInst *load)
+    {
+        mPtr = load->getPointerOperand();
+        mType = load->getType();
+        mName = load->getName();
+        mAtBegin.clear();
+        mVisited = 0;
+        return findBefore(load->getParent(), load->getIterator());
+    }
+
+  private:
+    Value *findBefore(BasicBlock *bb, BasicBlock::iterator it)
+    {
+        while (it != bb->begin())
+        {
+            Instruction &inst = *--it;
+            if (auto *store = dyn_cast<StoreInst>(&inst))
+            {
+                Value *value = store->getValueOperand();
+                if (store->isSimple() && value->getType() == mType &&
+                    mAlias.mustAlias(store->getPointerOperand(), value->getType(), mPtr, mType))
+                    return value;
+                if (!store->isSimple() || mAlias.mayAlias(store->getPointerOperand(), value->getType(), mPtr, mType))
+                    return nullptr;
+            }
+            else if (auto *load = dyn_cast<LoadInst>(&inst))
+            {
+                if (load->isSimple() && load->getType() == mType &&
+                    mAlias.mustAlias(load->getPointerOperand(), load->getType(), mPtr, mType))
+                    return load;
+            }
+            else if (auto *call = dyn_cast<CallBase>(&inst))
+            {
+                if (!call->onlyReadsMemory() && mAlias.mayBeWrittenByCall(mPtr))
+                    return nullptr;
+            }
+            else if (inst.mayWriteToMemory())
+            {
+                return nullptr;
+            }
+        }
+        return findAtBegin(bb);
+    }
+
+    Value *findAtBegin(BasicBlock *bb)
+    {
+        auto cached = mAtBegin.find(bb);
+        if (cached != mAtBegin.end())
+            return cached->second;
+        if (++mVisited > kMaxVisitedBlocks || pred_empty(bb))
+            return nullptr;
+        // 先记为不可用，沿环回到自己时就此失败
+        mAtBegin[bb] = nullptr;
+
+        SmallVector<BasicBlock *, 4> preds(predecessors(bb));
+        DenseMap<BasicBlock *, Value *> values;
+        Value *common = nullptr;
+        bool same = true;
+        for (BasicBlock *pred : preds)
+        {
+            if (values.count(pred))
+                continue;
+            Value *value = findBefore(pred, pred->end());
+            if (!value)
+                return nullptr;
+            values[pred] = value;
+            same = same && (!common || common == value);
+            common = value;
+        }
+        if (!same)
+        {
+            PHINode *phi = PHINode::Create(mType, preds.size(), mName + ".fwd", &bb->front());
+            for (BasicBlock *pred : preds)
+                phi->addIncoming(values[pred], pred);
+            mPhis.push_back(phi);
+            common = phi;
+        }
+        return mAtBegin[bb] = common;
+    }
+
+    AliasOracle &mAlias;
+    std::vector<PHINode *> &mPhis;
+    Value *mPtr = nullptr;
+    Type *mType = nullptr;
+    std::string mName;
+    DenseMap<BasicBlock *, Value *> mAtBegin;
+    unsigned mVisited = 0;
+};
+
+enum class PathResult
+{
+    Killed,
+    Read,
+    Continue,
+};
+
+// store 之后的所有路径上，被读取之前都已被覆盖或内存不再可见
+bool isDeadStore(StoreInst *store, AliasOracle &alias)
+{
+    Value *ptr = store->getPointerOperand();
+    Type *type = store->getValueOperand()->getType();
+    const Value *obj = getUnderlyingObject(ptr);
+    // 栈变量在返回后失效；main 返回后程序结束，全局变量也不会再被读取
+    bool diesAtExit =
+        isa<AllocaInst>(obj) || (isa<GlobalVariable>(obj) && store->getFunction()->getName() == "main");
+
+    auto scan = [&](BasicBlock *bb, BasicBlock::iterator it) {
+        for (; it != bb->end(); ++it)
+        {
+            Instruction &inst = *it;
+            if (auto *load = dyn_cast<LoadInst>(&inst))
+            {
+                if (!load->isSimple() || alias.mayAlias(load->getPointerOperand(), load->getType(), ptr, type))
+                    return PathResult::Read;
+            }
+            else if (auto *other = dyn_cast<StoreInst>(&inst))
+            {
+                if (other->isSimple() &&
+                    alias.mustAlias(other->getPointerOperand(), other->getValueOperand()->getType(), ptr, type))
+                    return PathResult::Killed;
+            }
+            else if (auto *call = dyn_cast<CallBase>(&inst))
+            {
+                if (!call->doesNotAccessMemory() && alias.mayBeWrittenByCall(ptr))
+                    return PathResult::Read;
+            }
+            else if (isa<ReturnInst>(inst))
+            {
+                return diesAtExit ? PathResult::Killed : PathResult::Read;
+            }
+            else if (isa<UnreachableInst>(inst))
+            {
+                return PathResult::Killed;
+            }
+            else if (inst.mayReadFromMemory())
+            {
+                return PathResult::Read;
+            }
+        }
+        return PathResult::Continue;
+    };
+
+    BasicBlock *start = store->getParent();
+    PathResult result = scan(start, std::next(store->getIterator()));
+    if (result != PathResult::Continue)
+        return result == PathResult::Killed;
+
+    // 沿后继搜索，再次进入 store 所在的块时从块首扫描，会遇到 store 本身
+    SmallPtrSet<BasicBlock *, 16> visited;
+    SmallVector<BasicBlock *, 16> worklist(successors(start));
+    while (!worklist.empty())
+    {
+        BasicBlock *bb = worklist.pop_back_val();
+        if (!visited.insert(bb).second)
+            continue;
+        if (visited.size() > kMaxVisitedBlocks)
+            return false;
+        result = scan(bb, bb->begin());
+        if (result == PathResult::Read)
+            return false;
+        if (result == PathResult::Continue)
+            worklist.append(succ_begin(bb), succ_end(bb));
+    }
+    return true;
+}
+
+} // namespace
+
+PreservedAnalyses DeadStoreElimination::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int forwardTimes = 0;
+    int deadStoreTimes = 0;
+    AliasOracle alias(func.getParent()->getDataLayout());
+
+    std::vector<PHINode *> phis;
+    StoreForwarder forwarder(alias, phis);
+    for (auto &bb : func)
+        for (auto &inst : make_early_inc_range(bb))
+            if (auto *load = dyn_cast<LoadInst>(&inst))
+            {
+                if (!load->isSimple())
+                    continue;
+                Value *value = forwarder.find(load);
+                if (!value || value == load)
+                    continue;
+                load->replaceAllUsesWith(value);
+                load->eraseFromParent();
+                ++forwardTimes;
+            }
+    // 查询失败时已插入的 phi 没有用处，后插入的可能使用先插入的，倒序删除
+    for (auto it = phis.rbegin(); it != phis.rend(); ++it)
+        if ((*it)->use_empty())
+            (*it)->eraseFromParent();
+
+    for (auto &bb : func)
+        for (auto &inst : make_early_inc_range(bb))
+            if (auto *store = dyn_cast<StoreInst>(&inst))
+                if (store->isSimple() && isDeadStore(store, alias))
+                {
+                    store->eraseFromParent();
+                    ++deadStoreTimes;
+                }
+
+    if (!forwardTimes && !deadStoreTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("loads forwarded", forwardTimes);
+    PassStatistics::count("stores eliminated", deadStoreTimes);
+    mOut << "DeadStoreElimination running on " << func.getName() << "...\n\rTo forward " << forwardTimes
+         << " loads and eliminate " << deadStoreTimes << " stores\n\r";
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
+}
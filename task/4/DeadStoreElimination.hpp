@@ -0,0 +1,20 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 死存储删除与存储到读取的转发，内存位置按“基址 + 常量偏移”区分，可以处理常量下标访问的局部数组与全局数组：
+//   - load 沿前驱向上找最近的写入，单前驱直接取值，多个前驱都能取到值时在汇合处插入 phi；
+//   - store 之后的每条路径上，在可能读取之前都被同一位置的 store 覆盖，或者到达函数出口时内存已不可见，则删除。
+class DeadStoreElimination : public llvm::PassInfoMixin<DeadStoreElimination>
+{
+  public:
+    explicit DeadStoreElimination(llvm::raw_ostream &out) : mOut(out)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+};
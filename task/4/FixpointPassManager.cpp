@@ -0,0 +1,361 @@
+#include "FixpointPassManager.hpp"
+
+#include <algorithm>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <thread>
+
+using namespace llvm;
+
+namespace {
+
+struct WorkerResult
+{
+    std::string log;
+    std::vector<bool> fired;
+    std::vector<std::string> changed;
+    SmallVector<char, 0> bitcode;
+    std::vector<PassRecord> records;
+};
+
+uint64_t countInstructions(const std::vector<Function *> &funcs)
+{
+    uint64_t count = 0;
+    for (auto *func : funcs)
+        count += func->getInstructionCount();
+    return count;
+}
+
+} // namespace
+
+void FixpointPassManager::runParallel(Module &mod, ModuleAnalysisManager &mam, unsigned round, size_t begin,
+                                      size_t end, const std::vector<bool> &needed, std::vector<bool> &fired)
+{
+    // 按指令数从大到小，依次分给当前负载最小的线程
+    std::vector<std::pair<unsigned, std::string>> funcs;
+    for (auto &func : mod)
+        if (!func.isDeclaration() && func.hasName())
+            funcs.push_back({func.getInstructionCount(), func.getName().str()});
+    std::sort(funcs.begin(), funcs.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+
+    unsigned workers = std::min<size_t>(mThreads, funcs.size());
+    if (!workers)
+        return;
+    std::vector<std::vector<std::string>> parts(workers);
+    std::vector<unsigned> load(workers, 0);
+    for (auto &[size, name] : funcs)
+    {
+        unsigned w = std::min_element(load.begin(), load.end()) - load.begin();
+        parts[w].push_back(name);
+        load[w] += size;
+    }
+
+    SmallVector<char, 0> input;
+    {
+        raw_svector_ostream os(input);
+        WriteBitcodeToFile(mod, os);
+    }
+    StringRef inputRef(input.data(), input.size());
+
+    std::vector<WorkerResult> results(workers);
+    std::vector<std::thread> threads;
+    for (unsigned w = 0; w < workers; ++w)
+    {
+        threads.emplace_back([&, w] {
+            WorkerResult &res = results[w];
+            res.fired.assign(end - begin, false);
+            raw_string_ostream log(res.log);
+
+            LLVMContext ctx;
+            auto modOrErr = parseBitcodeFile(MemoryBufferRef(inputRef, "worker"), ctx);
+            if (!modOrErr)
+            {
+                log << "FixpointPassManager worker " << w << ": " << toString(modOrErr.takeError()) << "\n\r";
+                return;
+            }
+            Module &copy = **modOrErr;
+
+            LoopAnalysisManager lam;
+            FunctionAnalysisManager fam;
+            CGSCCAnalysisManager cgam;
+            ModuleAnalysisManager wmam;
+            PassBuilder pb;
+            pb.registerModuleAnalyses(wmam);
+            pb.registerCGSCCAnalyses(cgam);
+            pb.registerFunctionAnalyses(fam);
+            pb.registerLoopAnalyses(lam);
+            pb.crossRegisterProxies(lam, fam, cgam, wmam);
+
+            std::vector<Function *> mine;
+            for (auto &name : parts[w])
+                mine.push_back(copy.getFunction(name));
+
+            // 只在前面有pass改动过本线程的函数时，才重新运行原本干净的pass
+            std::vector<bool> changed(mine.size(), false);
+            bool anyFired = false;
+            for (size_t i = begin; i < end; ++i)
+            {
+                if (!needed[i - begin] && !anyFired)
+                    continue;
+                for (auto &require : mPasses[i].requiredAnalyses)
+                    require(copy, wmam, true);
+                FunctionPassManager fpm;
+                mPasses[i].addToFunctionPM(fpm, log);
+                uint64_t instsBefore = mStats ? countInstructions(mine) : 0;
+                PassRecord record = PassStatistics::measure(mPasses[i].name, round, w + 1, [&] {
+                    for (size_t j = 0; j < mine.size(); ++j)
+                    {
+                        if (fpm.run(*mine[j], fam).areAllPreserved())
+                            continue;
+                        res.fired[i - begin] = true;
+                        changed[j] = true;
+                    }
+                });
+                anyFired |= res.fired[i - begin];
+                if (mStats)
+                {
+                    record.instsBefore = instsBefore;
+                    record.instsAfter = countInstructions(mine);
+                    record.changed = res.fired[i - begin];
+                    res.records.push_back(std::move(record));
+                }
+            }
+
+            // 只把改动过的函数体写回
+            for (size_t j = 0; j < mine.size(); ++j)
+                if (changed[j])
+                    res.changed.push_back(parts[w][j]);
+            if (res.changed.empty())
+                return;
+            for (auto &func : copy)
+                if (!func.isDeclaration() && std::find(res.changed.begin(), res.changed.end(), func.getName()) ==
+                                                 res.changed.end())
+                    func.deleteBody();
+            raw_svector_ostream os(res.bitcode);
+            WriteBitcodeToFile(copy, os);
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    auto &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(mod).getManager();
+    bool anyChanged = false;
+    for (auto &res : results)
+    {
+        mOut << res.log;
+        if (mStats)
+            for (auto &record : res.records)
+                mStats->add(std::move(record));
+        for (size_t i = 0; i < res.fired.size(); ++i)
+            if (res.fired[i])
+                fired[i] = true;
+        if (res.changed.empty())
+            continue;
+
+        // 在主 LLVMContext 中解析工作线程的结果，类型与常量因此与主模块共享
+        auto modOrErr = parseBitcodeFile(MemoryBufferRef(StringRef(res.bitcode.data(), res.bitcode.size()), "worker"),
+                                         mod.getContext());
+        if (!modOrErr)
+            report_fatal_error(modOrErr.takeError());
+        Module &copy = **modOrErr;
+        for (auto &global : copy.globals())
+            global.dropAllReferences();
+
+        for (auto &name : res.changed)
+        {
+            Function *dst = mod.getFunction(name);
+            Function *src = copy.getFunction(name);
+            dst->dropAllReferences();
+            while (!src->empty())
+            {
+                BasicBlock &bb = src->front();
+                bb.removeFromParent();
+                bb.insertInto(dst);
+            }
+            for (unsigned i = 0; i < src->arg_size(); ++i)
+                src->getArg(i)->replaceAllUsesWith(dst->getArg(i));
+            fam.clear(*dst, dst->getName());
+        }
+
+        // 搬过来的指令仍引用副本中的全局变量和函数，换成主模块中的同名对象
+        for (auto &gv : copy.global_values())
+        {
+            if (gv.use_empty())
+                continue;
+            GlobalValue *target = mod.getNamedValue(gv.getName());
+            if (!target)
+            {
+                auto *func = dyn_cast<Function>(&gv);
+                if (!func)
+                    report_fatal_error("FixpointPassManager: worker introduced global " + gv.getName());
+                target = cast<Function>(
+                    mod.getOrInsertFunction(func->getName(), func->getFunctionType(), func->getAttributes())
+                        .getCallee());
+            }
+            gv.replaceAllUsesWith(target);
+        }
+        anyChanged = true;
+    }
+
+    if (anyChanged)
+    {
+        // 函数级分析已按函数清除，模块级分析（如 StaticCallCounter）需要重新计算
+        PreservedAnalyses pa;
+        pa.preserveSet<AllAnalysesOn<Function>>();
+        pa.preserve<FunctionAnalysisManagerModuleProxy>();
+        mam.invalidate(mod, pa);
+    }
+}
+
+unsigned FixpointPassManager::run(Module &mod, ModuleAnalysisManager &mam)
+{
+    // 模块版本号：每当有pass改动IR时加一
+    unsigned version = 0;
+    // 每个pass最近一次“无改动”运行时的模块版本号，-1 表示必须运行
+    std::vector<unsigned> cleanAt(mPasses.size(), -1U);
+
+    unsigned round = 0;
+    while (round < mMaxIterations)
+    {
+        ++round;
+        std::vector<StringRef> fired;
+        unsigned skipped = 0;
+
+        for (size_t i = 0; i < mPasses.size();)
+        {
+            if (mPasses[i].late)
+            {
+                ++i;
+                continue;
+            }
+
+            if (mThreads > 1 && mPasses[i].addToFunctionPM)
+            {
+                // 连续的函数级pass作为一组并行运行
+                size_t end = i;
+                while (end < mPasses.size() && mPasses[end].addToFunctionPM && !mPasses[end].late)
+                    ++end;
+                std::vector<bool> needed(end - i), groupFired(end - i, false);
+                for (size_t k = i; k < end; ++k)
+                    needed[k - i] = cleanAt[k] != version;
+                if (std::find(needed.begin(), needed.end(), true) != needed.end())
+                    runParallel(mod, mam, round, i, end, needed, groupFired);
+
+                unsigned firedCount = std::count(groupFired.begin(), groupFired.end(), true);
+                bool earlierFired = false;
+                for (size_t k = i; k < end; ++k)
+                {
+                    if (!needed[k - i] && !earlierFired)
+                        ++skipped;
+                    if (groupFired[k - i])
+                        fired.push_back(mPasses[k].name);
+                    earlierFired |= groupFired[k - i];
+                }
+                // 组内某个pass之后又有pass改动了IR，它就不再是干净的
+                bool laterFired = false;
+                for (size_t k = end; k-- > i;)
+                {
+                    laterFired |= groupFired[k - i];
+                    cleanAt[k] = laterFired ? -1U : version + firedCount;
+                }
+                version += firedCount;
+                i = end;
+                continue;
+            }
+
+            // 输入自上次运行以来没有变化，再次运行也不会有改动
+            if (cleanAt[i] == version)
+            {
+                ++skipped;
+                ++i;
+                continue;
+            }
+
+            PreservedAnalyses pa;
+            uint64_t instsBefore = mStats ? mod.getInstructionCount() : 0;
+            PassRecord record = PassStatistics::measure(mPasses[i].name, round, 0,
+                                                        [&] { pa = runEntry(mPasses[i], mod, mam); });
+            if (mStats)
+            {
+                record.instsBefore = instsBefore;
+                record.instsAfter = mod.getInstructionCount();
+                record.changed = !pa.areAllPreserved();
+                mStats->add(std::move(record));
+            }
+            if (pa.areAllPreserved())
+            {
+                cleanAt[i] = version;
+            }
+            else
+            {
+                ++version;
+                cleanAt[i] = -1U;
+                fired.push_back(mPasses[i].name);
+            }
+            ++i;
+        }
+
+        mOut << "FixpointPassManager round " << round << ": ";
+        if (fired.empty())
+            mOut << "no change";
+        else
+            for (size_t i = 0; i < fired.size(); ++i)
+                mOut << (i ? ", " : "") << fired[i];
+        mOut << " (" << skipped << " skipped)\n\r";
+
+        if (fired.empty())
+        {
+            runLate(mod, mam, round);
+            return round;
+        }
+    }
+
+    mOut << "FixpointPassManager: iteration cap " << mMaxIterations << " reached before fixpoint\n\r";
+    runLate(mod, mam, round);
+    return round;
+}
+
+PreservedAnalyses FixpointPassManager::runEntry(Entry &entry, Module &mod, ModuleAnalysisManager &mam)
+{
+    for (auto &require : entry.requiredAnalyses)
+        require(mod, mam, true);
+    PreservedAnalyses pa = entry.pm->run(mod, mam);
+    for (auto &require : entry.requiredAnalyses)
+        require(mod, mam, false);
+    return pa;
+}
+
+void FixpointPassManager::runLate(Module &mod, ModuleAnalysisManager &mam, unsigned round)
+{
+    std::vector<StringRef> fired;
+    bool any = false;
+    for (auto &entry : mPasses)
+    {
+        if (!entry.late)
+            continue;
+        any = true;
+        PreservedAnalyses pa;
+        uint64_t instsBefore = mStats ? mod.getInstructionCount() : 0;
+        PassRecord record = PassStatistics::measure(entry.name, round + 1, 0, [&] { pa = runEntry(entry, mod, mam); });
+        if (mStats)
+        {
+            record.instsBefore = instsBefore;
+            record.instsAfter = mod.getInstructionCount();
+            record.changed = !pa.areAllPreserved();
+            mStats->add(std::move(record));
+        }
+        if (!pa.areAllPreserved())
+            fired.push_back(entry.name);
+    }
+    if (!any)
+        return;
+
+    mOut << "FixpointPassManager late passes: ";
+    if (fired.empty())
+        mOut << "no change";
+    else
+        for (size_t i = 0; i < fired.size(); ++i)
+            mOut << (i ? ", " : "") << fired[i];
+    mOut << "\n\r";
+}
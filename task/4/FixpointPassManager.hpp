@@ -0,0 +1,113 @@
+#pragma once
+
+#include "PassStatistics.hpp"
+#include <functional>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// 不动点调度器：反复运行流水线，直到一整轮没有任何pass改变模块。
+// pass 通过返回的 PreservedAnalyses 报告是否改动了IR（未全部保留即视为改动）。
+// 若自某个pass上一次“无改动”运行以来模块没有再变化，则跳过该pass。
+//
+// 函数级pass通过 addFunctionPass 添加。threads > 1 时，流水线中连续的函数级pass
+// 组成一组并行执行：LLVMContext 不是线程安全的，因此模块先写成 bitcode，
+// 每个工作线程在自己的 LLVMContext 中解析一份副本，只处理分到的函数，
+// 再把改动过的函数体搬回主模块。
+class FixpointPassManager
+{
+  public:
+    explicit FixpointPassManager(llvm::raw_ostream &out, unsigned maxIterations = 50, unsigned threads = 1)
+        : mOut(out), mMaxIterations(maxIterations), mThreads(threads ? threads : 1)
+    {
+    }
+
+    template <typename PassT> void addPass(PassT &&pass)
+    {
+        auto mpm = std::make_unique<llvm::ModulePassManager>();
+        mpm->addPass(std::forward<PassT>(pass));
+        mPasses.push_back({std::remove_reference_t<PassT>::name().str(), std::move(mpm), nullptr});
+    }
+
+    // 函数级pass需要在每个工作线程中各构造一份，因此按类型添加，其余构造参数按值保存
+    template <typename PassT, typename... ArgsT> void addFunctionPass(ArgsT... args)
+    {
+        auto addTo = [args...](llvm::FunctionPassManager &fpm, llvm::raw_ostream &out) {
+            if constexpr (std::is_constructible_v<PassT, llvm::raw_ostream &, ArgsT...>)
+                fpm.addPass(PassT(out, args...));
+            else
+                fpm.addPass(PassT(args...));
+        };
+        llvm::FunctionPassManager fpm;
+        addTo(fpm, mOut);
+        auto mpm = std::make_unique<llvm::ModulePassManager>();
+        mpm->addPass(llvm::createModuleToFunctionPassAdaptor(std::move(fpm)));
+        mPasses.push_back({PassT::name().str(), std::move(mpm), addTo});
+    }
+
+    // 最近添加的pass要读取的模块级分析。函数级pass只能通过 ModuleAnalysisManagerFunctionProxy
+    // 取到已缓存、且不随函数改动作废的模块级分析结果，因此在pass运行前（包括每个工作线程中）重新计算，
+    // 运行后立即丢弃，结果只在这一次运行期间有效
+    template <typename AnalysisT> void requireModuleAnalysis()
+    {
+        mPasses.back().requiredAnalyses.push_back(
+            [](llvm::Module &mod, llvm::ModuleAnalysisManager &mam, bool compute) {
+                mam.registerPass([] { return AnalysisT(); });
+                llvm::PreservedAnalyses pa = llvm::PreservedAnalyses::all();
+                pa.abandon<AnalysisT>();
+                mam.invalidate(mod, pa);
+                if (compute)
+                    mam.getResult<AnalysisT>(mod);
+            });
+    }
+
+    // 收尾pass：不参与不动点迭代，在其余pass收敛之后按添加顺序各运行一次。
+    // 用于会破坏其它pass所识别形式的变换（如 LoopStrengthReduction 生成的指针 phi）
+    template <typename PassT, typename... ArgsT> void addLateFunctionPass(ArgsT... args)
+    {
+        addFunctionPass<PassT>(args...);
+        mPasses.back().late = true;
+    }
+
+    // 设置后，每个pass的每次运行都记录到 stats 中
+    void setStatistics(PassStatistics *stats)
+    {
+        mStats = stats;
+    }
+
+    // 返回实际运行的轮数
+    unsigned run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+
+  private:
+    struct Entry
+    {
+        std::string name;
+        std::unique_ptr<llvm::ModulePassManager> pm;
+        // 仅函数级pass非空：向工作线程的 FunctionPassManager 添加一份新的pass
+        std::function<void(llvm::FunctionPassManager &, llvm::raw_ostream &)> addToFunctionPM;
+        // requireModuleAnalysis 登记的分析：丢弃缓存的结果，compute 为真时再重新计算
+        std::vector<std::function<void(llvm::Module &, llvm::ModuleAnalysisManager &, bool compute)>>
+            requiredAnalyses;
+        bool late = false;
+    };
+
+    // 运行 entry，前后准备与丢弃它要求的模块级分析
+    llvm::PreservedAnalyses runEntry(Entry &entry, llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+
+    // 不动点收敛之后依次运行收尾pass
+    void runLate(llvm::Module &mod, llvm::ModuleAnalysisManager &mam, unsigned round);
+
+    // 并行运行 [begin, end) 中的函数级pass，fired[i] 记录第 begin+i 个pass是否改动了IR
+    void runParallel(llvm::Module &mod, llvm::ModuleAnalysisManager &mam, unsigned round, size_t begin, size_t end,
+                     const std::vector<bool> &needed, std::vector<bool> &fired);
+
+    llvm::raw_ostream &mOut;
+    unsigned mMaxIterations;
+    unsigned mThreads;
+    std::vector<Entry> mPasses;
+    PassStatistics *mStats = nullptr;
+};
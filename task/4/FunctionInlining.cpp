@@ -1,170 +1,177 @@
 #include "FunctionInlining.hpp"
+#include "ChangeSet.hpp"
+#include "PassStatistics.hpp"
+#include "StaticCallCounter.hpp"
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/IntrinsicInst.h>
 
 using namespace llvm;
 
-PreservedAnalyses FunctionInlining::run(Module &mod, ModuleAnalysisManager &mam)
+namespace {
+
+// 调用指令本身的代价：参数传递、保存现场与跳转
+constexpr int kCallCost = 4;
+// 常量实参使被调用者中的一条指令可以折叠
+constexpr int kConstantArgBonus = 1;
+// 常量实参参与比较时，整条分支都可能被消去
+constexpr int kConstantBranchBonus = 5;
+// 被调用者只有这一个调用点，内联后可以删除
+constexpr int kLastCallBonus = 300;
+// 调用者内联后的指令数上限
+constexpr int kMaxCallerSize = 4000;
+
+int getInstructionCost(const Instruction &inst)
 {
-    int inlineTimes = 0;
-    std::map<Function *, std::vector<Instruction *>> smallFuncs;
-    std::vector<CallInst *> calls;
+    if (isa<PHINode>(inst) || isa<DbgInfoIntrinsic>(inst) || isa<AllocaInst>(inst) || isa<BitCastInst>(inst) ||
+        isa<ReturnInst>(inst))
+        return 0;
+    if (auto *br = dyn_cast<BranchInst>(&inst))
+        return br->isConditional() ? 1 : 0;
+    if (auto *call = dyn_cast<CallBase>(&inst))
+        return kCallCost + call->arg_size();
+    return 1;
+}
+
+int getFunctionCost(const Function &func)
+{
+    int cost = 0;
+    for (auto &bb : func)
+        for (auto &inst : bb)
+            cost += getInstructionCost(inst);
+    return cost;
+}
 
-    // 遍历所有函数，找到足够小的函数
-    for (auto &func : mod)
+// 常量实参可能折叠掉的代价
+int getConstantArgBonus(const CallBase &call, const Function &callee)
+{
+    int bonus = 0;
+    for (unsigned i = 0; i < call.arg_size(); ++i)
     {
-        if (func.isDeclaration())
+        if (!isa<Constant>(call.getArgOperand(i)))
             continue;
-        std::vector<Instruction *> insts;
-        bool hasCall = false;
-
-        for (auto &bb : func)
+        for (const User *user : callee.getArg(i)->users())
         {
-            for (auto &inst : bb)
-            {
-                if (auto *callInst = dyn_cast<CallInst>(&inst))
-                {
-                    hasCall = true;
-                    break;
-                }
-                if (auto *brInst = dyn_cast<BranchInst>(&inst))
-                {
-                    if (brInst->isConditional())
-                    {
-                        hasCall = true;
-                        break;
-                    }
-                }
-                insts.push_back(&inst);
-            }
+            bonus += kConstantArgBonus;
+            if (isa<ICmpInst>(user) || isa<SwitchInst>(user))
+                bonus += kConstantBranchBonus;
         }
+    }
+    return bonus;
+}
+
+bool isInlinable(const CallBase &call, const Function *callee)
+{
+    return callee && !callee->isDeclaration() && !callee->isVarArg() && !call.isNoInline() &&
+           call.getFunctionType() == callee->getFunctionType();
+}
+
+} // namespace
+
+PreservedAnalyses FunctionInlining::run(Module &mod, ModuleAnalysisManager &mam)
+{
+    int inlineTimes = 0;
+    ChangeSet changes(mod, mam);
+    auto &fam = mam.getResult<FunctionAnalysisManagerModuleProxy>(mod).getManager();
+    // 调用点个数在内联过程中随时更新
+    auto callCounts = mam.getResult<StaticCallCounter>(mod);
 
-        // 函数足够小且没有函数调用
-        if (insts.size() < 1145141919810 && !hasCall)
+    // clang -O0 给每个函数加上 noinline optnone，只说明前端没有优化，不是源程序的要求，一并去掉
+    // （verifier 要求 optnone 与 noinline 同时出现）；之后只有本 pass 标在调用点上的 noinline 阻止内联
+    int attrTimes = 0;
+    for (Function &func : mod)
+        if (!func.isDeclaration() && func.hasFnAttribute(Attribute::NoInline))
         {
-            smallFuncs[&func] = insts;
+            func.removeFnAttr(Attribute::NoInline);
+            func.removeFnAttr(Attribute::OptimizeNone);
+            ++attrTimes;
         }
-    }
 
-    // 遍历所有函数，找到调用小函数指令
-    for (auto &func : mod)
+    // 强连通分量按逆拓扑序给出，即被调用者在前
+    CallGraph callGraph(mod);
+    std::vector<std::vector<Function *>> sccs;
+    DenseMap<const Function *, unsigned> sccIndex;
+    DenseSet<const Function *> recursive;
+    for (auto it = scc_begin(&callGraph); !it.isAtEnd(); ++it)
     {
-        if (func.isDeclaration())
-            continue;
-        for (auto &bb : func)
-        {
-            for (auto &inst : bb)
+        std::vector<Function *> scc;
+        for (CallGraphNode *node : *it)
+            if (Function *func = node->getFunction())
             {
-                if (auto *callInst = dyn_cast<CallInst>(&inst))
-                {
-                    Function *callee = callInst->getCalledFunction();
-                    if (callee && smallFuncs.find(callee) != smallFuncs.end())
-                    {
-                        calls.push_back(callInst);
-                    }
-                }
+                sccIndex[func] = sccs.size();
+                scc.push_back(func);
+                if (it.hasCycle())
+                    recursive.insert(func);
             }
-        }
+        sccs.push_back(std::move(scc));
     }
 
-    // 替换函数调用指令
-    for (auto *callInst : calls)
+    for (auto &scc : sccs)
     {
-        Function *callee = callInst->getCalledFunction();
-        llvm::IRBuilder<> builder(callInst->getNextNode());
-        std::map<Value *, Value *> paramMap;
-
-        for (unsigned i = 0; i < callInst->arg_size(); ++i)
-        {
-            paramMap[callee->getArg(i)] = callInst->getArgOperand(i);
-        }
-
-        Value *retVal = nullptr;
-        bool encounteredError = false;
-
-        // 替换函数调用指令
-        for (auto *inst : smallFuncs[callee])
+        for (Function *caller : scc)
         {
-            if (auto *retInst = dyn_cast<ReturnInst>(inst))
-            {
-                if (!callee->getReturnType()->isVoidTy())
-                {
-                    retVal = paramMap.find(retInst->getReturnValue()) != paramMap.end()
-                                 ? paramMap[retInst->getReturnValue()]
-                                 : retInst->getReturnValue();
-                }
+            if (caller->isDeclaration())
                 continue;
-            }
 
-            Value *operand0 = (paramMap.find(inst->getOperand(0)) != paramMap.end()) ? paramMap[inst->getOperand(0)]
-                                                                                     : inst->getOperand(0);
-            Value *operand1 = inst->getNumOperands() > 1 ? (paramMap.find(inst->getOperand(1)) != paramMap.end())
-                                                               ? paramMap[inst->getOperand(1)]
-                                                               : inst->getOperand(1)
-                                                         : nullptr;
+            // 先收集调用点和所在的循环深度，内联会使循环信息失效
+            LoopInfo &LI = fam.getResult<LoopAnalysis>(*caller);
+            std::vector<std::pair<CallBase *, unsigned>> calls;
+            for (auto &bb : *caller)
+                for (auto &inst : bb)
+                    if (auto *call = dyn_cast<CallBase>(&inst))
+                        if (isInlinable(*call, call->getCalledFunction()) &&
+                            sccIndex.lookup(call->getCalledFunction()) != sccIndex.lookup(caller))
+                            calls.push_back({call, LI.getLoopDepth(&bb)});
 
-            switch (inst->getOpcode())
+            int callerCost = getFunctionCost(*caller);
+            bool changed = false;
+            for (auto &[call, depth] : calls)
             {
-            case Instruction::Add:
-                paramMap[inst] = builder.CreateAdd(operand0, operand1, "add");
-                break;
-            case Instruction::Sub:
-                paramMap[inst] = builder.CreateSub(operand0, operand1, "sub");
-                break;
-            case Instruction::Mul:
-                paramMap[inst] = builder.CreateMul(operand0, operand1, "mul");
-                break;
-            case Instruction::SDiv:
-                paramMap[inst] = builder.CreateSDiv(operand0, operand1, "sdiv");
-                break;
-            case Instruction::UDiv:
-                paramMap[inst] = builder.CreateUDiv(operand0, operand1, "udiv");
-                break;
-            case Instruction::SRem:
-                paramMap[inst] = builder.CreateSRem(operand0, operand1, "srem");
-                break;
-            case Instruction::Shl:
-                paramMap[inst] = builder.CreateShl(operand0, operand1, "shl");
-                break;
-            case Instruction::LShr:
-                paramMap[inst] = builder.CreateLShr(operand0, operand1, "lshr");
-                break;
-            case Instruction::AShr:
-                paramMap[inst] = builder.CreateAShr(operand0, operand1, "ashr");
-                break;
-            case Instruction::And:
-                paramMap[inst] = builder.CreateAnd(operand0, operand1, "and");
-                break;
-            case Instruction::Or:
-                paramMap[inst] = builder.CreateOr(operand0, operand1, "or");
-                break;
-            case Instruction::Xor:
-                paramMap[inst] = builder.CreateXor(operand0, operand1, "xor");
-                break;
-            case Instruction::Alloca:
-                paramMap[inst] = builder.CreateAlloca(inst->getType(), nullptr, "alloca");
-                break;
-            case Instruction::Load:
-                paramMap[inst] = builder.CreateLoad(Type::getInt32Ty(operand0->getContext()), operand0);
-                break;
-            case Instruction::Store:
-                paramMap[inst] = builder.CreateStore(operand0, operand1);
-                break;
-            default:
-                encounteredError = true;
-                break;
-            }
-        }
+                Function *callee = call->getCalledFunction();
+                int cost = getFunctionCost(*callee) - kCallCost - (int)call->arg_size();
+                int threshold = mThreshold;
+                // 循环中的调用点更热，每层循环阈值提高一半
+                threshold += threshold * std::min(depth, 3U) / 2;
+                if (callCounts.lookup(callee) == 1 && !callee->hasAddressTaken() && callee->getName() != "main")
+                    threshold += kLastCallBonus;
+                cost -= getConstantArgBonus(*call, *callee);
+                if (cost > threshold || callerCost + cost > kMaxCallerSize)
+                    continue;
 
-        if (!encounteredError)
-        {
-            if (retVal)
-            {
-                callInst->replaceAllUsesWith(retVal);
+                InlineFunctionInfo ifi;
+#if LLVM_VERSION_MAJOR >= 15
+                InlineResult result = InlineFunction(*call, ifi, false, nullptr, false);
+#else
+                InlineResult result = InlineFunction(*call, ifi, nullptr, false);
+#endif
+                if (!result.isSuccess())
+                    continue;
+
+                --callCounts[callee];
+                for (CallBase *newCall : ifi.InlinedCallSites)
+                {
+                    if (!newCall->getCalledFunction())
+                        continue;
+                    ++callCounts[newCall->getCalledFunction()];
+                    // 递归函数每个调用点只展开一层
+                    if (recursive.count(newCall->getCalledFunction()))
+                        newCall->setIsNoInline();
+                }
+                callerCost += cost;
+                changed = true;
+                ++inlineTimes;
             }
-            callInst->eraseFromParent();
-            ++inlineTimes;
+            if (changed)
+                changes.changeCFG(*caller);
         }
     }
 
+    if (!inlineTimes && !attrTimes)
+        return PreservedAnalyses::all();
+    changes.changeModule();
+    PassStatistics::count("calls inlined", inlineTimes);
     mOut << "FunctionInlining running...\n\rInline " << inlineTimes << " functions\n\r";
-    return PreservedAnalyses::all();
+    return changes.result();
 }
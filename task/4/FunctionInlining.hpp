@@ -6,10 +6,15 @@
 #include <llvm/Transforms/Utils/Cloning.h>
 #include "map"
 
+// 自底向上的函数内联：按调用图的强连通分量逆拓扑序处理，被调用者总是先于调用者完成内联。
+// 每个调用点估计被调用者内联后的代价（按指令计数，常量实参可能折叠掉的指令从代价中扣除），
+// 不超过阈值时内联。位于循环中的调用点阈值按循环深度提高；StaticCallCounter 统计只有一个调用点的函数
+// 内联后可以整体删除，阈值额外放宽。同一强连通分量内的调用不内联；递归函数内联后留下的递归调用标记为
+// noinline，避免在后续轮次中无限展开。前端给函数加上的 noinline 与 optnone 在内联之前去掉。
 class FunctionInlining : public llvm::PassInfoMixin<FunctionInlining>
 {
   public:
-    explicit FunctionInlining(llvm::raw_ostream &out) : mOut(out)
+    FunctionInlining(llvm::raw_ostream &out, unsigned threshold) : mOut(out), mThreshold(threshold)
     {
     }
 
@@ -17,4 +22,5 @@ class FunctionInlining : public llvm::PassInfoMixin<FunctionInlining>
 
   private:
     llvm::raw_ostream &mOut;
+    unsigned mThreshold;
 };
@@ -0,0 +1,115 @@
+#include "FunctionPurity.hpp"
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Analysis/CFG.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/IntrinsicInst.h>
+
+using namespace llvm;
+
+namespace {
+
+// 指针指向 func 自己的栈变量
+bool isLocal(const Value *ptr, const Function &func)
+{
+    auto *alloca = dyn_cast<AllocaInst>(getUnderlyingObject(ptr));
+    return alloca && alloca->getFunction() == &func;
+}
+
+// 指针指向本函数的栈变量或常量全局变量，读取它不依赖外部状态
+bool isReadOnlySource(const Value *ptr, const Function &func)
+{
+    if (isLocal(ptr, func))
+        return true;
+    auto *global = dyn_cast<GlobalVariable>(getUnderlyingObject(ptr));
+    return global && global->isConstant();
+}
+
+// scc 中的函数都假设为纯时，inst 是否仍然没有外部可见的读写
+bool isPureInstruction(const Instruction &inst, const Function &func, const FunctionPurity::Result &result,
+                       const SmallPtrSetImpl<const Function *> &scc)
+{
+    if (auto *load = dyn_cast<LoadInst>(&inst))
+        return load->isSimple() && isReadOnlySource(load->getPointerOperand(), func);
+    if (auto *store = dyn_cast<StoreInst>(&inst))
+        return store->isSimple() && isLocal(store->getPointerOperand(), func);
+    if (auto *memset = dyn_cast<MemSetInst>(&inst))
+        return !memset->isVolatile() && isLocal(memset->getDest(), func);
+    if (auto *memcpy = dyn_cast<MemTransferInst>(&inst))
+        return !memcpy->isVolatile() && isLocal(memcpy->getDest(), func) &&
+               isReadOnlySource(memcpy->getSource(), func);
+    if (auto *call = dyn_cast<CallBase>(&inst))
+    {
+        const Function *callee = call->getCalledFunction();
+        return callee && (scc.count(callee) || result.isPure(callee));
+    }
+    return !inst.mayReadOrWriteMemory();
+}
+
+// 纯函数 func 不在调用环上时，是否可推测执行
+bool isSpeculatableBody(const Function &func, const FunctionPurity::Result &result)
+{
+    // 有环的函数不一定终止
+    SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 4> backEdges;
+    FindFunctionBackedges(func, backEdges);
+    if (!backEdges.empty())
+        return false;
+    for (auto &bb : func)
+        for (auto &inst : bb)
+        {
+            if (isa<UnreachableInst>(inst))
+                return false;
+            if (auto *call = dyn_cast<CallBase>(&inst))
+            {
+                if (!result.isSpeculatable(call->getCalledFunction()))
+                    return false;
+                continue;
+            }
+            // 纯函数的 store 只写自己的栈变量
+            if (inst.isTerminator() || isa<PHINode>(inst) || isa<AllocaInst>(inst) || isa<StoreInst>(inst))
+                continue;
+            if (!isSafeToSpeculativelyExecute(&inst))
+                return false;
+        }
+    return true;
+}
+
+} // namespace
+
+FunctionPurity::Result FunctionPurity::run(Module &mod, ModuleAnalysisManager &)
+{
+    Result result;
+
+    // 强连通分量按逆拓扑序给出，即被调用者在前
+    CallGraph callGraph(mod);
+    for (auto it = scc_begin(&callGraph); !it.isAtEnd(); ++it)
+    {
+        SmallPtrSet<const Function *, 4> scc;
+        for (CallGraphNode *node : *it)
+            if (Function *func = node->getFunction())
+                scc.insert(func);
+        if (scc.empty())
+            continue;
+        if (it.hasCycle())
+            result.recursive.insert(scc.begin(), scc.end());
+
+        bool pure = all_of(scc, [&](const Function *func) {
+            if (func->isDeclaration())
+                return false;
+            for (auto &bb : *func)
+                for (auto &inst : bb)
+                    if (!isPureInstruction(inst, *func, result, scc))
+                        return false;
+            return true;
+        });
+        if (!pure)
+            continue;
+        result.pure.insert(scc.begin(), scc.end());
+        // 不在环上的分量只有一个函数
+        if (!it.hasCycle() && isSpeculatableBody(**scc.begin(), result))
+            result.speculatable.insert(*scc.begin());
+    }
+    return result;
+}
+
+AnalysisKey FunctionPurity::Key;
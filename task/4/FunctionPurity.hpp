@@ -0,0 +1,53 @@
+#pragma once
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/PassManager.h>
+
+// 过程间纯函数分析：按调用图的强连通分量自底向上，函数只读写自己的栈变量（可以读常量全局变量）、
+// 只调用纯函数时为纯，同一分量内的递归调用先假设为纯，整个分量都满足时才成立。
+// 纯函数没有副作用，结果只由实参决定。结果同时记录处在调用环上的函数。
+// 不在调用环上、控制流无环、每条指令都可以推测执行的纯函数是可推测执行的：不会出错、一定返回，
+// 提前到原来不会执行的位置调用也没有影响。
+// 函数声明按属性判断：不访问内存且一定返回时为纯，再有 speculatable 属性时可推测执行。
+// 函数级pass通过 ModuleAnalysisManagerFunctionProxy 读取结果，按其约定结果不随 IR 的改动作废，
+// 只在被显式放弃时作废：由 FixpointPassManager::requireModuleAnalysis 在需要它的pass运行前重新计算、运行后丢弃。
+class FunctionPurity : public llvm::AnalysisInfoMixin<FunctionPurity>
+{
+  public:
+    struct Result
+    {
+        llvm::SmallPtrSet<const llvm::Function *, 16> pure;
+        llvm::SmallPtrSet<const llvm::Function *, 16> recursive;
+        llvm::SmallPtrSet<const llvm::Function *, 16> speculatable;
+
+        bool isPure(const llvm::Function *func) const
+        {
+            if (func->isDeclaration())
+                return func->doesNotAccessMemory() && func->willReturn();
+            return pure.count(func);
+        }
+
+        bool isSpeculatable(const llvm::Function *func) const
+        {
+            if (func->isDeclaration())
+                return isPure(func) && func->isSpeculatable();
+            return speculatable.count(func);
+        }
+
+        bool isRecursive(const llvm::Function *func) const
+        {
+            return recursive.count(func);
+        }
+
+        bool invalidate(llvm::Module &, const llvm::PreservedAnalyses &pa, llvm::ModuleAnalysisManager::Invalidator &)
+        {
+            return !pa.getChecker<FunctionPurity>().preservedWhenStateless();
+        }
+    };
+
+    Result run(llvm::Module &mod, llvm::ModuleAnalysisManager &);
+
+  private:
+    static llvm::AnalysisKey Key;
+    friend struct llvm::AnalysisInfoMixin<FunctionPurity>;
+};
@@ -0,0 +1,370 @@
+#include "IfCombining.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/Analysis/CFG.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/ConstantRange.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/PatternMatch.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+namespace {
+
+// 每个分支臂最多提前执行的指令数
+constexpr unsigned kMaxSpeculated = 4;
+// 汇合处最多换成 select 的 phi 数
+constexpr unsigned kMaxSelects = 4;
+
+BranchInst *getConditionalBranch(BasicBlock *bb)
+{
+    auto *br = dyn_cast<BranchInst>(bb->getTerminator());
+    if (!br || !br->isConditional() || isa<Constant>(br->getCondition()) || br->getSuccessor(0) == br->getSuccessor(1))
+        return nullptr;
+    return br;
+}
+
+// bb 没有 phi，除跳转外只有少量可以提前执行的指令
+bool isSpeculatable(BasicBlock *bb)
+{
+    if (isa<PHINode>(bb->front()))
+        return false;
+    unsigned count = 0;
+    for (auto &inst : *bb)
+    {
+        if (inst.isTerminator())
+            break;
+        if (++count > kMaxSpeculated || !isSafeToSpeculativelyExecute(&inst))
+            return false;
+    }
+    return true;
+}
+
+void hoistBefore(BasicBlock *from, Instruction *pos)
+{
+    for (auto &inst : make_early_inc_range(*from))
+        if (!inst.isTerminator())
+            inst.moveBefore(pos);
+}
+
+// 支配 bb 的某条边已经决定了 bb 的分支条件时，返回条件的值
+Optional<bool> getDominatingCondition(BasicBlock *bb, Value *cond, DominatorTree &DT, const DataLayout &DL)
+{
+    for (DomTreeNode *node = DT.getNode(bb); node->getIDom(); node = node->getIDom())
+    {
+        // 只有一个前驱时，这条边支配 node，也就支配 bb
+        BasicBlock *pred = node->getBlock()->getSinglePredecessor();
+        if (!pred)
+            continue;
+        BranchInst *br = getConditionalBranch(pred);
+        if (!br)
+            continue;
+        bool side = br->getSuccessor(0) == node->getBlock();
+        if (auto implied = isImpliedCondition(br->getCondition(), cond, DL, side))
+            return implied;
+    }
+    return None;
+}
+
+Value *buildNegation(IRBuilder<> &builder, Value *cond, bool negate)
+{
+    if (!negate)
+        return cond;
+    // 只被被替换的分支使用的比较直接取反谓词
+    if (auto *cmp = dyn_cast<CmpInst>(cond); cmp && cmp->hasOneUse())
+    {
+        cmp->setPredicate(cmp->getInversePredicate());
+        return cmp;
+    }
+    return builder.CreateNot(cond);
+}
+
+// 同一个值与常量的两次比较合并成一次范围检查，区间不连续时返回空
+Value *buildRangeCheck(IRBuilder<> &builder, Value *lhs, Value *rhs, bool isAnd)
+{
+    ICmpInst::Predicate lhsPred, rhsPred;
+    Value *x;
+    const APInt *lhsConst, *rhsConst;
+    if (!match(lhs, m_ICmp(lhsPred, m_Value(x), m_APInt(lhsConst))) ||
+        !match(rhs, m_ICmp(rhsPred, m_Specific(x), m_APInt(rhsConst))))
+        return nullptr;
+    auto lhsRange = ConstantRange::makeExactICmpRegion(lhsPred, *lhsConst);
+    auto rhsRange = ConstantRange::makeExactICmpRegion(rhsPred, *rhsConst);
+    // 交集与并集的结果可能放大成包含两者的区间，只接受精确的结果
+    ConstantRange range = isAnd ? lhsRange.intersectWith(rhsRange) : lhsRange.unionWith(rhsRange);
+    bool exact = isAnd ? lhsRange.contains(range) && rhsRange.contains(range)
+                       : lhsRange.inverse().contains(range.inverse()) && rhsRange.inverse().contains(range.inverse());
+    if (!exact)
+        return nullptr;
+
+    CmpInst::Predicate pred;
+    APInt bound, offset;
+    range.getEquivalentICmp(pred, bound, offset);
+    Value *value = offset.isZero() ? x : builder.CreateAdd(x, ConstantInt::get(x->getType(), offset));
+    return builder.CreateICmp(pred, value, ConstantInt::get(x->getType(), bound));
+}
+
+Value *buildCombination(IRBuilder<> &builder, Value *lhs, Value *rhs, bool isAnd)
+{
+    if (Value *range = buildRangeCheck(builder, lhs, rhs, isAnd))
+        return range;
+    // rhs 原本只在 lhs 成立时才计算，可能是 poison 时用 select 形式
+    if (isGuaranteedNotToBePoison(rhs))
+        return isAnd ? builder.CreateAnd(lhs, rhs) : builder.CreateOr(lhs, rhs);
+    return isAnd ? builder.CreateLogicalAnd(lhs, rhs) : builder.CreateLogicalOr(lhs, rhs);
+}
+
+// 从 pred 跳到 bb 时 bb 的条件已知，pred 可以直接跳到 succ
+struct EdgeThread
+{
+    BasicBlock *pred;
+    BasicBlock *bb;
+    BasicBlock *succ;
+};
+
+// bb 只有跳转和它自己的条件时，找出条件已经由前驱决定的入边
+void findThreads(BasicBlock *bb, DominatorTree &DT, const DataLayout &DL,
+                 const SmallPtrSetImpl<const BasicBlock *> &headers, SmallVectorImpl<EdgeThread> &threads)
+{
+    BranchInst *br = getConditionalBranch(bb);
+    if (!br || headers.count(bb) || bb->isEntryBlock() || isa<PHINode>(bb->front()))
+        return;
+    Value *cond = br->getCondition();
+    auto *cmp = dyn_cast<Instruction>(cond);
+    bool local = cmp && cmp->getParent() == bb;
+    if (bb->size() != (local ? 2u : 1u) || (local && !cmp->hasOneUse()))
+        return;
+
+    for (BasicBlock *pred : predecessors(bb))
+    {
+        if (pred == bb || !DT.isReachableFromEntry(pred))
+            continue;
+        // 先看前驱自己的分支，再看支配前驱的边
+        Optional<bool> implied;
+        if (BranchInst *predBr = getConditionalBranch(pred))
+            implied = isImpliedCondition(predBr->getCondition(), cond, DL, predBr->getSuccessor(0) == bb);
+        if (!implied)
+            implied = getDominatingCondition(pred, cond, DT, DL);
+        if (!implied)
+            continue;
+        BasicBlock *succ = br->getSuccessor(*implied ? 0 : 1);
+        if (succ == bb || headers.count(succ))
+            continue;
+        // succ 的 phi 在新边上取 bb 边上的值，这个值不能在 bb 中定义
+        if (any_of(succ->phis(), [&](PHINode &phi) {
+                auto *value = dyn_cast<Instruction>(phi.getIncomingValueForBlock(bb));
+                return value && value->getParent() == bb;
+            }))
+            continue;
+        threads.push_back({pred, bb, succ});
+    }
+}
+
+bool applyThread(const EdgeThread &thread)
+{
+    Instruction *term = thread.pred->getTerminator();
+    if (is_contained(successors(thread.pred), thread.succ))
+        return false;
+    for (PHINode &phi : thread.succ->phis())
+        phi.addIncoming(phi.getIncomingValueForBlock(thread.bb), thread.pred);
+    for (unsigned i = 0; i < term->getNumSuccessors(); ++i)
+        if (term->getSuccessor(i) == thread.bb)
+            term->setSuccessor(i, thread.succ);
+    return true;
+}
+
+// br c1, next, common; next: br c2, other, common  =>  br (c1 && c2), other, common
+bool mergeConditions(BasicBlock *bb, const SmallPtrSetImpl<const BasicBlock *> &headers,
+                     SmallPtrSetImpl<BasicBlock *> &erased)
+{
+    BranchInst *br = getConditionalBranch(bb);
+    if (!br)
+        return false;
+    for (unsigned i = 0; i < 2; ++i)
+    {
+        BasicBlock *next = br->getSuccessor(i);
+        BasicBlock *common = br->getSuccessor(1 - i);
+        if (next == bb || next->getSinglePredecessor() != bb || headers.count(next))
+            continue;
+        BranchInst *nextBr = getConditionalBranch(next);
+        if (!nextBr || !isSpeculatable(next))
+            continue;
+        unsigned j = nextBr->getSuccessor(0) == common ? 0 : 1;
+        if (nextBr->getSuccessor(j) != common)
+            continue;
+        BasicBlock *other = nextBr->getSuccessor(1 - j);
+        if (other == bb || other == next)
+            continue;
+        // 两条到 common 的边合成一条，phi 在两条边上的值必须相同
+        if (any_of(common->phis(), [&](PHINode &phi) {
+                return phi.getIncomingValueForBlock(bb) != phi.getIncomingValueForBlock(next);
+            }))
+            continue;
+
+        hoistBefore(next, br);
+        IRBuilder<> builder(br);
+        // 到达 other 当且仅当 lhs && rhs，取反少的一种写法
+        bool negateLhs = i == 1, negateRhs = j == 0;
+        bool toOther = negateLhs + negateRhs <= 1;
+        Value *lhs = buildNegation(builder, br->getCondition(), toOther == negateLhs);
+        Value *rhs = buildNegation(builder, nextBr->getCondition(), toOther == negateRhs);
+        Value *cond = buildCombination(builder, lhs, rhs, toOther);
+        if (toOther)
+            builder.CreateCondBr(cond, other, common);
+        else
+            builder.CreateCondBr(cond, common, other);
+        br->eraseFromParent();
+
+        common->removePredecessor(next, true);
+        next->replaceSuccessorsPhiUsesWith(next, bb);
+        next->eraseFromParent();
+        erased.insert(next);
+        return true;
+    }
+    return false;
+}
+
+// 只有 bb 一个前驱、无条件跳到 merge 的小分支臂
+BasicBlock *getArmMerge(BasicBlock *arm, BasicBlock *bb)
+{
+    auto *br = dyn_cast<BranchInst>(arm->getTerminator());
+    if (arm == bb || arm->getSinglePredecessor() != bb || !br || br->isConditional() || !isSpeculatable(arm))
+        return nullptr;
+    return br->getSuccessor(0);
+}
+
+// 菱形或三角形分支：两臂提前到 bb 中执行，汇合处的 phi 换成 select
+bool formSelects(BasicBlock *bb, const SmallPtrSetImpl<const BasicBlock *> &headers,
+                 SmallPtrSetImpl<BasicBlock *> &erased)
+{
+    BranchInst *br = getConditionalBranch(bb);
+    if (!br)
+        return false;
+    BasicBlock *trueBB = br->getSuccessor(0), *falseBB = br->getSuccessor(1);
+    BasicBlock *trueMerge = getArmMerge(trueBB, bb), *falseMerge = getArmMerge(falseBB, bb);
+    BasicBlock *merge, *trueArm = nullptr, *falseArm = nullptr;
+    if (trueMerge && trueMerge == falseMerge)
+    {
+        merge = trueMerge;
+        trueArm = trueBB;
+        falseArm = falseBB;
+    }
+    else if (trueMerge && trueMerge == falseBB)
+    {
+        merge = falseBB;
+        trueArm = trueBB;
+    }
+    else if (falseMerge && falseMerge == trueBB)
+    {
+        merge = trueBB;
+        falseArm = falseBB;
+    }
+    else
+        return false;
+    if (merge == bb || headers.count(merge))
+        return false;
+    auto phis = merge->phis();
+    if (std::distance(phis.begin(), phis.end()) > kMaxSelects)
+        return false;
+
+    for (BasicBlock *arm : {trueArm, falseArm})
+        if (arm)
+            hoistBefore(arm, br);
+    IRBuilder<> builder(br);
+    for (PHINode &phi : phis)
+    {
+        Value *trueValue = phi.getIncomingValueForBlock(trueArm ? trueArm : bb);
+        Value *falseValue = phi.getIncomingValueForBlock(falseArm ? falseArm : bb);
+        Value *value = trueValue == falseValue ? trueValue
+                                               : builder.CreateSelect(br->getCondition(), trueValue, falseValue);
+        for (BasicBlock *arm : {trueArm, falseArm})
+            if (arm)
+                phi.removeIncomingValue(arm, false);
+        int index = phi.getBasicBlockIndex(bb);
+        if (index >= 0)
+            phi.setIncomingValue(index, value);
+        else
+            phi.addIncoming(value, bb);
+    }
+    builder.CreateBr(merge);
+    br->eraseFromParent();
+    for (BasicBlock *arm : {trueArm, falseArm})
+        if (arm)
+        {
+            arm->eraseFromParent();
+            erased.insert(arm);
+        }
+    return true;
+}
+
+} // namespace
+
+PreservedAnalyses IfCombining::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int foldTimes = 0;
+    int threadTimes = 0;
+    int mergeTimes = 0;
+    int selectTimes = 0;
+    const DataLayout &DL = func.getParent()->getDataLayout();
+
+    SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 8> backEdges;
+    FindFunctionBackedges(func, backEdges);
+    SmallPtrSet<const BasicBlock *, 8> loopHeaders;
+    for (auto &edge : backEdges)
+        loopHeaders.insert(edge.second);
+
+    // 先用支配树找出所有已知的条件，再统一改写，改写前支配树一直有效
+    auto &DT = fam.getResult<DominatorTreeAnalysis>(func);
+    SmallVector<std::pair<BranchInst *, bool>, 8> knownBranches;
+    SmallVector<EdgeThread, 8> threads;
+    for (auto &bb : func)
+    {
+        BranchInst *br = getConditionalBranch(&bb);
+        if (!br || !DT.isReachableFromEntry(&bb))
+            continue;
+        if (auto known = getDominatingCondition(&bb, br->getCondition(), DT, DL))
+            knownBranches.emplace_back(br, *known);
+        else
+            findThreads(&bb, DT, DL, loopHeaders, threads);
+    }
+    for (auto &thread : threads)
+        if (applyThread(thread))
+            ++threadTimes;
+    for (auto &[br, known] : knownBranches)
+    {
+        br->setCondition(ConstantInt::getBool(func.getContext(), known));
+        ConstantFoldTerminator(br->getParent(), true);
+        ++foldTimes;
+    }
+    if (foldTimes || threadTimes)
+        removeUnreachableBlocks(func);
+
+    // 这里只删除块、不新建块，已删除的块不会和其他块混淆
+    SmallVector<BasicBlock *, 32> blocks;
+    for (auto &bb : func)
+        blocks.push_back(&bb);
+    SmallPtrSet<BasicBlock *, 8> erased;
+    for (BasicBlock *bb : blocks)
+    {
+        if (erased.count(bb))
+            continue;
+        while (mergeConditions(bb, loopHeaders, erased))
+            ++mergeTimes;
+        if (formSelects(bb, loopHeaders, erased))
+            ++selectTimes;
+    }
+
+    if (!foldTimes && !threadTimes && !mergeTimes && !selectTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("branches folded", foldTimes);
+    PassStatistics::count("edges threaded", threadTimes);
+    PassStatistics::count("conditions merged", mergeTimes);
+    PassStatistics::count("branches turned into selects", selectTimes);
+    mOut << "IfCombining running on " << func.getName() << "...\n\rTo fold " << foldTimes << " branches, thread "
+         << threadTimes << " edges, merge " << mergeTimes << " conditions and turn " << selectTimes
+         << " branches into selects\n\r";
+    return PreservedAnalyses::none();
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 条件分支合并：
+//   - 支配当前块的分支条件已经决定了本块的条件时，条件换成常量并折叠分支；
+//   - 只有比较和跳转的块，从条件已知的前驱直接跳到确定的后继（跳转线程化）；
+//   - 两个相连的分支有共同的目标、第二个块只做少量无副作用的计算时，合并成一个 and/or 条件，
+//     比较同一个值与常量的两个条件进一步合并为一次范围比较；
+//   - 两臂只做少量无副作用计算的菱形与三角形分支，提前执行两臂并把汇合处的 phi 换成 select。
+// 循环头不参与线程化与 select 转换，保持循环的形状。
+class IfCombining : public llvm::PassInfoMixin<IfCombining>
+{
+  public:
+    explicit IfCombining(llvm::raw_ostream &out) : mOut(out)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+};
@@ -0,0 +1,264 @@
+#include "LoopDependence.hpp"
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/GetElementPtrTypeIterator.h>
+#include <llvm/IR/Operator.h>
+
+using namespace llvm;
+
+namespace {
+
+// 展开下标表达式的最大深度
+constexpr unsigned kMaxDepth = 8;
+
+bool parseAffine(Value *value, int64_t scale, const Loop *nest, ArrayRef<PHINode *> ivs, AffineExpr &expr,
+                 unsigned depth = 0)
+{
+    if (auto *constant = dyn_cast<ConstantInt>(value))
+    {
+        expr.constant += constant->getSExtValue() * scale;
+        return true;
+    }
+    auto *inst = dyn_cast<Instruction>(value);
+    if (inst && depth < kMaxDepth)
+    {
+        Value *lhs = inst->getNumOperands() > 0 ? inst->getOperand(0) : nullptr;
+        auto *rhsConst = inst->getNumOperands() > 1 ? dyn_cast<ConstantInt>(inst->getOperand(1)) : nullptr;
+        switch (inst->getOpcode())
+        {
+        case Instruction::SExt:
+            return parseAffine(lhs, scale, nest, ivs, expr, depth + 1);
+        case Instruction::Add:
+            return parseAffine(lhs, scale, nest, ivs, expr, depth + 1) &&
+                   parseAffine(inst->getOperand(1), scale, nest, ivs, expr, depth + 1);
+        case Instruction::Sub:
+            return parseAffine(lhs, scale, nest, ivs, expr, depth + 1) &&
+                   parseAffine(inst->getOperand(1), -scale, nest, ivs, expr, depth + 1);
+        case Instruction::Mul:
+            if (rhsConst)
+                return parseAffine(lhs, scale * rhsConst->getSExtValue(), nest, ivs, expr, depth + 1);
+            if (auto *lhsConst = dyn_cast<ConstantInt>(lhs))
+                return parseAffine(inst->getOperand(1), scale * lhsConst->getSExtValue(), nest, ivs, expr, depth + 1);
+            break;
+        case Instruction::Shl:
+            if (rhsConst && rhsConst->getZExtValue() < 32)
+                return parseAffine(lhs, scale << rhsConst->getZExtValue(), nest, ivs, expr, depth + 1);
+            break;
+        default:
+            break;
+        }
+    }
+    // 其它值整体作为一项，嵌套中定义的值只能是归纳变量；没有嵌套时任何值都可以作为一项
+    if (inst && nest && nest->contains(inst) && !is_contained(ivs, inst))
+        return false;
+    expr.terms[value] += scale;
+    return true;
+}
+
+// 地址线性化：沿 GEP 链把每个下标按它的步长累加到对应的维上
+bool linearize(Value *ptr, const Loop *nest, ArrayRef<PHINode *> ivs, const DataLayout &DL, ArrayAccess &access)
+{
+    SmallMapVector<int64_t, AffineExpr, 4> dims;
+    while (true)
+    {
+        ptr = ptr->stripPointerCasts();
+        auto *gep = dyn_cast<GEPOperator>(ptr);
+        if (!gep)
+            break;
+        for (auto it = gep_type_begin(gep), end = gep_type_end(gep); it != end; ++it)
+        {
+            if (it.getStructTypeOrNull())
+                return false;
+            int64_t stride = DL.getTypeAllocSize(it.getIndexedType()).getFixedSize();
+            if (!parseAffine(it.getOperand(), 1, nest, ivs, dims[stride]))
+                return false;
+        }
+        ptr = gep->getPointerOperand();
+    }
+    access.base = ptr;
+    // 在嵌套中变化的基地址无法比较
+    auto *baseInst = dyn_cast<Instruction>(ptr);
+    if (baseInst && nest->contains(baseInst))
+        return false;
+    access.dims.assign(dims.begin(), dims.end());
+    sort(access.dims, [](auto &lhs, auto &rhs) { return lhs.first > rhs.first; });
+    return true;
+}
+
+bool isIdentified(const Value *obj)
+{
+    return isa<AllocaInst>(obj) || isa<GlobalVariable>(obj);
+}
+
+// 函数的指针参数 arg 不会指向 other：每个调用点传入的都是与 other 不同的栈变量或全局变量
+bool isDistinctArgument(const Argument *arg, const Value *other)
+{
+    const Function *func = arg->getParent();
+    // 调用者的指针不会指向被调用者自己的栈变量
+    if (auto *alloca = dyn_cast<AllocaInst>(other))
+        return alloca->getFunction() == func;
+    auto *otherArg = dyn_cast<Argument>(other);
+    if (!isa<GlobalVariable>(other) && (!otherArg || otherArg->getParent() != func))
+        return false;
+    if (func->use_empty())
+        return false;
+    for (const User *user : func->users())
+    {
+        auto *call = dyn_cast<CallInst>(user);
+        if (!call || call->getCalledFunction() != func)
+            return false;
+        const Value *actual = getUnderlyingObject(call->getArgOperand(arg->getArgNo()));
+        const Value *otherActual = otherArg ? getUnderlyingObject(call->getArgOperand(otherArg->getArgNo())) : other;
+        if (!isIdentified(actual) || !isIdentified(otherActual) || actual == otherActual)
+            return false;
+    }
+    return true;
+}
+
+bool isDistinctObject(const Value *a, const Value *b)
+{
+    if (a == b)
+        return false;
+    if (isIdentified(a) && isIdentified(b))
+        return true;
+    if (auto *arg = dyn_cast<Argument>(a); arg && isDistinctArgument(arg, b))
+        return true;
+    if (auto *arg = dyn_cast<Argument>(b); arg && isDistinctArgument(arg, a))
+        return true;
+    return false;
+}
+
+const AffineExpr &getDimension(const ArrayAccess &access, int64_t stride)
+{
+    static const AffineExpr zero;
+    for (auto &[dimStride, expr] : access.dims)
+        if (dimStride == stride)
+            return expr;
+    return zero;
+}
+
+} // namespace
+
+bool collectAccesses(ArrayRef<BasicBlock *> blocks, const Loop *nest, ArrayRef<PHINode *> ivs,
+                     const DataLayout &DL, SmallVectorImpl<ArrayAccess> &accesses)
+{
+    for (BasicBlock *bb : blocks)
+        for (auto &inst : *bb)
+        {
+            Value *ptr;
+            Type *type;
+            if (auto *load = dyn_cast<LoadInst>(&inst); load && load->isSimple())
+            {
+                ptr = load->getPointerOperand();
+                type = load->getType();
+            }
+            else if (auto *store = dyn_cast<StoreInst>(&inst); store && store->isSimple())
+            {
+                ptr = store->getPointerOperand();
+                type = store->getValueOperand()->getType();
+            }
+            else if (inst.mayReadOrWriteMemory())
+                return false;
+            else
+                continue;
+
+            uint64_t size = DL.getTypeStoreSize(type).getFixedSize();
+            ArrayAccess access{&inst, nullptr, size, isa<StoreInst>(inst), true, {}};
+            if (!linearize(ptr, nest, ivs, DL, access))
+            {
+                access.affine = false;
+                access.base = getUnderlyingObject(ptr);
+                access.dims.clear();
+            }
+            accesses.push_back(std::move(access));
+        }
+    return true;
+}
+
+AccessDependence testDependence(const ArrayAccess &a, const ArrayAccess &b, ArrayRef<PHINode *> ivs)
+{
+    AccessDependence dep;
+    if (isDistinctObject(getUnderlyingObject(a.base), getUnderlyingObject(b.base)))
+    {
+        dep.independent = true;
+        return dep;
+    }
+    if (a.base != b.base || !a.affine || !b.affine || a.size != b.size)
+        return dep;
+
+    SmallVector<int64_t, 4> strides;
+    for (auto *access : {&a, &b})
+        for (auto &dim : access->dims)
+            if (!is_contained(strides, dim.first))
+                strides.push_back(dim.first);
+    for (int64_t stride : strides)
+    {
+        const AffineExpr &lhs = getDimension(a, stride);
+        const AffineExpr &rhs = getDimension(b, stride);
+        // 两边的系数必须相同：不变项相同才能互相抵消，归纳变量的系数相同才是固定的距离
+        bool uniform = true;
+        for (auto *expr : {&lhs, &rhs})
+            for (auto &[term, coeff] : expr->terms)
+                uniform &= lhs.terms.lookup(term) == rhs.terms.lookup(term);
+        if (!uniform)
+            continue;
+
+        SmallVector<PHINode *, 2> used;
+        for (PHINode *iv : ivs)
+            if (lhs.terms.lookup(iv))
+                used.push_back(iv);
+        // coeff * (b 处的值 - a 处的值) = a 的常数项 - b 的常数项
+        int64_t delta = lhs.constant - rhs.constant;
+        if (used.empty())
+        {
+            if (delta)
+                dep.independent = true;
+        }
+        else if (used.size() == 1)
+        {
+            int64_t coeff = lhs.terms.lookup(used[0]);
+            if (delta % coeff)
+                dep.independent = true;
+            else
+            {
+                auto [it, inserted] = dep.distance.try_emplace(used[0], delta / coeff);
+                if (!inserted && it->second != delta / coeff)
+                    dep.independent = true;
+            }
+        }
+        if (dep.independent)
+            return dep;
+    }
+    return dep;
+}
+
+int64_t getStride(const ArrayAccess &access, PHINode *iv)
+{
+    int64_t stride = 0;
+    for (auto &[dimStride, expr] : access.dims)
+        stride += dimStride * expr.terms.lookup(iv);
+    return stride;
+}
+
+bool decomposeAddress(Value *ptr, const DataLayout &DL, Value *&base, AffineExpr &offset)
+{
+    while (true)
+    {
+        ptr = ptr->stripPointerCasts();
+        auto *gep = dyn_cast<GEPOperator>(ptr);
+        if (!gep)
+            break;
+        for (auto it = gep_type_begin(gep), end = gep_type_end(gep); it != end; ++it)
+        {
+            if (it.getStructTypeOrNull())
+                return false;
+            int64_t stride = DL.getTypeAllocSize(it.getIndexedType()).getFixedSize();
+            if (!parseAffine(it.getOperand(), stride, nullptr, {}, offset))
+                return false;
+        }
+        ptr = gep->getPointerOperand();
+    }
+    base = ptr;
+    // 系数为 0 的项（如 i - i）不影响地址
+    offset.terms.remove_if([](auto &term) { return term.second == 0; });
+    return true;
+}
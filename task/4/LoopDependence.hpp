@@ -0,0 +1,50 @@
+#pragma once
+
+#include <llvm/ADT/MapVector.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Instructions.h>
+
+// 仿射式 constant + Σ coeff * term，term 是循环嵌套的归纳变量或在整个嵌套中不变的值
+struct AffineExpr
+{
+    int64_t constant = 0;
+    llvm::SmallMapVector<llvm::Value *, int64_t, 4> terms;
+};
+
+// 一次内存访问。地址线性化为 base + Σ stride * index，步长（字节）相同的下标合并为一维，
+// 即多维数组的每一维；假设每一维的下标都不越界，不同维之间不会互相进位
+struct ArrayAccess
+{
+    llvm::Instruction *inst;
+    llvm::Value *base;
+    uint64_t size;
+    bool isWrite;
+    // 地址不能写成仿射式时为 false，只能按 base 判断是否别名
+    bool affine;
+    // 按步长从大到小排列
+    llvm::SmallVector<std::pair<int64_t, AffineExpr>, 4> dims;
+};
+
+// 两次访问 a、b 之间的依赖。independent 为真时它们不可能访问同一地址；
+// 否则 distance 给出被约束的归纳变量在两次访问之间的迭代差（b 处的值减去 a 处的值），不在表中的归纳变量可以相差任意值
+struct AccessDependence
+{
+    bool independent = false;
+    llvm::SmallDenseMap<llvm::PHINode *, int64_t, 4> distance;
+};
+
+// 收集 blocks 中的 load 与 store，下标按 nest 中的归纳变量 ivs 展开；
+// 有其它读写内存的指令（如调用）时返回 false
+bool collectAccesses(llvm::ArrayRef<llvm::BasicBlock *> blocks, const llvm::Loop *nest,
+                     llvm::ArrayRef<llvm::PHINode *> ivs, const llvm::DataLayout &DL,
+                     llvm::SmallVectorImpl<ArrayAccess> &accesses);
+
+// 对每一维做 ZIV/SIV 测试：两次访问的每一维系数相同时求出对应归纳变量的距离，距离不是整数或互相矛盾时不相关
+AccessDependence testDependence(const ArrayAccess &a, const ArrayAccess &b, llvm::ArrayRef<llvm::PHINode *> ivs);
+
+// 访问在 iv 方向上相邻两次迭代之间的地址差（字节）
+int64_t getStride(const ArrayAccess &access, llvm::PHINode *iv);
+
+// 把地址 ptr 写成 base + offset（字节），offset 中的项可以是任意的值；有结构体下标时返回 false
+bool decomposeAddress(llvm::Value *ptr, const llvm::DataLayout &DL, llvm::Value *&base, AffineExpr &offset);
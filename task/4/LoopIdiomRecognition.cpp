@@ -0,0 +1,243 @@
+#include "LoopIdiomRecognition.hpp"
+#include "LoopInduction.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/IntrinsicInst.h>
+
+using namespace llvm;
+
+namespace {
+
+enum class Idiom
+{
+    None,
+    MemSet,
+    MemCpy
+};
+
+// 以 iv（或它的 sext）为下标、其余下标都是循环不变量的 GEP，相邻迭代访问相邻的元素
+struct StridedAccess
+{
+    GetElementPtrInst *gep = nullptr;
+    // iv 所在的下标位置，之后的下标都是常量 0
+    unsigned ivIndex = 0;
+    // 每次迭代访问的元素类型
+    Type *elementType = nullptr;
+};
+
+bool matchStridedGEP(Value *ptr, Loop *LP, PHINode *iv, StridedAccess &access)
+{
+    auto *gep = dyn_cast<GetElementPtrInst>(ptr);
+    // 全零下标的 GEP 与它的基址是同一个地址
+    while (gep && gep->hasAllZeroIndices() && isa<GetElementPtrInst>(gep->getPointerOperand()))
+        gep = cast<GetElementPtrInst>(gep->getPointerOperand());
+    if (!gep || gep->getNumIndices() == 0)
+        return false;
+
+    // 末尾的常量 0 下标不改变地址（例如内层循环生成的 memset 从一行的开头写起）
+    SmallVector<Value *, 4> indices(gep->idx_begin(), gep->idx_end());
+    unsigned ivIndex = indices.size() - 1;
+    auto isZero = [](Value *index) {
+        auto *c = dyn_cast<ConstantInt>(index);
+        return c && c->isZero();
+    };
+    while (ivIndex > 0 && isZero(indices[ivIndex]))
+        --ivIndex;
+    Value *index = indices[ivIndex];
+    if (auto *sext = dyn_cast<SExtInst>(index))
+        index = sext->getOperand(0);
+    if (index != iv)
+        return false;
+    if (!LP->isLoopInvariant(gep->getPointerOperand()))
+        return false;
+    for (unsigned i = 0; i < ivIndex; ++i)
+        if (!LP->isLoopInvariant(indices[i]))
+            return false;
+
+    access.gep = gep;
+    access.ivIndex = ivIndex;
+    access.elementType =
+        GetElementPtrInst::getIndexedType(gep->getSourceElementType(), makeArrayRef(indices).take_front(ivIndex + 1));
+    return access.elementType != nullptr;
+}
+
+// 第一次迭代访问的地址：把 iv 所在的下标换成归纳变量的初值，去掉之后的 0 下标
+Value *buildStartPointer(IRBuilder<> &builder, const StridedAccess &access, Value *start)
+{
+    GetElementPtrInst *gep = access.gep;
+    SmallVector<Value *, 4> indices(gep->idx_begin(), gep->idx_begin() + access.ivIndex + 1);
+    indices.back() = builder.CreateSExtOrTrunc(start, indices.back()->getType());
+    if (gep->isInBounds())
+        return builder.CreateInBoundsGEP(gep->getSourceElementType(), gep->getPointerOperand(), indices, "idiom.begin");
+    return builder.CreateGEP(gep->getSourceElementType(), gep->getPointerOperand(), indices, "idiom.begin");
+}
+
+// 两个指针分别位于不同的栈变量或全局变量中
+bool isDisjoint(Value *a, Value *b)
+{
+    const Value *objA = getUnderlyingObject(a);
+    const Value *objB = getUnderlyingObject(b);
+    auto identified = [](const Value *obj) { return isa<AllocaInst>(obj) || isa<GlobalVariable>(obj); };
+    return objA != objB && identified(objA) && identified(objB);
+}
+
+Idiom recognize(Loop *LP, LoopInfo &LI, DominatorTree &DT, const DataLayout &dl)
+{
+    // 只处理只从头块退出的循环
+    BasicBlock *header = LP->getHeader();
+    BasicBlock *preheader = LP->getLoopPreheader();
+    BasicBlock *latch = LP->getLoopLatch();
+    if (!preheader || !latch || LP->getExitingBlock() != header)
+        return Idiom::None;
+    InductionInfo info;
+    if (!analyzeInduction(LP, info) || info.step != 1)
+        return Idiom::None;
+    int64_t tripCount = 0;
+    bool constant = getConstantTripCount(info, tripCount);
+    if (constant ? tripCount == 0 : !info.noWrap || (info.pred != CmpInst::ICMP_SLT && info.pred != CmpInst::ICMP_SLE))
+        return Idiom::None;
+
+    // 循环中唯一的写入，每次迭代恰好执行一次：直接属于这个循环、不在头块中且支配回边
+    Instruction *write = nullptr;
+    unsigned reads = 0;
+    for (BasicBlock *bb : LP->blocks())
+        for (auto &inst : *bb)
+        {
+            if (inst.mayWriteToMemory())
+            {
+                if (write)
+                    return Idiom::None;
+                write = &inst;
+            }
+            else if (inst.mayReadFromMemory())
+            {
+                ++reads;
+            }
+        }
+    if (!write || write->getParent() == header || LI.getLoopFor(write->getParent()) != LP ||
+        !DT.dominates(write->getParent(), latch))
+        return Idiom::None;
+
+    Value *ptr = nullptr;
+    uint64_t size = 0;
+    MaybeAlign align;
+    Value *byte = nullptr;
+    LoadInst *load = nullptr;
+    if (auto *store = dyn_cast<StoreInst>(write))
+    {
+        if (!store->isSimple())
+            return Idiom::None;
+        Value *value = store->getValueOperand();
+        ptr = store->getPointerOperand();
+        size = dl.getTypeStoreSize(value->getType());
+        align = store->getAlign();
+        if (LP->isLoopInvariant(value))
+            byte = isBytewiseValue(value, dl);
+        else
+            load = dyn_cast<LoadInst>(value);
+    }
+    else if (auto *memset = dyn_cast<MemSetInst>(write))
+    {
+        // 内层循环变成的 memset 正好写满一个元素时，外层循环可以合并成一次更大的 memset
+        auto *length = dyn_cast<ConstantInt>(memset->getLength());
+        if (memset->isVolatile() || !length || !LP->isLoopInvariant(memset->getValue()))
+            return Idiom::None;
+        ptr = memset->getDest();
+        size = length->getZExtValue();
+        align = memset->getDestAlign();
+        byte = memset->getValue();
+    }
+    if (!ptr || (byte && isa<UndefValue>(byte)))
+        return Idiom::None;
+
+    StridedAccess dst;
+    if (!matchStridedGEP(ptr, LP, info.iv, dst) || dl.getTypeAllocSize(dst.elementType) != size)
+        return Idiom::None;
+
+    StridedAccess src;
+    if (byte)
+    {
+        // memset 之后循环中其它读取会看到提前写入的值
+        if (reads)
+            return Idiom::None;
+    }
+    else
+    {
+        if (!load || !load->isSimple() || !load->hasOneUse() || reads != 1 || !LP->contains(load))
+            return Idiom::None;
+        if (!matchStridedGEP(load->getPointerOperand(), LP, info.iv, src) ||
+            dl.getTypeAllocSize(src.elementType) != size || !isDisjoint(dst.gep, src.gep))
+            return Idiom::None;
+    }
+
+    IRBuilder<> builder(preheader->getTerminator());
+    Value *count = constant ? builder.getInt64(tripCount) : buildTripCount(builder, info);
+    Value *bytes = builder.CreateMul(count, builder.getInt64(size), "idiom.bytes");
+    Value *dstBegin = buildStartPointer(builder, dst, info.start);
+    write->eraseFromParent();
+    if (byte)
+    {
+        builder.CreateMemSet(dstBegin, byte, bytes, align);
+        return Idiom::MemSet;
+    }
+    Value *srcBegin = buildStartPointer(builder, src, info.start);
+    builder.CreateMemCpy(dstBegin, align, srcBegin, load->getAlign(), bytes);
+    load->eraseFromParent();
+    return Idiom::MemCpy;
+}
+
+} // namespace
+
+PreservedAnalyses LoopIdiomRecognition::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int memsetTimes = 0;
+    int memcpyTimes = 0;
+
+    LoopInfo &LI = fam.getResult<LoopAnalysis>(func);
+    DominatorTree &DT = fam.getResult<DominatorTreeAnalysis>(func);
+    const DataLayout &dl = func.getParent()->getDataLayout();
+    // 先内层后外层，外层循环才能看到内层变成的 memset；识别时只插入指令，LoopInfo 保持有效
+    auto loops = LI.getLoopsInPreorder();
+    SmallPtrSet<Loop *, 8> converted;
+    for (auto it = loops.rbegin(); it != loops.rend(); ++it)
+    {
+        switch (recognize(*it, LI, DT, dl))
+        {
+        case Idiom::MemSet:
+            ++memsetTimes;
+            converted.insert(*it);
+            break;
+        case Idiom::MemCpy:
+            ++memcpyTimes;
+            converted.insert(*it);
+            break;
+        case Idiom::None:
+            break;
+        }
+    }
+
+    // 最后删除最外层的已转换循环，内层循环的块随之删除
+    int deletedLoops = 0;
+    for (Loop *LP : loops)
+    {
+        bool outermost = converted.count(LP);
+        for (Loop *parent = LP->getParentLoop(); outermost && parent; parent = parent->getParentLoop())
+            outermost = !converted.count(parent);
+        if (outermost && deleteDeadLoop(LP))
+            ++deletedLoops;
+    }
+
+    if (!memsetTimes && !memcpyTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("loops turned into memset", memsetTimes);
+    PassStatistics::count("loops turned into memcpy", memcpyTimes);
+    PassStatistics::count("loops deleted", deletedLoops);
+    mOut << "LoopIdiomRecognition running on " << func.getName() << "...\n\rTo form " << memsetTimes
+         << " memsets and " << memcpyTimes << " memcpys, deleting " << deletedLoops << " loops\n\r";
+    if (deletedLoops)
+        return PreservedAnalyses::none();
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
+}
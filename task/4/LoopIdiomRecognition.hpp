@@ -0,0 +1,21 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 循环惯用法识别：步长为 1 的计数循环中，每次迭代恰好向 a[i] 写一次且循环内没有其它内存访问时，
+//   - 写入循环不变、按字节重复的值（包括内层循环已经变成的整行 memset）：换成前置块中的一次 llvm.memset；
+//   - 写入同一下标处从另一个数组读出的值：换成前置块中的一次 llvm.memcpy，两个数组必须是不同的栈变量或全局变量。
+// 原来的 store 删除后循环不再有副作用，且没有在循环外被使用的值时整个删除（DeadCodeElimination 不删除循环）。
+class LoopIdiomRecognition : public llvm::PassInfoMixin<LoopIdiomRecognition>
+{
+  public:
+    explicit LoopIdiomRecognition(llvm::raw_ostream &out) : mOut(out)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+};
@@ -0,0 +1,279 @@
+#include "LoopInduction.hpp"
+#include <llvm/ADT/SetVector.h>
+#include <optional>
+
+using namespace llvm;
+
+bool isSimpleLoop(Loop *LP)
+{
+    BasicBlock *latch = LP->getLoopLatch();
+    if (!LP->getLoopPreheader() || !latch || latch == LP->getHeader() || !LP->getExitBlock() ||
+        LP->getExitingBlock() != LP->getHeader())
+        return false;
+    auto *br = dyn_cast<BranchInst>(latch->getTerminator());
+    return br && br->isUnconditional();
+}
+
+bool analyzeRecurrence(Loop *LP, PHINode *phi, Recurrence &rec)
+{
+    BasicBlock *preheader = LP->getLoopPreheader();
+    BasicBlock *latch = LP->getLoopLatch();
+    if (!preheader || !latch || phi->getParent() != LP->getHeader() || !phi->getType()->isIntegerTy())
+        return false;
+    // 回边上的值必须是 phi + c 或 phi - c
+    auto *next = dyn_cast<BinaryOperator>(phi->getIncomingValueForBlock(latch));
+    if (!next || (next->getOpcode() != Instruction::Add && next->getOpcode() != Instruction::Sub) ||
+        next->getOperand(0) != phi)
+        return false;
+    auto *stepConst = dyn_cast<ConstantInt>(next->getOperand(1));
+    if (!stepConst || stepConst->isZero())
+        return false;
+    rec.phi = phi;
+    rec.start = phi->getIncomingValueForBlock(preheader);
+    rec.step = stepConst->getSExtValue();
+    if (next->getOpcode() == Instruction::Sub)
+        rec.step = -rec.step;
+    rec.next = next;
+    return true;
+}
+
+bool analyzeInduction(Loop *LP, InductionInfo &info)
+{
+    BasicBlock *header = LP->getHeader();
+    auto *br = dyn_cast<BranchInst>(header->getTerminator());
+    if (!br || !br->isConditional())
+        return false;
+    auto *cmp = dyn_cast<ICmpInst>(br->getCondition());
+    if (!cmp)
+        return false;
+
+    // 统一成“iv pred bound 为真时留在循环内”
+    bool bodyOnTrue = LP->contains(br->getSuccessor(0));
+    CmpInst::Predicate pred = bodyOnTrue ? cmp->getPredicate() : cmp->getInversePredicate();
+    Value *lhs = cmp->getOperand(0);
+    Value *rhs = cmp->getOperand(1);
+    auto *iv = dyn_cast<PHINode>(lhs);
+    if (!iv || iv->getParent() != header)
+    {
+        std::swap(lhs, rhs);
+        pred = CmpInst::getSwappedPredicate(pred);
+        iv = dyn_cast<PHINode>(lhs);
+    }
+    if (!iv || iv->getParent() != header || !LP->isLoopInvariant(rhs))
+        return false;
+    if (!iv->getType()->isIntegerTy() || iv->getType()->getIntegerBitWidth() > 32)
+        return false;
+
+    Recurrence rec;
+    if (!analyzeRecurrence(LP, iv, rec))
+        return false;
+    int64_t step = rec.step;
+    BinaryOperator *next = rec.next;
+
+    info.iv = iv;
+    info.start = rec.start;
+    info.step = step;
+    info.pred = pred;
+    info.bound = rhs;
+    info.body = br->getSuccessor(bodyOnTrue ? 0 : 1);
+    // 步长为 1 的 i < n 在 n 不超过最大值时不会溢出
+    info.noWrap = next->hasNoSignedWrap() || (step == 1 && pred == CmpInst::ICMP_SLT) ||
+                  (step == -1 && pred == CmpInst::ICMP_SGT);
+    return true;
+}
+
+bool mergeLatches(Loop *LP, LoopInfo &LI)
+{
+    BasicBlock *header = LP->getHeader();
+    SmallVector<BasicBlock *, 4> latches;
+    LP->getLoopLatches(latches);
+    if (latches.size() < 2 || !LP->getLoopPreheader())
+        return false;
+    for (BasicBlock *latch : latches)
+    {
+        auto *br = dyn_cast<BranchInst>(latch->getTerminator());
+        if (!br || br->isConditional())
+            return false;
+    }
+
+    // 每个 phi 在回边块中的新值：各条回边相同的值，或 nullptr 表示 phi + step
+    SmallVector<std::pair<PHINode *, Value *>, 4> merged;
+    SmallVector<int64_t, 4> steps;
+    for (PHINode &phi : header->phis())
+    {
+        Value *same = phi.getIncomingValueForBlock(latches[0]);
+        if (all_of(latches, [&](BasicBlock *latch) { return phi.getIncomingValueForBlock(latch) == same; }))
+        {
+            merged.push_back({&phi, same});
+            steps.push_back(0);
+            continue;
+        }
+        std::optional<int64_t> step;
+        for (BasicBlock *latch : latches)
+        {
+            auto *next = dyn_cast<BinaryOperator>(phi.getIncomingValueForBlock(latch));
+            auto *stepConst = next ? dyn_cast<ConstantInt>(next->getOperand(1)) : nullptr;
+            if (!stepConst || next->getOpcode() != Instruction::Add || next->getOperand(0) != &phi ||
+                (step && *step != stepConst->getSExtValue()))
+                return false;
+            step = stepConst->getSExtValue();
+        }
+        merged.push_back({&phi, nullptr});
+        steps.push_back(*step);
+    }
+
+    Function *func = header->getParent();
+    BasicBlock *newLatch = BasicBlock::Create(func->getContext(), header->getName() + ".latch", func,
+                                              latches.back()->getNextNode());
+    IRBuilder<> builder(newLatch);
+    for (size_t i = 0; i < merged.size(); ++i)
+    {
+        auto [phi, value] = merged[i];
+        if (!value)
+        {
+            // 各条回边上的 phi + c 都不会溢出时，合并后的也不会
+            bool nsw = all_of(latches, [&](BasicBlock *latch) {
+                return cast<BinaryOperator>(phi->getIncomingValueForBlock(latch))->hasNoSignedWrap();
+            });
+            value = builder.CreateAdd(phi, ConstantInt::get(phi->getType(), steps[i]), phi->getName() + ".next",
+                                      false, nsw);
+        }
+        SmallSetVector<Instruction *, 4> olds;
+        for (BasicBlock *latch : latches)
+        {
+            if (auto *old = dyn_cast<Instruction>(phi->getIncomingValueForBlock(latch)); old && old != value)
+                olds.insert(old);
+            phi->removeIncomingValue(latch, false);
+        }
+        phi->addIncoming(value, newLatch);
+        for (Instruction *old : olds)
+            if (old->use_empty())
+                old->eraseFromParent();
+    }
+    builder.CreateBr(header);
+    for (BasicBlock *latch : latches)
+        latch->getTerminator()->replaceUsesOfWith(header, newLatch);
+    LP->addBasicBlockToLoop(newLatch, LI);
+    return true;
+}
+
+bool getConstantTripCount(const InductionInfo &info, int64_t &tripCount)
+{
+    auto *startConst = dyn_cast<ConstantInt>(info.start);
+    auto *boundConst = dyn_cast<ConstantInt>(info.bound);
+    if (!startConst || !boundConst)
+        return false;
+    int64_t start = startConst->getSExtValue();
+    int64_t bound = boundConst->getSExtValue();
+    int64_t step = info.step;
+
+    switch (info.pred)
+    {
+    case CmpInst::ICMP_SLT:
+        if (step <= 0)
+            return false;
+        tripCount = start < bound ? (bound - start + step - 1) / step : 0;
+        break;
+    case CmpInst::ICMP_SLE:
+        if (step <= 0)
+            return false;
+        tripCount = start <= bound ? (bound - start) / step + 1 : 0;
+        break;
+    case CmpInst::ICMP_SGT:
+        if (step >= 0)
+            return false;
+        tripCount = start > bound ? (start - bound - step - 1) / -step : 0;
+        break;
+    case CmpInst::ICMP_SGE:
+        if (step >= 0)
+            return false;
+        tripCount = start >= bound ? (start - bound) / -step + 1 : 0;
+        break;
+    case CmpInst::ICMP_NE:
+        // 必须恰好走到边界，否则会绕过边界直到溢出
+        if ((bound - start) % step != 0 || (bound - start) / step < 0)
+            return false;
+        tripCount = (bound - start) / step;
+        break;
+    default:
+        return false;
+    }
+
+    // 退出时归纳变量的值不能溢出，否则原循环还会继续执行
+    unsigned bits = info.iv->getType()->getIntegerBitWidth();
+    int64_t last = start + tripCount * step;
+    return last >= APInt::getSignedMinValue(bits).getSExtValue() &&
+           last <= APInt::getSignedMaxValue(bits).getSExtValue();
+}
+
+Value *buildTripCount(IRBuilder<> &builder, const InductionInfo &info)
+{
+    bool up = info.pred == CmpInst::ICMP_SLT || info.pred == CmpInst::ICMP_SLE;
+    bool down = info.pred == CmpInst::ICMP_SGT || info.pred == CmpInst::ICMP_SGE;
+    if (!info.noWrap || (!up && !down) || (info.step > 0) != up)
+        return nullptr;
+
+    // 在 i64 上计算不会溢出：distance = |bound - start|，闭区间多走一次
+    Type *i64 = builder.getInt64Ty();
+    Value *start = builder.CreateSExt(info.start, i64);
+    Value *bound = builder.CreateSExt(info.bound, i64);
+    Value *distance = up ? builder.CreateSub(bound, start) : builder.CreateSub(start, bound);
+    int64_t step = up ? info.step : -info.step;
+    if (info.pred == CmpInst::ICMP_SLE || info.pred == CmpInst::ICMP_SGE)
+        distance = builder.CreateAdd(distance, builder.getInt64(1));
+    Value *count = distance;
+    if (step != 1)
+        count = builder.CreateSDiv(builder.CreateAdd(distance, builder.getInt64(step - 1)), builder.getInt64(step));
+    Value *positive = builder.CreateICmpSGT(distance, builder.getInt64(0));
+    return builder.CreateSelect(positive, count, builder.getInt64(0), "trip.count");
+}
+
+void addLoopAttribute(BasicBlock *latch, StringRef name)
+{
+    // 循环 ID 是第一个操作数指向自己的 distinct 节点
+    LLVMContext &ctx = latch->getContext();
+    Instruction *term = latch->getTerminator();
+    SmallVector<Metadata *, 4> ops{nullptr};
+    if (MDNode *old = term->getMetadata(LLVMContext::MD_loop))
+        for (unsigned i = 1; i < old->getNumOperands(); ++i)
+        {
+            auto *attr = dyn_cast<MDNode>(old->getOperand(i));
+            auto *attrName = attr && attr->getNumOperands() ? dyn_cast<MDString>(attr->getOperand(0)) : nullptr;
+            if (attrName && attrName->getString() == name)
+                return;
+            ops.push_back(old->getOperand(i));
+        }
+    ops.push_back(MDNode::get(ctx, MDString::get(ctx, name)));
+    MDNode *loopID = MDNode::getDistinct(ctx, ops);
+    loopID->replaceOperandWith(0, loopID);
+    term->setMetadata(LLVMContext::MD_loop, loopID);
+}
+
+bool deleteDeadLoop(Loop *LP)
+{
+    BasicBlock *header = LP->getHeader();
+    BasicBlock *preheader = LP->getLoopPreheader();
+    BasicBlock *exit = LP->getExitBlock();
+    if (!preheader || !exit || LP->getExitingBlock() != header)
+        return false;
+    for (BasicBlock *bb : LP->blocks())
+        for (auto &inst : *bb)
+        {
+            if (inst.mayHaveSideEffects())
+                return false;
+            for (auto *user : inst.users())
+                if (!LP->contains(cast<Instruction>(user)))
+                    return false;
+        }
+
+    // 出口只从头块进入循环外，出口 phi 在头块这一路上的值都在循环外定义
+    for (PHINode &phi : exit->phis())
+        phi.setIncomingBlock(phi.getBasicBlockIndex(header), preheader);
+    preheader->getTerminator()->replaceUsesOfWith(header, exit);
+    SmallVector<BasicBlock *, 8> blocks(LP->blocks());
+    for (BasicBlock *bb : blocks)
+        bb->dropAllReferences();
+    for (BasicBlock *bb : blocks)
+        bb->eraseFromParent();
+    return true;
+}
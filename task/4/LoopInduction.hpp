@@ -0,0 +1,55 @@
+#pragma once
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+
+// 头块中每次迭代加上常量的 phi：回边上的值是 phi + step（或 phi - (-step)）
+struct Recurrence
+{
+    llvm::PHINode *phi;
+    llvm::Value *start;
+    int64_t step;
+    llvm::BinaryOperator *next;
+};
+
+// 头块中控制循环的归纳变量：iv 从 start 开始，每次迭代加 step，满足 iv pred bound 时进入循环体
+struct InductionInfo
+{
+    llvm::PHINode *iv;
+    llvm::Value *start;
+    int64_t step;
+    llvm::CmpInst::Predicate pred;
+    llvm::Value *bound;
+    // 头块在循环内的后继
+    llvm::BasicBlock *body;
+    // 循环执行期间归纳变量不会有符号溢出
+    bool noWrap;
+};
+
+// 头块退出、回边来自唯一的无条件跳转的循环
+bool isSimpleLoop(llvm::Loop *LP);
+
+// 识别头块中的整数递推 phi，循环必须有前置块和唯一的回边
+bool analyzeRecurrence(llvm::Loop *LP, llvm::PHINode *phi, Recurrence &rec);
+
+// 识别头块条件分支所比较的归纳变量，循环必须有前置块和唯一的回边
+bool analyzeInduction(llvm::Loop *LP, InductionInfo &info);
+
+// 循环体中的 continue 使循环有多条回边：每条回边都是无条件跳转、头块的每个 phi 在各条回边上
+// 取同一个值或同一个 phi + c 时，把回边合并到新建的唯一回边块，phi + c 在其中重新计算一次。
+// LoopInfo 随之更新，DominatorTree 失效
+bool mergeLatches(llvm::Loop *LP, llvm::LoopInfo &LI);
+
+// 初值和边界都是常量时求出循环体执行的次数
+bool getConstantTripCount(const InductionInfo &info, int64_t &tripCount);
+
+// 在 builder 处生成循环体执行次数（i64），只支持 noWrap 且方向与步长一致的 <、<=、>、>=，否则返回 nullptr
+llvm::Value *buildTripCount(llvm::IRBuilder<> &builder, const InductionInfo &info);
+
+// 在回边的 llvm.loop 元数据上添加标记 name，保留已有的标记
+void addLoopAttribute(llvm::BasicBlock *latch, llvm::StringRef name);
+
+// 没有副作用、也没有在循环外被使用的值且只从头块退出的循环：计数循环一定终止，前置块直接跳到出口并删除循环的块。
+// LoopInfo 随之失效
+bool deleteDeadLoop(llvm::Loop *LP);
@@ -1,132 +1,279 @@
 #include "LoopInvariantCodeMotion.hpp"
+#include "AliasOracle.hpp"
+#include "FunctionPurity.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/Analysis/LoopIterator.h>
+#include <llvm/Analysis/Loads.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
 
 using namespace llvm;
 
-void findNoNestedLoops(Loop *loop, std::vector<Loop *> &noNestedLoops)
+namespace {
+
+// 循环（包括内层循环）中的内存访问
+struct LoopMemory
+{
+    std::vector<LoadInst *> loads;
+    std::vector<StoreInst *> stores;
+    // 有不纯的调用或其它无法分析的写入
+    bool hasCall = false;
+    bool hasUnknownWrite = false;
+};
+
+class LoopHoister
 {
-    if (loop->getSubLoops().empty())
+  public:
+    LoopHoister(Loop *LP, LoopInfo &LI, DominatorTree &DT, AliasOracle &alias, const FunctionPurity::Result &purity)
+        : mLoop(LP), mLI(LI), mDT(DT), mAlias(alias), mPurity(purity), mDL(LP->getHeader()->getModule()->getDataLayout())
+    {
+        LP->getExitBlocks(mExits);
+    }
+
+    int hoist();
+    int promote();
+    int sink();
+
+  private:
+    LoopMemory collectMemory();
+
+    // 每次进入循环都会执行到 bb
+    bool isGuaranteedToExecute(BasicBlock *bb)
+    {
+        return all_of(mExits, [&](BasicBlock *exit) { return mDT.dominates(bb, exit); });
+    }
+
+    bool isInvariant(Instruction &inst)
     {
-        bool hasCall = false;
-        for (auto *bb : loop->blocks())
+        return all_of(inst.operands(), [&](Value *op) { return mLoop->isLoopInvariant(op); });
+    }
+
+    bool canHoist(Instruction &inst, const LoopMemory &mem);
+
+    Loop *mLoop;
+    LoopInfo &mLI;
+    DominatorTree &mDT;
+    AliasOracle &mAlias;
+    const FunctionPurity::Result &mPurity;
+    const DataLayout &mDL;
+    SmallVector<BasicBlock *, 4> mExits;
+};
+
+LoopMemory LoopHoister::collectMemory()
+{
+    LoopMemory mem;
+    for (BasicBlock *bb : mLoop->blocks())
+        for (auto &inst : *bb)
         {
-            for (auto &inst : *bb)
+            if (auto *load = dyn_cast<LoadInst>(&inst))
             {
-                if (auto *callInst = dyn_cast<CallInst>(&inst))
-                {
-                    hasCall = true;
-                    break;
-                }
+                mem.loads.push_back(load);
+                if (!load->isSimple())
+                    mem.hasUnknownWrite = true;
+            }
+            else if (auto *store = dyn_cast<StoreInst>(&inst))
+            {
+                mem.stores.push_back(store);
+                if (!store->isSimple())
+                    mem.hasUnknownWrite = true;
+            }
+            else if (auto *call = dyn_cast<CallBase>(&inst))
+            {
+                Function *callee = call->getCalledFunction();
+                if (!callee || !mPurity.isPure(callee))
+                    mem.hasCall = true;
+            }
+            else if (inst.mayWriteToMemory())
+            {
+                mem.hasUnknownWrite = true;
             }
         }
-        if (!hasCall)
-        {
-            noNestedLoops.push_back(loop);
-        }
+    return mem;
+}
+
+bool LoopHoister::canHoist(Instruction &inst, const LoopMemory &mem)
+{
+    if (isa<PHINode>(inst) || inst.isTerminator() || !isInvariant(inst))
+        return false;
+    BasicBlock *bb = inst.getParent();
+
+    if (auto *load = dyn_cast<LoadInst>(&inst))
+    {
+        if (!load->isSimple() || mem.hasUnknownWrite)
+            return false;
+        Value *ptr = load->getPointerOperand();
+        if (mem.hasCall && mAlias.mayBeWrittenByCall(ptr))
+            return false;
+        for (StoreInst *store : mem.stores)
+            if (mAlias.mayAlias(store->getPointerOperand(), store->getValueOperand()->getType(), ptr,
+                                load->getType()))
+                return false;
+        return isSafeToSpeculativelyExecute(load) || isGuaranteedToExecute(bb);
     }
-    else
+    if (auto *call = dyn_cast<CallBase>(&inst))
     {
-        for (auto *subLoop : loop->getSubLoops())
-        {
-            findNoNestedLoops(subLoop, noNestedLoops);
-        }
+        Function *callee = call->getCalledFunction();
+        if (!callee || !mPurity.isPure(callee))
+            return false;
+        return mPurity.isSpeculatable(callee) || isGuaranteedToExecute(bb);
     }
+    if (inst.mayHaveSideEffects() || inst.mayReadFromMemory() || isa<AllocaInst>(inst))
+        return false;
+    return isSafeToSpeculativelyExecute(&inst) || isGuaranteedToExecute(bb);
 }
 
-PreservedAnalyses LoopInvariantCodeMotion::run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam)
+int LoopHoister::hoist()
 {
-    int licmTimes = 0;
+    int hoistTimes = 0;
+    LoopMemory mem = collectMemory();
+    Instruction *insertPoint = mLoop->getLoopPreheader()->getTerminator();
+    // 逆后序遍历保证操作数先于使用者被外提
+    LoopBlocksRPO rpo(mLoop);
+    rpo.perform(&mLI);
+    for (BasicBlock *bb : rpo)
+        for (auto &inst : make_early_inc_range(*bb))
+            if (canHoist(inst, mem))
+            {
+                inst.moveBefore(insertPoint);
+                ++hoistTimes;
+            }
+    return hoistTimes;
+}
 
-    // 在FunctionAnalysisManager注册LoopAnalysis
-    FunctionAnalysisManager fam;
-    PassBuilder pb;
-    fam.registerPass([&] { return LoopAnalysis(); });
-    pb.registerFunctionAnalyses(fam);
-    std::vector<Loop *> noNestedLoops;
+int LoopHoister::promote()
+{
+    if (mExits.empty() || !mLoop->hasDedicatedExits())
+        return 0;
+    LoopMemory mem = collectMemory();
+    if (mem.hasUnknownWrite)
+        return 0;
 
-    for (auto &func : mod)
+    // 按地址分组，只考虑循环中被写入的不变地址
+    MapVector<Value *, SmallVector<Instruction *, 4>> accesses;
+    for (StoreInst *store : mem.stores)
+        if (mLoop->isLoopInvariant(store->getPointerOperand()))
+            accesses[store->getPointerOperand()].push_back(store);
+
+    int promoteTimes = 0;
+    for (auto &[ptr, insts] : accesses)
     {
-        if (func.isDeclaration())
+        Type *type = cast<StoreInst>(insts.front())->getValueOperand()->getType();
+        Align align = cast<StoreInst>(insts.front())->getAlign();
+        if (mem.hasCall && mAlias.mayBeWrittenByCall(ptr))
+            continue;
+        // 提前读入需要地址一定可以访问
+        if (!isDereferenceableAndAlignedPointer(ptr, type, align, mDL))
             continue;
 
-        auto &LI = fam.getResult<LoopAnalysis>(func);
-
-        for (auto *loop : LI)
+        // 其它可能别名的访问必须与它使用同一个地址和类型
+        bool promotable = true;
+        SmallVector<Instruction *, 8> uses;
+        for (LoadInst *load : mem.loads)
+        {
+            if (!mAlias.mayAlias(load->getPointerOperand(), load->getType(), ptr, type))
+                continue;
+            if (load->getPointerOperand() != ptr || load->getType() != type)
+                promotable = false;
+            uses.push_back(load);
+        }
+        for (StoreInst *store : mem.stores)
         {
-            findNoNestedLoops(loop, noNestedLoops);
+            Type *storeType = store->getValueOperand()->getType();
+            if (!mAlias.mayAlias(store->getPointerOperand(), storeType, ptr, type))
+                continue;
+            if (store->getPointerOperand() != ptr || storeType != type)
+                promotable = false;
+            uses.push_back(store);
         }
+        if (!promotable)
+            continue;
+
+        SmallVector<PHINode *, 8> newPhis;
+        SSAUpdater ssa(&newPhis);
+        SmallVector<const Instruction *, 8> constUses(uses.begin(), uses.end());
+        LoadAndStorePromoter promoter(constUses, ssa, ptr->getName());
+        auto *initial = new LoadInst(type, ptr, ptr->getName() + ".promoted", false, align,
+                                     mLoop->getLoopPreheader()->getTerminator());
+        ssa.AddAvailableValue(mLoop->getLoopPreheader(), initial);
+        promoter.run(uses);
+        for (BasicBlock *exit : mExits)
+            new StoreInst(ssa.GetValueInMiddleOfBlock(exit), ptr, false, align, &*exit->getFirstInsertionPt());
+
+        // 被删除的访问不能留在后续分组中
+        mem = collectMemory();
+        ++promoteTimes;
     }
+    return promoteTimes;
+}
 
-    for (auto *loop : noNestedLoops)
-    {
-        // 随循环改变的是 phi 节点的结果
-        std::vector<Instruction *> phiInsts;
-        std::vector<Instruction *> loopChangingInsts;
+int LoopHoister::sink()
+{
+    BasicBlock *exit = mLoop->getExitBlock();
+    if (!exit || !exit->getSinglePredecessor())
+        return 0;
 
-        for (auto *bb : loop->blocks())
-        {
-            for (auto &inst : *bb)
-            {
-                if (auto *phiInst = dyn_cast<PHINode>(&inst))
-                {
-                    phiInsts.push_back(phiInst);
-                }
-            }
-        }
-        while (!phiInsts.empty())
+    int sinkTimes = 0;
+    for (BasicBlock *bb : mLoop->blocks())
+    {
+        if (mLI.getLoopFor(bb) != mLoop || !mDT.dominates(bb, exit))
+            continue;
+        // 倒序处理，使用者下沉后操作数也能继续下沉
+        for (auto &inst : make_early_inc_range(reverse(*bb)))
         {
-            auto *phiInst = phiInsts.back();
-            phiInsts.pop_back();
-            if (std::find(loopChangingInsts.begin(), loopChangingInsts.end(), phiInst) == loopChangingInsts.end())
-            {
-                loopChangingInsts.push_back(phiInst);
-            }
-            for (auto *user : phiInst->users())
-            {
-                if (auto *inst = dyn_cast<Instruction>(user))
-                {
-                    if (std::find(phiInsts.begin(), phiInsts.end(), inst) == phiInsts.end() &&
-                        std::find(loopChangingInsts.begin(), loopChangingInsts.end(), inst) == loopChangingInsts.end())
-                    {
-                        phiInsts.push_back(inst);
-                        // inst->print(mOut);
-                        // mOut << "\n\r";
-                    }
-                }
-            }
+            if (isa<PHINode>(inst) || inst.isTerminator() || inst.mayHaveSideEffects() || inst.mayReadFromMemory() ||
+                inst.use_empty())
+                continue;
+            bool usedOutside = all_of(inst.users(), [&](User *user) {
+                auto *userInst = cast<Instruction>(user);
+                return !isa<PHINode>(userInst) && !mLoop->contains(userInst);
+            });
+            if (!usedOutside)
+                continue;
+            inst.moveBefore(&*exit->getFirstInsertionPt());
+            ++sinkTimes;
         }
+    }
+    return sinkTimes;
+}
 
-        // 提到循环之外的指令
-        std::vector<Instruction *> toMove;
-        for (auto *bb : loop->blocks())
-        {
-            for (auto &inst : *bb)
-            {
-                if (auto *brInst = dyn_cast<BranchInst>(&inst))
-                {
-                    continue;
-                }
-                if (std::find(loopChangingInsts.begin(), loopChangingInsts.end(), &inst) == loopChangingInsts.end())
-                {
-                    toMove.push_back(&inst);
-                }
-            }
-        }
+} // namespace
 
-            for (auto *inst : toMove)
-            {
-                inst->moveBefore(loop->getLoopPreheader()->getTerminator());
-                ++licmTimes;
-            }
-        // // 倒序移动
-        // for (auto it = toMove.rbegin(); it != toMove.rend(); ++it)
-        // {
-        //     (*it)->print(mOut);
-        //     mOut << "\n\r";
-        //     (*it)->moveBefore(loop->getLoopPreheader()->getTerminator());
-        //     ++licmTimes;
-        // }
+PreservedAnalyses LoopInvariantCodeMotion::run(llvm::Function &func, llvm::FunctionAnalysisManager &fam)
+{
+    int hoistTimes = 0;
+    int promoteTimes = 0;
+    int sinkTimes = 0;
+
+    auto &LI = fam.getResult<LoopAnalysis>(func);
+    auto &DT = fam.getResult<DominatorTreeAnalysis>(func);
+    AliasOracle alias(func.getParent()->getDataLayout());
+    // FunctionPurity 由流水线在本pass之前计算（FixpointPassManager::requireModuleAnalysis），
+    // 没有缓存时只按属性认定函数声明，调用已定义的函数都不外提
+    static const FunctionPurity::Result noPurity;
+    auto *purity = fam.getResult<ModuleAnalysisManagerFunctionProxy>(func).getCachedResult<FunctionPurity>(
+        *func.getParent());
+
+    // 先序的逆序：内层循环先于外层循环
+    SmallVector<Loop *, 8> loops = LI.getLoopsInPreorder();
+    for (Loop *LP : reverse(loops))
+    {
+        if (!LP->getLoopPreheader())
+            continue;
+        LoopHoister hoister(LP, LI, DT, alias, purity ? *purity : noPurity);
+        hoistTimes += hoister.hoist();
+        promoteTimes += hoister.promote();
+        sinkTimes += hoister.sink();
     }
 
-    mOut << "LoopInvariantCodeMotion running...\n\rTo move " << licmTimes << " instructions out of the loop\n\r";
-    return PreservedAnalyses::all();
+    if (!hoistTimes && !promoteTimes && !sinkTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("instructions hoisted", hoistTimes);
+    PassStatistics::count("scalars promoted", promoteTimes);
+    PassStatistics::count("instructions sunk", sinkTimes);
+    mOut << "LoopInvariantCodeMotion running on " << func.getName() << "...\n\rTo move " << hoistTimes
+         << " instructions out of the loop, promote " << promoteTimes << " memory locations and sink " << sinkTimes
+         << " instructions\n\r";
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
 }
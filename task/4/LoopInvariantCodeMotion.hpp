@@ -5,6 +5,12 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/Passes/PassBuilder.h"
 
+// 循环不变量外提：从内层循环到外层循环依次处理，内层提出的指令在外层循环中还能继续外提。
+//   - 操作数都不随循环变化的运算提到前置块；可能出错的指令（除法、访问未知地址）只在每次进入循环都会执行时外提；
+//   - 循环中没有可能别名的写入时，不变地址上的 load 一并外提；
+//   - FunctionPurity 认定为纯的函数调用可以外提，不可推测执行的只在每次进入循环都会执行时外提；
+//   - 只通过同一个不变地址读写的内存（如 a[i] += ...）在循环中换成寄存器，前置块读入，出口写回；
+//   - 只在循环之外使用的运算下沉到出口块。
 class LoopInvariantCodeMotion : public llvm::PassInfoMixin<LoopInvariantCodeMotion>
 {
   public:
@@ -12,7 +18,7 @@ class LoopInvariantCodeMotion : public llvm::PassInfoMixin<LoopInvariantCodeMoti
     {
     }
 
-    llvm::PreservedAnalyses run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
 
   private:
     llvm::raw_ostream &mOut;
@@ -0,0 +1,413 @@
+#include "LoopNestOptimization.hpp"
+#include "LoopDependence.hpp"
+#include "LoopInduction.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Transforms/Utils/LoopUtils.h>
+
+using namespace llvm;
+
+namespace {
+
+// 跨行访问每次迭代都换一条缓存行，代价按一行能放下的 int 个数计
+constexpr unsigned kStridedCost = 16;
+// 已经分块的块循环上的标记，避免重复分块
+constexpr const char *kTiledAttr = "sysu.loop.tiled";
+
+enum class NestAction
+{
+    None,
+    Interchange,
+    Tile,
+    TileOuter
+};
+
+struct LoopNest
+{
+    Loop *outer;
+    Loop *inner;
+    InductionInfo outerInfo;
+    InductionInfo innerInfo;
+    // 三层嵌套时内层循环唯一的子循环，否则为空
+    Loop *innermost = nullptr;
+    InductionInfo innermostInfo;
+    // 展开下标所用的归纳变量：外层、内层，三层嵌套时还有最内层
+    SmallVector<PHINode *, 3> ivs;
+    // 外层循环体中位于内层循环之前的块
+    SmallVector<BasicBlock *, 2> before;
+    SmallVector<ArrayAccess, 8> accesses;
+    NestAction action = NestAction::None;
+};
+
+// 头块中只有归纳变量、比较和跳转，回边上的 iv + c 只给归纳变量使用
+bool isControlOnly(Loop *LP, const InductionInfo &info)
+{
+    BasicBlock *header = LP->getHeader();
+    auto *cond = cast<Instruction>(cast<BranchInst>(header->getTerminator())->getCondition());
+    if (header->size() != 3 || &header->front() != info.iv || cond->getParent() != header || !cond->hasOneUse())
+        return false;
+    auto *next = cast<BinaryOperator>(info.iv->getIncomingValueForBlock(LP->getLoopLatch()));
+    return next->getOpcode() == Instruction::Add && next->hasOneUse() &&
+           info.body->getSinglePredecessor() == header;
+}
+
+// 沿无条件跳转从 from 走到 to，途经的块记入 path
+bool walkChain(BasicBlock *from, BasicBlock *to, SmallVectorImpl<BasicBlock *> &path)
+{
+    for (BasicBlock *bb = from; bb != to; bb = bb->getSingleSuccessor())
+    {
+        auto *br = dyn_cast<BranchInst>(bb->getTerminator());
+        if (!br || br->isConditional() || is_contained(path, bb))
+            return false;
+        path.push_back(bb);
+    }
+    return true;
+}
+
+bool analyzeNest(Loop *inner, const DataLayout &DL, LoopNest &nest)
+{
+    Loop *outer = inner->getParentLoop();
+    if (!outer || outer->getSubLoops().size() != 1 || !isSimpleLoop(inner) || !isSimpleLoop(outer))
+        return false;
+    nest.outer = outer;
+    nest.inner = inner;
+    if (!analyzeInduction(outer, nest.outerInfo) || !analyzeInduction(inner, nest.innerInfo) ||
+        !isControlOnly(outer, nest.outerInfo) || !isControlOnly(inner, nest.innerInfo))
+        return false;
+    // 矩形嵌套：内层的范围与外层归纳变量无关
+    if (!outer->isLoopInvariant(nest.innerInfo.start) || !outer->isLoopInvariant(nest.innerInfo.bound))
+        return false;
+    nest.ivs = {nest.outerInfo.iv, nest.innerInfo.iv};
+    // 三层嵌套：最内层循环是内层唯一的子循环，内层循环体中的其它部分（如 mm 中 A[i][k] == 0 时跳过的判断）不限
+    if (!inner->isInnermost())
+    {
+        if (inner->getSubLoops().size() != 1)
+            return false;
+        nest.innermost = inner->getSubLoops().front();
+        if (!nest.innermost->isInnermost() || !isSimpleLoop(nest.innermost) ||
+            !analyzeInduction(nest.innermost, nest.innermostInfo))
+            return false;
+        nest.ivs.push_back(nest.innermostInfo.iv);
+    }
+
+    // 外层循环体：头块 → 内层循环之前的块 → 内层循环 → 只有跳转的块 → 只有 iv + c 的回边块
+    BasicBlock *latch = outer->getLoopLatch();
+    SmallVector<BasicBlock *, 2> after;
+    if (!walkChain(nest.outerInfo.body, inner->getHeader(), nest.before) ||
+        !walkChain(inner->getExitBlock(), latch, after) || latch->size() != 2)
+        return false;
+    if (any_of(after, [](BasicBlock *bb) { return bb->size() != 1; }))
+        return false;
+    if (outer->getNumBlocks() != inner->getNumBlocks() + nest.before.size() + after.size() + 2)
+        return false;
+
+    // 嵌套中的值都不在嵌套外使用
+    for (BasicBlock *bb : outer->blocks())
+        for (auto &inst : *bb)
+            for (User *user : inst.users())
+                if (!outer->contains(cast<Instruction>(user)))
+                    return false;
+
+    SmallVector<BasicBlock *, 8> blocks(outer->blocks());
+    return collectAccesses(blocks, outer, nest.ivs, DL, nest.accesses);
+}
+
+// 交换两层后依赖方向不变：任何一对可能相关的访问，在两层上的距离都不会一正一负
+bool isPermutable(const LoopNest &nest)
+{
+    PHINode *outerIV = nest.outerInfo.iv, *innerIV = nest.innerInfo.iv;
+    for (auto &lhs : nest.accesses)
+        for (auto &rhs : nest.accesses)
+        {
+            if ((!lhs.isWrite && !rhs.isWrite) || &lhs > &rhs)
+                continue;
+            AccessDependence dep = testDependence(lhs, rhs, nest.ivs);
+            if (dep.independent)
+                continue;
+            // 没有约束的归纳变量正负都有可能
+            auto canBe = [&](PHINode *iv, bool positive) {
+                auto it = dep.distance.find(iv);
+                return it == dep.distance.end() || (positive ? it->second > 0 : it->second < 0);
+            };
+            if ((canBe(outerIV, true) && canBe(innerIV, false)) || (canBe(outerIV, false) && canBe(innerIV, true)))
+                return false;
+        }
+    return true;
+}
+
+unsigned getCost(const ArrayAccess &access, PHINode *iv)
+{
+    int64_t stride = getStride(access, iv);
+    if (!stride)
+        return 0;
+    return uint64_t(std::abs(stride)) <= access.size ? 1 : kStridedCost;
+}
+
+// iv 作为最内层归纳变量时，内层循环中各次访问的缓存代价
+unsigned getNestCost(const LoopNest &nest, PHINode *iv)
+{
+    unsigned cost = 0;
+    for (auto &access : nest.accesses)
+        if (access.affine && nest.inner->contains(access.inst))
+            cost += getCost(access, iv);
+    return cost;
+}
+
+// 交换时内层循环之前的计算要下沉到内层循环体中
+bool canSinkBefore(const LoopNest &nest)
+{
+    for (BasicBlock *bb : nest.before)
+        for (auto &inst : *bb)
+            if (!inst.isTerminator() && (inst.mayReadOrWriteMemory() || inst.mayHaveSideEffects()))
+                return false;
+    return true;
+}
+
+bool isInterchangeable(const LoopNest &nest)
+{
+    return canSinkBefore(nest) && getNestCost(nest, nest.outerInfo.iv) < getNestCost(nest, nest.innerInfo.iv) &&
+           isPermutable(nest);
+}
+
+bool isTileable(const LoopNest &nest, unsigned tileSize)
+{
+    const InductionInfo &info = nest.innerInfo;
+    auto *start = dyn_cast<ConstantInt>(info.start);
+    if (info.step != 1 || info.pred != CmpInst::ICMP_SLT || !start || start->isNegative() || !info.noWrap)
+        return false;
+    Loop *parent = nest.outer->getParentLoop();
+    if (parent && getBooleanLoopAttribute(parent, kTiledAttr))
+        return false;
+    int64_t tripCount = 0;
+    if (getConstantTripCount(info, tripCount) && tripCount <= tileSize)
+        return false;
+
+    // 有访问沿内层方向跨行、沿外层方向连续时才值得分块
+    if (none_of(nest.accesses, [&](const ArrayAccess &access) {
+            return access.affine && nest.inner->contains(access.inst) &&
+                   getCost(access, info.iv) == kStridedCost && getCost(access, nest.outerInfo.iv) == 1;
+        }))
+        return false;
+
+    // 外层循环体中内层循环以外的部分每块都会重新执行
+    for (auto &access : nest.accesses)
+    {
+        if (nest.inner->contains(access.inst))
+            continue;
+        for (auto &other : nest.accesses)
+            if (other.isWrite && !testDependence(access, other, nest.ivs).independent)
+                return false;
+    }
+    for (BasicBlock *bb : nest.outer->blocks())
+        if (!nest.inner->contains(bb))
+            for (auto &inst : *bb)
+                if (inst.mayHaveSideEffects())
+                    return false;
+    return isPermutable(nest);
+}
+
+// 三层嵌套中有最内层连续访问、只随内层变化的数组（C[i][j]）时才值得对外层分块
+bool isOuterTileable(const LoopNest &nest, unsigned tileSize)
+{
+    const InductionInfo &info = nest.outerInfo;
+    auto *start = dyn_cast<ConstantInt>(info.start);
+    if (!nest.innermost || info.step != 1 || info.pred != CmpInst::ICMP_SLT || !start || start->isNegative() ||
+        !info.noWrap)
+        return false;
+    Loop *parent = nest.outer->getParentLoop();
+    if (parent && getBooleanLoopAttribute(parent, kTiledAttr))
+        return false;
+    int64_t tripCount = 0;
+    if (getConstantTripCount(info, tripCount) && tripCount <= tileSize)
+        return false;
+
+    if (none_of(nest.accesses, [&](const ArrayAccess &access) {
+            return access.affine && nest.innermost->contains(access.inst) && !getStride(access, info.iv) &&
+                   getStride(access, nest.innerInfo.iv) && getCost(access, nest.innermostInfo.iv) == 1;
+        }))
+        return false;
+    return canSinkBefore(nest) && isPermutable(nest);
+}
+
+// 按 range 重新生成头块的条件，条件为真时进入 body
+void rebuildCondition(BasicBlock *header, PHINode *iv, const InductionInfo &range, BasicBlock *body)
+{
+    auto *br = cast<BranchInst>(header->getTerminator());
+    auto *oldCond = cast<Instruction>(br->getCondition());
+    IRBuilder<> builder(br);
+    br->setCondition(builder.CreateICmp(range.pred, iv, range.bound));
+    if (br->getSuccessor(0) != body)
+        br->swapSuccessors();
+    oldCond->eraseFromParent();
+}
+
+// 两个归纳变量交换范围，循环体中的使用随之交换，控制流不变
+void interchange(LoopNest &nest)
+{
+    PHINode *outerIV = nest.outerInfo.iv, *innerIV = nest.innerInfo.iv;
+    auto *outerNext = cast<BinaryOperator>(outerIV->getIncomingValueForBlock(nest.outer->getLoopLatch()));
+    auto *innerNext = cast<BinaryOperator>(innerIV->getIncomingValueForBlock(nest.inner->getLoopLatch()));
+    BasicBlock *outerHeader = nest.outer->getHeader(), *innerHeader = nest.inner->getHeader();
+    Value *outerCond = cast<BranchInst>(outerHeader->getTerminator())->getCondition();
+    Value *innerCond = cast<BranchInst>(innerHeader->getTerminator())->getCondition();
+
+    // 内层循环之前的计算下沉到内层循环体，交换后它们依赖的外层归纳变量在内层才有定义
+    Instruction *pos = &*nest.innerInfo.body->getFirstInsertionPt();
+    for (BasicBlock *bb : nest.before)
+        for (auto &inst : make_early_inc_range(*bb))
+            if (!inst.isTerminator())
+                inst.moveBefore(pos);
+
+    SmallVector<Use *, 8> outerUses, innerUses;
+    for (Use &use : outerIV->uses())
+        if (use.getUser() != outerNext && use.getUser() != outerCond)
+            outerUses.push_back(&use);
+    for (Use &use : innerIV->uses())
+        if (use.getUser() != innerNext && use.getUser() != innerCond)
+            innerUses.push_back(&use);
+    for (Use *use : outerUses)
+        use->set(innerIV);
+    for (Use *use : innerUses)
+        use->set(outerIV);
+
+    // 交换初值、步长与边界
+    outerIV->setIncomingValueForBlock(nest.outer->getLoopPreheader(), nest.innerInfo.start);
+    innerIV->setIncomingValueForBlock(nest.inner->getLoopPreheader(), nest.outerInfo.start);
+    Value *outerStep = outerNext->getOperand(1);
+    outerNext->setOperand(1, innerNext->getOperand(1));
+    innerNext->setOperand(1, outerStep);
+    bool outerNSW = outerNext->hasNoSignedWrap();
+    outerNext->setHasNoSignedWrap(innerNext->hasNoSignedWrap());
+    innerNext->setHasNoSignedWrap(outerNSW);
+    bool outerNUW = outerNext->hasNoUnsignedWrap();
+    outerNext->setHasNoUnsignedWrap(innerNext->hasNoUnsignedWrap());
+    innerNext->setHasNoUnsignedWrap(outerNUW);
+    rebuildCondition(outerHeader, outerIV, nest.innerInfo, nest.outerInfo.body);
+    rebuildCondition(innerHeader, innerIV, nest.outerInfo, nest.innerInfo.body);
+}
+
+// for (t = start; t < n; t += T) for (o ...) for (i = t; i < min(t + T, n); ++i)
+void tile(LoopNest &nest, unsigned tileSize)
+{
+    Function *func = nest.outer->getHeader()->getParent();
+    LLVMContext &ctx = func->getContext();
+    const InductionInfo &info = nest.innerInfo;
+    BasicBlock *preheader = nest.outer->getLoopPreheader();
+    BasicBlock *outerHeader = nest.outer->getHeader();
+    BasicBlock *exit = nest.outer->getExitBlock();
+
+    BasicBlock *tileHeader = BasicBlock::Create(ctx, "tile.header", func, outerHeader);
+    BasicBlock *tileLatch = BasicBlock::Create(ctx, "tile.latch", func, exit);
+    preheader->getTerminator()->replaceUsesOfWith(outerHeader, tileHeader);
+    outerHeader->replacePhiUsesWith(preheader, tileHeader);
+    outerHeader->getTerminator()->replaceUsesOfWith(exit, tileLatch);
+    exit->replacePhiUsesWith(outerHeader, tileHeader);
+
+    // 初值非负且 t < n，n - t 与 t + T 都不会溢出
+    IRBuilder<> builder(tileHeader);
+    Type *type = info.iv->getType();
+    Value *size = ConstantInt::get(type, tileSize);
+    PHINode *tileIV = builder.CreatePHI(type, 2, "tile");
+    Value *rest = builder.CreateSub(info.bound, tileIV);
+    Value *tileEnd = builder.CreateSelect(builder.CreateICmpSGT(rest, size), builder.CreateNSWAdd(tileIV, size),
+                                          info.bound, "tile.end");
+    builder.CreateCondBr(builder.CreateICmpSLT(tileIV, info.bound), outerHeader, exit);
+
+    builder.SetInsertPoint(tileLatch);
+    Value *tileNext = builder.CreateNSWAdd(tileIV, size);
+    builder.CreateBr(tileHeader);
+    addLoopAttribute(tileLatch, kTiledAttr);
+    tileIV->addIncoming(info.start, preheader);
+    tileIV->addIncoming(tileNext, tileLatch);
+
+    // 内层循环只走当前块
+    info.iv->setIncomingValueForBlock(nest.inner->getLoopPreheader(), tileIV);
+    cast<Instruction>(cast<BranchInst>(nest.inner->getHeader()->getTerminator())->getCondition())
+        ->replaceUsesOfWith(info.bound, tileEnd);
+}
+
+// for (t = start; t < n; t += T) for (i ...) for (o = t; o < min(t + T, n); ++o)：
+// 先交换两层，交换到内层的原外层范围再按块分开
+void tileOuter(LoopNest &nest, unsigned tileSize)
+{
+    interchange(nest);
+    InductionInfo range = nest.outerInfo;
+    range.iv = nest.innerInfo.iv;
+    range.body = nest.innerInfo.body;
+    nest.innerInfo = range;
+    tile(nest, tileSize);
+}
+
+} // namespace
+
+PreservedAnalyses LoopNestOptimization::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int mergeTimes = 0;
+    int interchangeTimes = 0;
+    int tileTimes = 0;
+    const DataLayout &DL = func.getParent()->getDataLayout();
+
+    // 三层嵌套的中间一层常有 continue（如 mm 中 A[i][k] == 0 时跳过），先把多条回边合并成一条
+    auto &LI = fam.getResult<LoopAnalysis>(func);
+    for (Loop *LP : LI.getLoopsInPreorder())
+        if (LP->getParentLoop() && LP->getSubLoops().size() == 1 && LP->getSubLoops().front()->isInnermost())
+            mergeTimes += mergeLatches(LP, LI);
+
+    // 每个最内层循环至多属于一个嵌套，各层都只有唯一的子循环，不同的嵌套互不相交；
+    // 全部分析完之后再改写，分块会使 LoopInfo 失效
+    SmallVector<LoopNest, 4> nests;
+    for (Loop *LP : LI.getLoopsInPreorder())
+    {
+        if (!LP->isInnermost())
+            continue;
+        LoopNest nest;
+        if (analyzeNest(LP, DL, nest))
+        {
+            if (isInterchangeable(nest))
+                nest.action = NestAction::Interchange;
+            else if (isTileable(nest, mTileSize))
+                nest.action = NestAction::Tile;
+        }
+        // 二层嵌套不能变换时，再看以它为最内层的三层嵌套
+        if (nest.action == NestAction::None && LP->getParentLoop())
+        {
+            nest = LoopNest();
+            if (analyzeNest(LP->getParentLoop(), DL, nest) && isOuterTileable(nest, mTileSize))
+                nest.action = NestAction::TileOuter;
+        }
+        if (nest.action != NestAction::None)
+            nests.push_back(std::move(nest));
+    }
+    for (auto &nest : nests)
+    {
+        if (nest.action == NestAction::Interchange)
+        {
+            interchange(nest);
+            ++interchangeTimes;
+        }
+        else if (nest.action == NestAction::Tile)
+        {
+            tile(nest, mTileSize);
+            ++tileTimes;
+        }
+        else
+        {
+            tileOuter(nest, mTileSize);
+            ++tileTimes;
+        }
+    }
+
+    if (!mergeTimes && !interchangeTimes && !tileTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("loop latches merged", mergeTimes);
+    PassStatistics::count("loop nests interchanged", interchangeTimes);
+    PassStatistics::count("loop nests tiled", tileTimes);
+    mOut << "LoopNestOptimization running on " << func.getName() << "...\n\rTo merge " << mergeTimes
+         << " loop latches, interchange " << interchangeTimes << " loop nests and tile " << tileTimes
+         << " loop nests\n\r";
+    if (mergeTimes || tileTimes)
+        return PreservedAnalyses::none();
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
+}
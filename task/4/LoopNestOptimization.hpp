@@ -0,0 +1,30 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 循环嵌套的交换与分块。二层嵌套只处理内层循环是外层循环唯一子循环、两层都是头块退出的计数循环、
+// 内层的范围与外层归纳变量无关、嵌套中的值不在嵌套外使用的情况：
+//   - 交换：按每次访问在两个归纳变量方向上的步长估计缓存代价，外层变量作为内层时代价更小则交换两层，
+//     让最内层连续访问内存。外层循环体中只能有内层循环，内层循环之前的无副作用计算下沉到内层循环体；
+//   - 分块：有访问沿内层方向跨行、沿外层方向连续（如转置）时，交换也无法让所有访问连续，
+//     把内层循环按 tileSize 次迭代分块，块循环移到外层之外，块内的数据在外层迭代之间留在缓存中。
+//     外层循环体中内层循环以外的部分每块重新执行一次，不能有副作用，读取的内存也不能被嵌套写入。
+// 三层嵌套（内层循环唯一的子循环是最内层循环，外层与内层满足上面的条件，内层循环体中可以有
+// continue 之类的判断，多条回边先合并成一条）只做外层分块：最内层连续访问、只随内层变化的数组
+// （如 mm 按 k、i、j 嵌套时的 C[i][j]）在外层每次迭代中都要整个重新读写，外层按 tileSize 次迭代分块、
+// 块内的外层移到内层之内，C[i] 在块内的外层迭代之间留在缓存中。
+// 所有变换都要求依赖距离在外层与内层上不会一正一负（LoopDependence），交换后依赖方向不变。
+class LoopNestOptimization : public llvm::PassInfoMixin<LoopNestOptimization>
+{
+  public:
+    LoopNestOptimization(llvm::raw_ostream &out, unsigned tileSize) : mOut(out), mTileSize(tileSize)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+    unsigned mTileSize;
+};
@@ -0,0 +1,230 @@
+#include "LoopStrengthReduction.hpp"
+#include "LoopDependence.hpp"
+#include "LoopInduction.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/Analysis/InstructionSimplify.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+using namespace llvm;
+
+namespace {
+
+// 地址相对于 base 只差常量偏移的一组 GEP，geps 中的常量是各自的字节偏移
+struct PointerGroup
+{
+    Value *base;
+    AffineExpr offset;
+    int64_t coeff;
+    Type *type;
+    SmallVector<std::pair<int64_t, GetElementPtrInst *>, 4> geps;
+};
+
+bool isSameOffset(const AffineExpr &a, const AffineExpr &b)
+{
+    if (a.terms.size() != b.terms.size())
+        return false;
+    for (auto &[term, coeff] : a.terms)
+        if (b.terms.lookup(term) != coeff)
+            return false;
+    return true;
+}
+
+// 前置块中新建的初值与增量常常是 0 * x、x * 1、x + 0，建好之后立即化简。
+// lsr 在不动点之后运行，不再有别的 pass 清理它们
+Value *simplify(Value *value, const DataLayout &DL)
+{
+    auto *inst = dyn_cast<Instruction>(value);
+    if (!inst)
+        return value;
+    Value *simple = SimplifyInstruction(inst, DL);
+    if (!simple)
+        return value;
+    inst->replaceAllUsesWith(simple);
+    inst->eraseFromParent();
+    return simple;
+}
+
+// 与归纳变量同类型、同初值、同步长的递推 phi 与归纳变量始终相等
+int mergeCongruentIVs(Loop *LP, const InductionInfo &info)
+{
+    int times = 0;
+    for (PHINode &phi : make_early_inc_range(LP->getHeader()->phis()))
+    {
+        Recurrence rec;
+        if (&phi == info.iv || phi.getType() != info.iv->getType() || !analyzeRecurrence(LP, &phi, rec) ||
+            rec.start != info.start || rec.step != info.step)
+            continue;
+        phi.replaceAllUsesWith(info.iv);
+        phi.eraseFromParent();
+        RecursivelyDeleteTriviallyDeadInstructions(rec.next);
+        ++times;
+    }
+    return times;
+}
+
+// iv * x 在第 k 次迭代的值是 start * x + k * (step * x)，按模 2^n 的运算总是相等
+int reduceMultiplications(Loop *LP, const InductionInfo &info, const DataLayout &DL)
+{
+    SmallVector<BinaryOperator *, 4> muls;
+    for (BasicBlock *bb : LP->blocks())
+        for (Instruction &inst : *bb)
+            if (inst.getOpcode() == Instruction::Mul &&
+                (inst.getOperand(0) == info.iv || inst.getOperand(1) == info.iv) &&
+                LP->isLoopInvariant(inst.getOperand(inst.getOperand(0) == info.iv ? 1 : 0)))
+                muls.push_back(cast<BinaryOperator>(&inst));
+
+    BasicBlock *header = LP->getHeader();
+    BasicBlock *preheader = LP->getLoopPreheader();
+    BasicBlock *latch = LP->getLoopLatch();
+    Type *type = info.iv->getType();
+    for (BinaryOperator *mul : muls)
+    {
+        Value *factor = mul->getOperand(mul->getOperand(0) == info.iv ? 1 : 0);
+        IRBuilder<> builder(preheader->getTerminator());
+        Value *init = simplify(builder.CreateMul(info.start, factor), DL);
+        Value *inc = simplify(builder.CreateMul(factor, ConstantInt::get(type, info.step)), DL);
+        PHINode *counter = PHINode::Create(type, 2, mul->getName() + ".lsr", &header->front());
+        builder.SetInsertPoint(latch->getTerminator());
+        counter->addIncoming(init, preheader);
+        counter->addIncoming(builder.CreateAdd(counter, inc, counter->getName() + ".next"), latch);
+        mul->replaceAllUsesWith(counter);
+        mul->eraseFromParent();
+    }
+    return muls.size();
+}
+
+// 在 insertBefore 处重新计算循环中的地址 value，归纳变量取初值
+Value *cloneAtStart(Value *value, Loop *LP, const InductionInfo &info, const DataLayout &DL,
+                    Instruction *insertBefore, DenseMap<Value *, Value *> &clones)
+{
+    if (value == info.iv)
+        return info.start;
+    auto *inst = dyn_cast<Instruction>(value);
+    if (!inst || !LP->contains(inst))
+        return value;
+    if (Value *clone = clones.lookup(inst))
+        return clone;
+    Instruction *clone = inst->clone();
+    for (unsigned i = 0; i < clone->getNumOperands(); ++i)
+        clone->setOperand(i, cloneAtStart(clone->getOperand(i), LP, info, DL, insertBefore, clones));
+    clone->insertBefore(insertBefore);
+    clone->setName(inst->getName() + ".start");
+    return clones[inst] = simplify(clone, DL);
+}
+
+// 收集循环中地址随归纳变量线性变化的 GEP，只取不再被其它 GEP 使用的那一个
+void collectPointerGroups(Loop *LP, const InductionInfo &info, const DataLayout &DL,
+                          SmallVectorImpl<PointerGroup> &groups)
+{
+    for (BasicBlock *bb : LP->blocks())
+        for (Instruction &inst : *bb)
+        {
+            auto *gep = dyn_cast<GetElementPtrInst>(&inst);
+            if (!gep || any_of(gep->users(), [](User *user) { return isa<GetElementPtrInst>(user); }))
+                continue;
+            Value *base;
+            AffineExpr offset;
+            if (!decomposeAddress(gep, DL, base, offset) || !LP->isLoopInvariant(base))
+                continue;
+            int64_t coeff = offset.terms.lookup(info.iv);
+            int64_t size = DL.getTypeAllocSize(gep->getResultElementType()).getFixedSize();
+            offset.terms.erase(info.iv);
+            // 每次迭代的增量必须是整数个元素
+            if (!coeff || !size || (coeff * info.step) % size ||
+                any_of(offset.terms, [&](auto &term) { return !LP->isLoopInvariant(term.first); }))
+                continue;
+            auto group = find_if(groups, [&](PointerGroup &group) {
+                return group.base == base && group.coeff == coeff && group.type == gep->getType() &&
+                       isSameOffset(group.offset, offset) && (offset.constant - group.offset.constant) % size == 0;
+            });
+            if (group == groups.end())
+                group = groups.insert(groups.end(), {base, offset, coeff, gep->getType(), {}});
+            group->geps.push_back({offset.constant, gep});
+        }
+}
+
+// 组中偏移最小的 GEP 成为头块中的指针 phi，其余的 GEP 从它加上常量偏移
+void reducePointerGroup(Loop *LP, const InductionInfo &info, const DataLayout &DL, PointerGroup &group)
+{
+    BasicBlock *header = LP->getHeader();
+    BasicBlock *preheader = LP->getLoopPreheader();
+    BasicBlock *latch = LP->getLoopLatch();
+    auto [anchorOffset, anchor] = *std::min_element(group.geps.begin(), group.geps.end(),
+                                                    [](auto &lhs, auto &rhs) { return lhs.first < rhs.first; });
+    Type *elementType = anchor->getResultElementType();
+    int64_t size = DL.getTypeAllocSize(elementType).getFixedSize();
+
+    DenseMap<Value *, Value *> clones;
+    Value *start = cloneAtStart(anchor, LP, info, DL, preheader->getTerminator(), clones);
+    PHINode *ptr = PHINode::Create(group.type, 2, anchor->getName() + ".lsr", &header->front());
+    IRBuilder<> builder(latch->getTerminator());
+    ptr->addIncoming(start, preheader);
+    ptr->addIncoming(builder.CreateGEP(elementType, ptr, builder.getInt64(group.coeff * info.step / size),
+                                       ptr->getName() + ".next"),
+                     latch);
+
+    for (auto [offset, gep] : group.geps)
+    {
+        Value *replacement = ptr;
+        if (offset != anchorOffset)
+        {
+            builder.SetInsertPoint(gep);
+            replacement = builder.CreateGEP(elementType, ptr, builder.getInt64((offset - anchorOffset) / size),
+                                            gep->getName());
+        }
+        gep->replaceAllUsesWith(replacement);
+        RecursivelyDeleteTriviallyDeadInstructions(gep);
+    }
+}
+
+// 每次改写一组，改写之后其它组的地址计算可能已经变化，重新收集
+int reducePointers(Loop *LP, const InductionInfo &info, const DataLayout &DL)
+{
+    int times = 0;
+    while (true)
+    {
+        SmallVector<PointerGroup, 4> groups;
+        collectPointerGroups(LP, info, DL, groups);
+        if (groups.empty())
+            return times;
+        reducePointerGroup(LP, info, DL, groups.front());
+        ++times;
+    }
+}
+
+} // namespace
+
+PreservedAnalyses LoopStrengthReduction::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int ivTimes = 0;
+    int mulTimes = 0;
+    int pointerTimes = 0;
+    const DataLayout &DL = func.getParent()->getDataLayout();
+
+    // 只增加 phi 和指令，不改变控制流，LoopInfo 始终有效；内层循环先改写，它在前置块中计算的初值再由外层循环削弱
+    auto &LI = fam.getResult<LoopAnalysis>(func);
+    SmallVector<Loop *, 8> loops = LI.getLoopsInPreorder();
+    for (Loop *LP : reverse(loops))
+    {
+        InductionInfo info;
+        if (!isSimpleLoop(LP) || !analyzeInduction(LP, info))
+            continue;
+        // 先改写地址，乘法换成计数器之后 decomposeAddress 就认不出其中的归纳变量了
+        ivTimes += mergeCongruentIVs(LP, info);
+        pointerTimes += reducePointers(LP, info, DL);
+        mulTimes += reduceMultiplications(LP, info, DL);
+    }
+
+    if (!ivTimes && !mulTimes && !pointerTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("induction variables merged", ivTimes);
+    PassStatistics::count("multiplications reduced", mulTimes);
+    PassStatistics::count("pointers reduced", pointerTimes);
+    mOut << "LoopStrengthReduction running on " << func.getName() << "...\n\rTo merge " << ivTimes
+         << " induction variables, reduce " << mulTimes << " multiplications and " << pointerTimes
+         << " pointer groups\n\r";
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
+}
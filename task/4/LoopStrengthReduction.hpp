@@ -0,0 +1,24 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 循环强度削弱，作用于头块退出、回边来自唯一的无条件跳转的计数循环（从内到外）：
+//   - 与归纳变量初值、步长都相同的递推 phi 是冗余的归纳变量，改用归纳变量；
+//   - iv * x（x 在循环中不变）换成每次迭代加 step * x 的计数器；
+//   - 地址是 base + c * iv + 不变量（LoopDependence::decomposeAddress）的 GEP 换成每次迭代递增的指针，
+//     只差常量偏移的 GEP 共用一个指针，从它加上常量偏移得到。
+// 指针的初值在前置块中按归纳变量的初值重新计算一遍原来的地址。
+// 生成的指针 phi 不再是仿射下标，其它循环优化认不出来，因此作为收尾 pass 在流水线收敛之后运行。
+class LoopStrengthReduction : public llvm::PassInfoMixin<LoopStrengthReduction>
+{
+  public:
+    explicit LoopStrengthReduction(llvm::raw_ostream &out) : mOut(out)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+};
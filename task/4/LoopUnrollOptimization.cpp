@@ -1,194 +1,323 @@
-
 #include "LoopUnrollOptimization.hpp"
+#include "LoopInduction.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 
 using namespace llvm;
 
-void LoopUnrollOptimization::unrollLoop(Loop *LP)
+namespace {
+
+// 完全展开后的指令数上限
+constexpr int64_t kFullUnrollThreshold = 400;
+// 部分展开、运行时展开后循环体的指令数上限
+constexpr unsigned kPartialUnrollThreshold = 160;
+constexpr unsigned kMaxUnrollFactor = 8;
+// 展开出的循环上的标记，避免重复展开
+constexpr const char *kUnrollDisableAttr = "llvm.loop.unroll.disable";
+
+enum class UnrollKind
 {
-    // 从 header 块中找到 icmp 指令
-    int start = 114514, end = 114514, step = 114514;
-    for (Instruction &inst : *LP->getHeader())
+    None,
+    Full,
+    Partial,
+    Runtime
+};
+
+unsigned getLoopSize(Loop *LP)
+{
+    unsigned size = 0;
+    for (BasicBlock *bb : LP->blocks())
+        size += bb->size() - std::distance(bb->phis().begin(), bb->phis().end());
+    return size;
+}
+
+Value *lookup(ValueToValueMapTy &vmap, Value *value)
+{
+    auto it = vmap.find(value);
+    return it != vmap.end() ? static_cast<Value *>(it->second) : value;
+}
+
+// 复制循环的全部基本块，复制出的块插在 insertBefore 之前，指令操作数尚未重映射
+SmallVector<BasicBlock *, 8> cloneLoopBlocks(Loop *LP, ValueToValueMapTy &vmap, const Twine &suffix,
+                                             BasicBlock *insertBefore)
+{
+    SmallVector<BasicBlock *, 8> blocks;
+    for (BasicBlock *bb : LP->blocks())
+    {
+        BasicBlock *clone = CloneBasicBlock(bb, vmap, suffix, bb->getParent());
+        clone->moveBefore(insertBefore);
+        vmap[bb] = clone;
+        blocks.push_back(clone);
+    }
+    return blocks;
+}
+
+// 把分支换成无条件跳转到 target，原来的条件如果没有其它使用者一并删除
+void replaceWithBranch(BasicBlock *bb, BasicBlock *target)
+{
+    Instruction *term = bb->getTerminator();
+    Value *cond = isa<BranchInst>(term) && cast<BranchInst>(term)->isConditional()
+                      ? cast<BranchInst>(term)->getCondition()
+                      : nullptr;
+    BranchInst::Create(target, term);
+    term->eraseFromParent();
+    if (cond)
+        RecursivelyDeleteTriviallyDeadInstructions(cond);
+}
+
+// 在原循环体之后串上 count - 1 份副本：第 k 份副本头块的 phi 取第 k-1 份副本回边上的值，
+// 副本头块不再判断出口，最后一份副本的回边回到原头块。vmaps[k - 1] 为第 k 份副本的映射
+void appendCopies(Loop *LP, const InductionInfo &info, unsigned count,
+                  std::vector<std::unique_ptr<ValueToValueMapTy>> &vmaps, SmallPtrSetImpl<BasicBlock *> &loopBlocks)
+{
+    BasicBlock *header = LP->getHeader();
+    BasicBlock *latch = LP->getLoopLatch();
+    BasicBlock *exit = LP->getExitBlock();
+    BasicBlock *prevLatch = latch;
+
+    for (unsigned k = 1; k < count; ++k)
     {
-        if (ICmpInst *icmp = dyn_cast<ICmpInst>(&inst))
+        auto vmap = std::make_unique<ValueToValueMapTy>();
+        auto blocks = cloneLoopBlocks(LP, *vmap, ".unroll" + Twine(k), exit);
+        for (PHINode &phi : header->phis())
         {
-            if (ConstantInt *CI = dyn_cast<ConstantInt>(icmp->getOperand(1)))
-            {
-                end = CI->getZExtValue();
-            }
-            if (PHINode *phi = dyn_cast<PHINode>(icmp->getOperand(0)))
-            {
-                if (ConstantInt *CI = dyn_cast<ConstantInt>(phi->getIncomingValue(0)))
-                {
-                    start = CI->getZExtValue();
-                }
-                if (Instruction *op = dyn_cast<Instruction>(phi->getIncomingValue(1)))
-                {
-                    if (BinaryOperator *binOp = dyn_cast<BinaryOperator>(op))
-                    {
-                        if (binOp->getOpcode() == Instruction::Add || binOp->getOpcode() == Instruction::Sub)
-                        {
-                            if (ConstantInt *CI = dyn_cast<ConstantInt>(binOp->getOperand(1)))
-                            {
-                                step = CI->getZExtValue();
-                            }
-                        }
-                    }
-                }
-            }
-            if (start != 114514 && end != 114514 && step != 114514 && end < 80)
-            {
-                BasicBlock *newBB = BasicBlock::Create(icmp->getContext(), "loop.unroll",
-                                                       icmp->getParent()->getParent(), LP->getLoopLatch());
-                IRBuilder<> builder(newBB);
-                std::map<Value *, Value *> paramMap;
-                for (int i = start; i < end; i += step)
-                {
-                    // header
-                    for (Instruction &inst : *LP->getHeader())
-                    {
-                        if (BranchInst *branch = dyn_cast<BranchInst>(&inst))
-                        {
-                            continue;
-                        }
-                        if (PHINode *phi = dyn_cast<PHINode>(&inst))
-                        {
-                            if (paramMap.find(&inst) != paramMap.end())
-                            {
-                                paramMap[&inst] = paramMap[phi->getIncomingValue(1)];
-                            }
-                            else
-                            {
-                                paramMap[&inst] = phi->getIncomingValue(0);
-                            }
-                            continue;
-                        }
-                        Instruction *newInst = inst.clone();
-                        for (unsigned i = 0; i < newInst->getNumOperands(); i++)
-                        {
-                            if (paramMap.find(newInst->getOperand(i)) != paramMap.end())
-                            {
-                                newInst->setOperand(i, paramMap[newInst->getOperand(i)]);
-                            }
-                        }
-                        builder.Insert(newInst);
-                        paramMap[&inst] = newInst;
-                    }
-                    // latch
-                    for (Instruction &inst : *LP->getLoopLatch())
-                    {
-                        if (BranchInst *branch = dyn_cast<BranchInst>(&inst))
-                        {
-                            continue;
-                        }
-                        if (PHINode *phi = dyn_cast<PHINode>(&inst))
-                        {
-                            if (paramMap.find(&inst) != paramMap.end())
-                            {
-                                paramMap[&inst] = paramMap[phi->getIncomingValue(1)];
-                            }
-                            else
-                            {
-                                paramMap[&inst] = phi->getIncomingValue(0);
-                            }
-                            continue;
-                        }
-                        Instruction *newInst = inst.clone();
-                        for (unsigned i = 0; i < newInst->getNumOperands(); i++)
-                        {
-                            if (paramMap.find(newInst->getOperand(i)) != paramMap.end())
-                            {
-                                newInst->setOperand(i, paramMap[newInst->getOperand(i)]);
-                            }
-                        }
-                        builder.Insert(newInst);
-                        paramMap[&inst] = newInst;
-                    }
-                }
-                // header
-                for (Instruction &inst : *LP->getHeader())
-                {
-                    if (BranchInst *branch = dyn_cast<BranchInst>(&inst))
-                    {
-                        continue;
-                    }
-                    if (PHINode *phi = dyn_cast<PHINode>(&inst))
-                    {
-                        if (paramMap.find(&inst) != paramMap.end())
-                        {
-                            paramMap[&inst] = paramMap[phi->getIncomingValue(1)];
-                            continue;
-                        }
-                        else
-                        {
-                            paramMap[&inst] = phi->getIncomingValue(0);
-                            continue;
-                        }
-                    }
-                    Instruction *newInst = inst.clone();
-                    for (unsigned i = 0; i < newInst->getNumOperands(); i++)
-                    {
-                        if (paramMap.find(newInst->getOperand(i)) != paramMap.end())
-                        {
-                            newInst->setOperand(i, paramMap[newInst->getOperand(i)]);
-                        }
-                    }
-                    builder.Insert(newInst);
-                    paramMap[&inst] = newInst;
-                }
-                // 跳转替换
-                builder.CreateBr(LP->getExitBlock());
-                for (Instruction &inst : *LP->getLoopPreheader())
-                {
-                    if (BranchInst *branch = dyn_cast<BranchInst>(&inst))
-                    {
-                        for (unsigned i = 0; i < branch->getNumSuccessors(); i++)
-                        {
-                            if (branch->getSuccessor(i) == LP->getHeader())
-                            {
-                                branch->setSuccessor(i, newBB);
-                            }
-                        }
-                    }
-                }
-                // 后续变量使用替换
-                for (auto &pair : paramMap)
-                {
-                    pair.first->replaceAllUsesWith(pair.second);
-                }
-            }
+            auto *clonePhi = cast<PHINode>((*vmap)[&phi]);
+            Value *incoming = phi.getIncomingValueForBlock(latch);
+            (*vmap)[&phi] = vmaps.empty() ? incoming : lookup(*vmaps.back(), incoming);
+            clonePhi->eraseFromParent();
         }
+        remapInstructionsInBlocks(blocks, *vmap);
+        loopBlocks.insert(blocks.begin(), blocks.end());
+
+        auto *newHeader = cast<BasicBlock>((*vmap)[header]);
+        auto *newLatch = cast<BasicBlock>((*vmap)[latch]);
+        replaceWithBranch(newHeader, cast<BasicBlock>((*vmap)[info.body]));
+        newLatch->getTerminator()->replaceUsesOfWith(newHeader, header);
+        // 原回边要等所有副本复制完再改，否则之后的副本会复制到改过的跳转
+        if (prevLatch != latch)
+            prevLatch->getTerminator()->replaceUsesOfWith(header, newHeader);
+        prevLatch = newLatch;
+        vmaps.push_back(std::move(vmap));
+    }
+    latch->getTerminator()->replaceUsesOfWith(header, cast<BasicBlock>((*vmaps.front())[header]));
+
+    for (PHINode &phi : header->phis())
+    {
+        int idx = phi.getBasicBlockIndex(latch);
+        phi.setIncomingValue(idx, lookup(*vmaps.back(), phi.getIncomingValue(idx)));
+        phi.setIncomingBlock(idx, prevLatch);
+    }
+}
+
+// 循环从 exiting 而不是原头块退出：出口块的 phi 和循环外对头块中值的使用改为 vmap 中对应的值
+void redirectExit(BasicBlock *header, BasicBlock *exit, BasicBlock *exiting, ValueToValueMapTy &vmap,
+                  const SmallPtrSetImpl<BasicBlock *> &loopBlocks)
+{
+    for (PHINode &phi : exit->phis())
+        for (unsigned i = 0; i < phi.getNumIncomingValues(); ++i)
+            if (phi.getIncomingBlock(i) == header)
+                phi.setIncomingBlock(i, exiting);
+    // 先收集再替换：头块的 phi 可能互为回边上的值（如交换），边收集边替换会把改过的使用再映射一次
+    SmallVector<std::pair<Use *, Value *>, 8> uses;
+    for (Instruction &inst : *header)
+    {
+        Value *mapped = lookup(vmap, &inst);
+        if (mapped == &inst)
+            continue;
+        for (Use &use : inst.uses())
+            if (!loopBlocks.count(cast<Instruction>(use.getUser())->getParent()))
+                uses.push_back({&use, mapped});
     }
+    for (auto [use, mapped] : uses)
+        use->set(mapped);
+}
+
+void fullUnroll(Loop *LP, const InductionInfo &info, int64_t tripCount)
+{
+    BasicBlock *header = LP->getHeader();
+    BasicBlock *preheader = LP->getLoopPreheader();
+    BasicBlock *exit = LP->getExitBlock();
+    SmallPtrSet<BasicBlock *, 32> loopBlocks(LP->block_begin(), LP->block_end());
+    std::vector<std::unique_ptr<ValueToValueMapTy>> vmaps;
 
-    for (Loop *subLoop : LP->getSubLoops())
+    // 多复制一份，只保留它的头块用来计算退出时的值
+    appendCopies(LP, info, tripCount + 1, vmaps, loopBlocks);
+    ValueToValueMapTy &last = *vmaps.back();
+    auto *lastHeader = cast<BasicBlock>(last[header]);
+    replaceWithBranch(lastHeader, exit);
+    std::vector<BasicBlock *> deadBlocks;
+    for (BasicBlock *bb : LP->blocks())
+        if (bb != header)
+            deadBlocks.push_back(cast<BasicBlock>(last[bb]));
+    redirectExit(header, exit, lastHeader, last, loopBlocks);
+
+    // 原头块只从前置块进入
+    for (PHINode &phi : make_early_inc_range(header->phis()))
     {
-        unrollLoop(subLoop);
+        phi.replaceAllUsesWith(phi.getIncomingValueForBlock(preheader));
+        phi.eraseFromParent();
     }
+    replaceWithBranch(header, info.body);
+    for (BasicBlock *bb : deadBlocks)
+        bb->dropAllReferences();
+    for (BasicBlock *bb : deadBlocks)
+        bb->eraseFromParent();
+}
+
+void partialUnroll(Loop *LP, const InductionInfo &info, unsigned factor)
+{
+    // 复制之后回边不再来自原循环的块，LoopInfo 求不出回边，先记下来
+    BasicBlock *latch = LP->getLoopLatch();
+    SmallPtrSet<BasicBlock *, 32> loopBlocks(LP->block_begin(), LP->block_end());
+    std::vector<std::unique_ptr<ValueToValueMapTy>> vmaps;
+    appendCopies(LP, info, factor, vmaps, loopBlocks);
+    addLoopAttribute(cast<BasicBlock>((*vmaps.back())[latch]), kUnrollDisableAttr);
+}
+
+// 主循环在剩余迭代不少于 factor 次时一次执行 factor 个迭代，之后由余数循环（原循环的副本）收尾
+void runtimeUnroll(Loop *LP, const InductionInfo &info, unsigned factor)
+{
+    BasicBlock *header = LP->getHeader();
+    BasicBlock *preheader = LP->getLoopPreheader();
+    BasicBlock *latch = LP->getLoopLatch();
+    BasicBlock *exit = LP->getExitBlock();
+    SmallPtrSet<BasicBlock *, 32> loopBlocks(LP->block_begin(), LP->block_end());
+
+    // 余数循环从主循环的头块进入，初值是主循环退出时的值
+    ValueToValueMapTy epilogue;
+    auto blocks = cloneLoopBlocks(LP, epilogue, ".epil", exit);
+    remapInstructionsInBlocks(blocks, epilogue);
+    loopBlocks.insert(blocks.begin(), blocks.end());
+    auto *epilogueHeader = cast<BasicBlock>(epilogue[header]);
+    for (PHINode &phi : header->phis())
+    {
+        auto *epiloguePhi = cast<PHINode>(epilogue[&phi]);
+        int idx = epiloguePhi->getBasicBlockIndex(preheader);
+        epiloguePhi->setIncomingValue(idx, &phi);
+        epiloguePhi->setIncomingBlock(idx, header);
+    }
+    addLoopAttribute(cast<BasicBlock>(epilogue[latch]), kUnrollDisableAttr);
+
+    std::vector<std::unique_ptr<ValueToValueMapTy>> vmaps;
+    appendCopies(LP, info, factor, vmaps, loopBlocks);
+    addLoopAttribute(cast<BasicBlock>((*vmaps.back())[latch]), kUnrollDisableAttr);
+    redirectExit(header, exit, epilogueHeader, epilogue, loopBlocks);
+
+    // iv + (factor - 1) * step 仍满足循环条件时才进入主循环体，在 i64 上计算避免溢出
+    Instruction *term = header->getTerminator();
+    IRBuilder<> builder(term);
+    Type *i64 = builder.getInt64Ty();
+    Value *last = builder.CreateAdd(builder.CreateSExt(info.iv, i64),
+                                    ConstantInt::get(i64, (int64_t)(factor - 1) * info.step), "unroll.last");
+    Value *cond = builder.CreateICmp(info.pred, last, builder.CreateSExt(info.bound, i64), "unroll.cond");
+    Value *oldCond = cast<BranchInst>(term)->getCondition();
+    builder.CreateCondBr(cond, info.body, epilogueHeader);
+    term->eraseFromParent();
+    RecursivelyDeleteTriviallyDeadInstructions(oldCond);
 }
 
-PreservedAnalyses LoopUnrollOptimization::run(Module &mod, ModuleAnalysisManager &mam)
+UnrollKind unrollLoop(Loop *LP)
 {
-    int unrollTimes = 0;
+    if (!LP->isInnermost() || getBooleanLoopAttribute(LP, kUnrollDisableAttr))
+        return UnrollKind::None;
+    // 只处理只从头块退出的循环，回边来自唯一的无条件跳转
+    if (!isSimpleLoop(LP))
+        return UnrollKind::None;
+
+    InductionInfo info;
+    if (!analyzeInduction(LP, info))
+        return UnrollKind::None;
+    unsigned size = getLoopSize(LP);
+    int64_t tripCount = 0;
+    bool constant = getConstantTripCount(info, tripCount);
+    if (constant)
+    {
+        // 不执行的循环留给常量传播处理
+        if (tripCount == 0)
+            return UnrollKind::None;
+        if (tripCount * size <= kFullUnrollThreshold)
+        {
+            fullUnroll(LP, info, tripCount);
+            return UnrollKind::Full;
+        }
+    }
 
-    // 在FunctionAnalysisManager注册LoopAnalysis
-    FunctionAnalysisManager fam;
-    PassBuilder pb;
-    fam.registerPass([&] { return LoopAnalysis(); });
-    pb.registerFunctionAnalyses(fam);
+    unsigned factor = kMaxUnrollFactor;
+    while (factor > 1 && factor * size > kPartialUnrollThreshold)
+        factor /= 2;
+    if (factor < 2)
+        return UnrollKind::None;
 
-    for (Function &func : mod)
+    if (constant)
     {
-        if (func.isDeclaration())
+        // 取不超过展开因子的最大约数，整除时不需要余数循环
+        unsigned divisor = factor;
+        while (divisor > 1 && tripCount % divisor)
+            --divisor;
+        if (divisor > 1)
         {
-            continue;
+            partialUnroll(LP, info, divisor);
+            return UnrollKind::Partial;
         }
+        if (tripCount < factor)
+            return UnrollKind::None;
+    }
 
-        LoopInfo &LI = fam.getResult<LoopAnalysis>(func);
-        for (Loop *LP : LI)
+    // 运行时展开会在余数循环中重新执行头块，头块不能有副作用
+    if (!info.noWrap || (info.pred != CmpInst::ICMP_SLT && info.pred != CmpInst::ICMP_SLE &&
+                         info.pred != CmpInst::ICMP_SGT && info.pred != CmpInst::ICMP_SGE))
+        return UnrollKind::None;
+    if ((info.step > 0) != (info.pred == CmpInst::ICMP_SLT || info.pred == CmpInst::ICMP_SLE))
+        return UnrollKind::None;
+    for (Instruction &inst : *LP->getHeader())
+        if (inst.mayHaveSideEffects())
+            return UnrollKind::None;
+    runtimeUnroll(LP, info, factor);
+    return UnrollKind::Runtime;
+}
+
+} // namespace
+
+PreservedAnalyses LoopUnrollOptimization::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int fullTimes = 0;
+    int partialTimes = 0;
+    int runtimeTimes = 0;
+
+    // 只展开最内层循环，它们互不相交，展开一个不会影响其它循环的基本块集合
+    LoopInfo &LI = fam.getResult<LoopAnalysis>(func);
+    SmallVector<Loop *, 8> innermost;
+    for (Loop *LP : LI.getLoopsInPreorder())
+        if (LP->isInnermost())
+            innermost.push_back(LP);
+    for (Loop *LP : innermost)
+    {
+        switch (unrollLoop(LP))
         {
-            unrollLoop(LP);
+        case UnrollKind::Full:
+            ++fullTimes;
+            break;
+        case UnrollKind::Partial:
+            ++partialTimes;
+            break;
+        case UnrollKind::Runtime:
+            ++runtimeTimes;
+            break;
+        case UnrollKind::None:
+            break;
         }
     }
 
-    mOut << "LoopUnrollOptimization running...\n\rUnroll times: " << unrollTimes << "\n\r";
-    return PreservedAnalyses::all();
+    if (!fullTimes && !partialTimes && !runtimeTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("loops fully unrolled", fullTimes);
+    PassStatistics::count("loops partially unrolled", partialTimes);
+    PassStatistics::count("loops runtime unrolled", runtimeTimes);
+    mOut << "LoopUnrollOptimization running on " << func.getName() << "...\n\rFully unrolled " << fullTimes
+         << " loops, partially unrolled " << partialTimes << " loops, runtime unrolled " << runtimeTimes
+         << " loops\n\r";
+    return PreservedAnalyses::none();
 }
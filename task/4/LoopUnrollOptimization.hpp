@@ -7,6 +7,12 @@
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 
+// 循环展开：只处理最内层、以头块为唯一出口的循环（while 形式），循环体可以有多个基本块。
+// 由头块中归纳变量与循环不变量的比较求出迭代次数：
+//   - 常量次数且展开后足够小：完全展开，循环消失；
+//   - 常量次数能被展开因子整除：部分展开，去掉中间副本的出口判断；
+//   - 其余情况：运行时展开，主循环每次执行 N 个迭代，剩余迭代交给尾部的余数循环。
+// 展开因子由循环体指令数决定，展开过的循环打上 llvm.loop.unroll.disable 标记，不会被再次展开。
 class LoopUnrollOptimization : public llvm::PassInfoMixin<LoopUnrollOptimization>
 {
   public:
@@ -14,10 +20,8 @@ class LoopUnrollOptimization : public llvm::PassInfoMixin<LoopUnrollOptimization
     {
     }
 
-    llvm::PreservedAnalyses run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
 
   private:
     llvm::raw_ostream &mOut;
-
-    void unrollLoop(llvm::Loop *LP);
 };
@@ -0,0 +1,499 @@
+#include "LoopVectorization.hpp"
+#include "LoopDependence.hpp"
+#include "LoopInduction.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Transforms/Utils/LoopUtils.h>
+
+using namespace llvm;
+
+namespace {
+
+// 向量循环与余数循环上的标记，避免重复向量化
+constexpr const char *kVectorizedAttr = "llvm.loop.isvectorized";
+// 每次迭代递增归纳变量、比较和跳转的代价
+constexpr unsigned kLoopOverhead = 3;
+// 不变的读取在向量循环中还要广播到每条通道
+constexpr unsigned kBroadcastCost = 1;
+constexpr unsigned kMaxVF = 16;
+
+// 头块中的归约 phi = update(phi, x)，phi 在循环中只被 update 使用，update 只被 phi 使用
+struct Reduction
+{
+    PHINode *phi;
+    BinaryOperator *update;
+};
+
+struct VectorLoop
+{
+    Loop *LP;
+    InductionInfo info;
+    // 头块之后依次执行的块，最后一个是回边块
+    SmallVector<BasicBlock *, 4> blocks;
+    SmallVector<Reduction, 2> reductions;
+    // 只用于计算地址的指令，向量循环中只按第一条通道计算一次
+    SmallPtrSet<Instruction *, 16> addressOnly;
+    // 地址在循环中不变的读取
+    SmallPtrSet<Instruction *, 4> uniformLoads;
+    unsigned vf = 0;
+};
+
+bool isVectorizableType(Type *type)
+{
+    return type->isIntegerTy() || type->isFloatTy() || type->isDoubleTy();
+}
+
+bool isReductionOp(unsigned opcode)
+{
+    return opcode == Instruction::Add || opcode == Instruction::Mul || opcode == Instruction::And ||
+           opcode == Instruction::Or || opcode == Instruction::Xor;
+}
+
+bool analyzeReduction(Loop *LP, PHINode *phi, Reduction &reduction)
+{
+    auto *update = dyn_cast<BinaryOperator>(phi->getIncomingValueForBlock(LP->getLoopLatch()));
+    if (!phi->getType()->isIntegerTy() || !update || !isReductionOp(update->getOpcode()) ||
+        !LP->contains(update) || update->getParent() == LP->getHeader() || !update->hasOneUse())
+        return false;
+    if ((update->getOperand(0) == phi) == (update->getOperand(1) == phi))
+        return false;
+    for (User *user : phi->users())
+        if (user != update && LP->contains(cast<Instruction>(user)))
+            return false;
+    reduction = {phi, update};
+    return true;
+}
+
+// 向量运算能直接对应到标量运算的指令；整数除法没有向量指令，不扩展
+bool isWidenable(Instruction &inst)
+{
+    if (auto *binary = dyn_cast<BinaryOperator>(&inst))
+    {
+        switch (binary->getOpcode())
+        {
+        case Instruction::SDiv:
+        case Instruction::UDiv:
+        case Instruction::SRem:
+        case Instruction::URem:
+            return false;
+        default:
+            break;
+        }
+    }
+    else if (!isa<CmpInst>(inst) && !isa<CastInst>(inst) && !isa<SelectInst>(inst) && !isa<UnaryOperator>(inst))
+        return false;
+    if (!isVectorizableType(inst.getType()))
+        return false;
+    return all_of(inst.operands(), [](Value *op) { return isVectorizableType(op->getType()); });
+}
+
+// 指令处理的标量的最大位宽，i1 只是比较结果，不计入
+unsigned getBits(Instruction &inst, const DataLayout &DL)
+{
+    unsigned bits = 1;
+    auto account = [&](Type *type) {
+        if (isVectorizableType(type) && !type->isIntegerTy(1))
+            bits = std::max<unsigned>(bits, DL.getTypeSizeInBits(type).getFixedSize());
+    };
+    account(inst.getType());
+    for (Value *op : inst.operands())
+        account(op->getType());
+    return bits;
+}
+
+// 头块之后只有一串无条件跳转的块，依次记入 blocks
+bool collectBlocks(Loop *LP, const InductionInfo &info, SmallVectorImpl<BasicBlock *> &blocks)
+{
+    BasicBlock *latch = LP->getLoopLatch();
+    for (BasicBlock *bb = info.body;; bb = bb->getSingleSuccessor())
+    {
+        auto *br = dyn_cast<BranchInst>(bb->getTerminator());
+        if (!LP->contains(bb) || is_contained(blocks, bb) || !br || br->isConditional() || isa<PHINode>(bb->front()))
+            return false;
+        blocks.push_back(bb);
+        if (bb == latch)
+            break;
+    }
+    return blocks.size() + 1 == LP->getNumBlocks();
+}
+
+// 内存访问都连续或不变，依赖距离为 0 或不小于 VF；maxVF 为依赖允许的最大 VF
+bool checkAccesses(VectorLoop &loop, const DataLayout &DL, unsigned &maxVF)
+{
+    PHINode *iv = loop.info.iv;
+    SmallVector<ArrayAccess, 8> accesses;
+    if (!collectAccesses(loop.blocks, loop.LP, iv, DL, accesses))
+        return false;
+    for (auto &access : accesses)
+    {
+        Type *type = access.isWrite ? cast<StoreInst>(access.inst)->getValueOperand()->getType()
+                                    : access.inst->getType();
+        // 向量中的元素必须与数组中的元素一样紧密排列
+        if (!access.affine || !isVectorizableType(type) || !DL.typeSizeEqualsStoreSize(type))
+            return false;
+        int64_t stride = getStride(access, iv);
+        if (stride == 0 && !access.isWrite)
+            loop.uniformLoads.insert(access.inst);
+        else if (stride != int64_t(access.size))
+            return false;
+    }
+
+    maxVF = kMaxVF;
+    for (auto &lhs : accesses)
+        for (auto &rhs : accesses)
+        {
+            if ((!lhs.isWrite && !rhs.isWrite) || &lhs > &rhs)
+                continue;
+            AccessDependence dep = testDependence(lhs, rhs, iv);
+            if (dep.independent)
+                continue;
+            // 同一迭代内的依赖按原来的顺序逐条扩展即可保持
+            auto it = dep.distance.find(iv);
+            if (it == dep.distance.end())
+                return false;
+            uint64_t distance = std::abs(it->second);
+            if (distance == 0)
+                continue;
+            if (distance < 2)
+                return false;
+            maxVF = std::min<unsigned>(maxVF, PowerOf2Floor(distance));
+        }
+    return true;
+}
+
+// 从后往前找出只流向地址的指令，回边上的 iv + 1 也只被归纳变量使用，不需要扩展
+bool collectAddressOnly(VectorLoop &loop)
+{
+    for (BasicBlock *bb : reverse(loop.blocks))
+        for (Instruction &inst : reverse(*bb))
+        {
+            if (inst.isTerminator() || isa<LoadInst>(inst) || isa<StoreInst>(inst))
+                continue;
+            bool address = !inst.use_empty() && all_of(inst.uses(), [&](Use &use) {
+                auto *user = cast<Instruction>(use.getUser());
+                if (user == loop.info.iv || isa<LoadInst>(user))
+                    return true;
+                if (auto *store = dyn_cast<StoreInst>(user))
+                    return use.getOperandNo() == store->getPointerOperandIndex();
+                return loop.addressOnly.count(user) > 0;
+            });
+            if (!address)
+                continue;
+            if (!isa<GetElementPtrInst>(inst) && !isa<CastInst>(inst) && !isa<BinaryOperator>(inst))
+                return false;
+            loop.addressOnly.insert(&inst);
+        }
+    return true;
+}
+
+// 按每个 VF 估计一次向量迭代的代价：扩展的指令按需要的向量寄存器个数计，地址与循环控制只算一次。
+// 取每次标量迭代平均代价最小的 VF，不比标量循环便宜时返回 0
+unsigned selectVF(VectorLoop &loop, const DataLayout &DL, unsigned vectorWidth, unsigned maxVF)
+{
+    SmallVector<unsigned, 16> widened;
+    unsigned scalarCost = kLoopOverhead;
+    unsigned fixedCost = kLoopOverhead;
+    unsigned minBits = vectorWidth;
+    for (BasicBlock *bb : loop.blocks)
+        for (Instruction &inst : *bb)
+        {
+            if (inst.isTerminator())
+                continue;
+            ++scalarCost;
+            if (loop.addressOnly.count(&inst))
+                ++fixedCost;
+            else if (loop.uniformLoads.count(&inst))
+                fixedCost += 1 + kBroadcastCost;
+            else
+            {
+                widened.push_back(getBits(inst, DL));
+                minBits = std::min(minBits, widened.back());
+            }
+        }
+
+    unsigned bestVF = 1;
+    unsigned bestCost = scalarCost;
+    for (unsigned vf = 2; vf <= maxVF && vf * minBits <= vectorWidth; vf *= 2)
+    {
+        unsigned cost = fixedCost;
+        for (unsigned bits : widened)
+            cost += (vf * bits + vectorWidth - 1) / vectorWidth;
+        if (cost * bestVF < bestCost * vf)
+        {
+            bestVF = vf;
+            bestCost = cost;
+        }
+    }
+    return bestVF > 1 ? bestVF : 0;
+}
+
+bool analyzeLoop(Loop *LP, const DataLayout &DL, unsigned vectorWidth, VectorLoop &loop)
+{
+    if (!LP->isInnermost() || !isSimpleLoop(LP) || getBooleanLoopAttribute(LP, kVectorizedAttr))
+        return false;
+    loop.LP = LP;
+    InductionInfo &info = loop.info;
+    if (!analyzeInduction(LP, info) || info.step != 1 || info.pred != CmpInst::ICMP_SLT || !info.noWrap)
+        return false;
+
+    // 头块中只有 phi、比较和跳转，phi 除了归纳变量都是归约
+    BasicBlock *header = LP->getHeader();
+    Instruction *cond = header->getFirstNonPHI();
+    if (cond != cast<BranchInst>(header->getTerminator())->getCondition() || !cond->hasOneUse() ||
+        cond->getNextNode() != header->getTerminator())
+        return false;
+    for (PHINode &phi : header->phis())
+    {
+        Reduction reduction;
+        if (&phi == info.iv)
+            continue;
+        if (!analyzeReduction(LP, &phi, reduction))
+            return false;
+        loop.reductions.push_back(reduction);
+    }
+
+    unsigned maxVF = 0;
+    if (!collectBlocks(LP, info, loop.blocks) || !checkAccesses(loop, DL, maxVF) || !collectAddressOnly(loop))
+        return false;
+    for (BasicBlock *bb : loop.blocks)
+        for (Instruction &inst : *bb)
+            if (!inst.isTerminator() && !loop.addressOnly.count(&inst) && !isa<LoadInst>(inst) &&
+                !isa<StoreInst>(inst) && !isWidenable(inst))
+                return false;
+
+    loop.vf = selectVF(loop, DL, vectorWidth, maxVF);
+    if (!loop.vf)
+        return false;
+    // 次数太少的循环留给循环展开
+    int64_t tripCount = 0;
+    return !getConstantTripCount(info, tripCount) || tripCount >= 2 * loop.vf;
+}
+
+// 生成向量循环体：循环中的值 v 在第 k 条通道上是 v 在第 vecIV + k 次迭代中的值
+class Widener
+{
+  public:
+    Widener(VectorLoop &loop, PHINode *vecIV, Instruction *preheaderTerm, BasicBlock *body)
+        : mLoop(loop), mVecIV(vecIV), mPreheader(preheaderTerm), mBody(body)
+    {
+    }
+
+    void setVector(Value *value, Value *vector)
+    {
+        mVectors[value] = vector;
+    }
+
+    // 第一条通道上的标量值
+    Value *getScalar(Value *value)
+    {
+        if (value == mLoop.info.iv)
+            return mVecIV;
+        auto *inst = dyn_cast<Instruction>(value);
+        if (!inst || !mLoop.LP->contains(inst))
+            return value;
+        if (Value *scalar = mScalars.lookup(inst))
+            return scalar;
+        Instruction *clone = inst->clone();
+        for (unsigned i = 0; i < clone->getNumOperands(); ++i)
+            clone->setOperand(i, getScalar(clone->getOperand(i)));
+        mBody.Insert(clone, inst->getName());
+        mScalars[inst] = clone;
+        return clone;
+    }
+
+    Value *getVector(Value *value)
+    {
+        if (Value *vector = mVectors.lookup(value))
+            return vector;
+        Value *vector;
+        unsigned vf = mLoop.vf;
+        if (value == mLoop.info.iv)
+        {
+            SmallVector<Constant *, 16> lanes;
+            for (unsigned k = 0; k < vf; ++k)
+                lanes.push_back(ConstantInt::get(value->getType(), k));
+            vector = mBody.CreateNSWAdd(mBody.CreateVectorSplat(vf, mVecIV), ConstantVector::get(lanes),
+                                        value->getName() + ".vec");
+        }
+        else if (auto *constant = dyn_cast<Constant>(value))
+            vector = ConstantVector::getSplat(ElementCount::getFixed(vf), constant);
+        else
+            vector = mPreheader.CreateVectorSplat(vf, value, value->getName() + ".splat");
+        mVectors[value] = vector;
+        return vector;
+    }
+
+    void widen(Instruction &inst)
+    {
+        unsigned vf = mLoop.vf;
+        Value *vector;
+        if (auto *load = dyn_cast<LoadInst>(&inst))
+        {
+            Value *ptr = getScalar(load->getPointerOperand());
+            if (mLoop.uniformLoads.count(load))
+            {
+                Value *scalar = mBody.CreateAlignedLoad(load->getType(), ptr, load->getAlign(), load->getName());
+                vector = mBody.CreateVectorSplat(vf, scalar, load->getName() + ".splat");
+            }
+            else
+            {
+                auto *type = FixedVectorType::get(load->getType(), vf);
+                vector = mBody.CreateAlignedLoad(type, castPointer(ptr, type), load->getAlign(), load->getName());
+            }
+        }
+        else if (auto *store = dyn_cast<StoreInst>(&inst))
+        {
+            Value *value = getVector(store->getValueOperand());
+            mBody.CreateAlignedStore(value, castPointer(getScalar(store->getPointerOperand()), value->getType()),
+                                     store->getAlign());
+            return;
+        }
+        else
+        {
+            Instruction *clone = inst.clone();
+            for (unsigned i = 0; i < clone->getNumOperands(); ++i)
+                clone->setOperand(i, getVector(clone->getOperand(i)));
+            clone->mutateType(FixedVectorType::get(inst.getType(), vf));
+            mBody.Insert(clone, inst.getName());
+            vector = clone;
+        }
+        mVectors[&inst] = vector;
+    }
+
+  private:
+    Value *castPointer(Value *ptr, Type *type)
+    {
+        return mBody.CreateBitCast(ptr, type->getPointerTo(ptr->getType()->getPointerAddressSpace()));
+    }
+
+    VectorLoop &mLoop;
+    PHINode *mVecIV;
+    IRBuilder<> mPreheader;
+    IRBuilder<> mBody;
+    DenseMap<Value *, Value *> mScalars;
+    DenseMap<Value *, Value *> mVectors;
+};
+
+Value *createReduce(IRBuilder<> &builder, unsigned opcode, Value *vector)
+{
+    switch (opcode)
+    {
+    case Instruction::Add:
+        return builder.CreateAddReduce(vector);
+    case Instruction::Mul:
+        return builder.CreateMulReduce(vector);
+    case Instruction::And:
+        return builder.CreateAndReduce(vector);
+    case Instruction::Or:
+        return builder.CreateOrReduce(vector);
+    default:
+        return builder.CreateXorReduce(vector);
+    }
+}
+
+// preheader → vec.header ⇄ vec.body，vec.header → vec.exit → header（余数循环）→ exit
+void vectorize(VectorLoop &loop)
+{
+    Loop *LP = loop.LP;
+    const InductionInfo &info = loop.info;
+    unsigned vf = loop.vf;
+    BasicBlock *header = LP->getHeader();
+    BasicBlock *preheader = LP->getLoopPreheader();
+    BasicBlock *latch = LP->getLoopLatch();
+    Function *func = header->getParent();
+    LLVMContext &ctx = func->getContext();
+    Type *ivType = info.iv->getType();
+    int64_t tripCount = 0;
+    bool constant = getConstantTripCount(info, tripCount);
+
+    // 向量循环执行 trip count 向下取整到 vf 倍数次迭代，退出时归纳变量为 vec.end，不超过边界
+    IRBuilder<> builder(preheader->getTerminator());
+    Value *vecCount = builder.CreateAnd(buildTripCount(builder, info), builder.getInt64(-int64_t(vf)));
+    Value *vecEnd = builder.CreateTrunc(builder.CreateAdd(builder.CreateSExt(info.start, builder.getInt64Ty()), vecCount),
+                                        ivType, "vec.end");
+
+    BasicBlock *vecHeader = BasicBlock::Create(ctx, "vec.header", func, header);
+    BasicBlock *vecBody = BasicBlock::Create(ctx, "vec.body", func, header);
+    BasicBlock *vecExit = BasicBlock::Create(ctx, "vec.exit", func, header);
+    preheader->getTerminator()->replaceUsesOfWith(header, vecHeader);
+
+    IRBuilder<> headerBuilder(vecHeader);
+    PHINode *vecIV = headerBuilder.CreatePHI(ivType, 2, info.iv->getName() + ".vec.iv");
+    vecIV->addIncoming(info.start, preheader);
+    Widener widener(loop, vecIV, preheader->getTerminator(), vecBody);
+    // 归约的第一条通道从初值开始，其余通道从单位元开始
+    SmallVector<PHINode *, 2> vecPhis;
+    for (auto &reduction : loop.reductions)
+    {
+        Type *type = reduction.phi->getType();
+        Constant *identity = ConstantExpr::getBinOpIdentity(reduction.update->getOpcode(), type);
+        Value *init = builder.CreateInsertElement(ConstantVector::getSplat(ElementCount::getFixed(vf), identity),
+                                                  reduction.phi->getIncomingValueForBlock(preheader), uint64_t(0));
+        PHINode *vecPhi = headerBuilder.CreatePHI(init->getType(), 2, reduction.phi->getName() + ".vec");
+        vecPhi->addIncoming(init, preheader);
+        widener.setVector(reduction.phi, vecPhi);
+        vecPhis.push_back(vecPhi);
+    }
+    headerBuilder.CreateCondBr(headerBuilder.CreateICmpSLT(vecIV, vecEnd), vecBody, vecExit);
+
+    for (BasicBlock *bb : loop.blocks)
+        for (Instruction &inst : *bb)
+            if (!inst.isTerminator() && !loop.addressOnly.count(&inst))
+                widener.widen(inst);
+    IRBuilder<> bodyBuilder(vecBody);
+    vecIV->addIncoming(bodyBuilder.CreateNSWAdd(vecIV, ConstantInt::get(ivType, vf), vecIV->getName() + ".next"),
+                       vecBody);
+    bodyBuilder.CreateBr(vecHeader);
+    addLoopAttribute(vecBody, kVectorizedAttr);
+
+    // 各通道的归约重新结合，溢出的位置可能与原来不同
+    IRBuilder<> exitBuilder(vecExit);
+    for (unsigned i = 0; i < loop.reductions.size(); ++i)
+    {
+        auto &reduction = loop.reductions[i];
+        auto *update = cast<Instruction>(widener.getVector(reduction.update));
+        update->dropPoisonGeneratingFlags();
+        vecPhis[i]->addIncoming(update, vecBody);
+        Value *result = createReduce(exitBuilder, reduction.update->getOpcode(), vecPhis[i]);
+        reduction.phi->setIncomingValueForBlock(preheader, result);
+    }
+    exitBuilder.CreateBr(header);
+
+    // 原循环从 vec.end 开始执行余数迭代
+    info.iv->setIncomingValueForBlock(preheader, vecEnd);
+    header->replacePhiUsesWith(preheader, vecExit);
+    addLoopAttribute(latch, kVectorizedAttr);
+    // 余数循环不到 vf 次迭代，次数不是常量时不值得展开
+    if (!constant)
+        addLoopAttribute(latch, "llvm.loop.unroll.disable");
+}
+
+} // namespace
+
+PreservedAnalyses LoopVectorization::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int vectorizeTimes = 0;
+    const DataLayout &DL = func.getParent()->getDataLayout();
+
+    // 最内层循环互不相交，全部分析完之后再改写
+    auto &LI = fam.getResult<LoopAnalysis>(func);
+    SmallVector<VectorLoop, 4> loops;
+    for (Loop *LP : LI.getLoopsInPreorder())
+    {
+        VectorLoop loop;
+        if (analyzeLoop(LP, DL, mVectorWidth, loop))
+            loops.push_back(std::move(loop));
+    }
+    for (auto &loop : loops)
+    {
+        vectorize(loop);
+        ++vectorizeTimes;
+    }
+
+    if (!vectorizeTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("loops vectorized", vectorizeTimes);
+    mOut << "LoopVectorization running on " << func.getName() << "...\n\rTo vectorize " << vectorizeTimes
+         << " loops\n\r";
+    return PreservedAnalyses::none();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 最内层计数循环的向量化，只处理头块中只有 phi、比较和跳转，循环体是一串无条件跳转的块、
+// 步长为 1 的 i < n 循环：
+//   - 内存访问沿归纳变量连续（或在循环中不变的读取），依赖距离为 0 或不小于向量宽度（LoopDependence）；
+//   - 循环体中的运算扩展为 <VF x T> 的向量运算，地址只按第一条通道计算；头块中的整数 add/mul/and/or/xor
+//     归约逐通道累加，退出向量循环后再归约成一个值；
+//   - 向量循环执行 trip count 向下取整到 VF 倍数的迭代，原循环作为余数循环执行剩下的迭代。
+// VF 由代价模型在目标向量寄存器宽度 vectorWidth（位）之内选出，向量化后不比标量便宜时不变换。
+class LoopVectorization : public llvm::PassInfoMixin<LoopVectorization>
+{
+  public:
+    LoopVectorization(llvm::raw_ostream &out, unsigned vectorWidth) : mOut(out), mVectorWidth(vectorWidth)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+    unsigned mVectorWidth;
+};
@@ -1,4 +1,5 @@
 #include "Mem2Reg.hpp"
+#include "PassStatistics.hpp"
 
 using namespace llvm;
 
@@ -886,11 +887,13 @@ PromoteMemToReg(ArrayRef<AllocaInst*> Allocas, DominatorTree& DT)
 }
 
 static bool
-promoteMemoryToRegister(Function& F, DominatorTree& DT)
+promoteMemoryToRegister(Function& F, FunctionAnalysisManager& FAM)
 {
   std::vector<AllocaInst*> Allocas;
   BasicBlock& BB = F.getEntryBlock(); // Get the entry node for the function
   bool Changed = false;
+  // 支配树只在确实有可提升的 alloca 时才向分析管理器请求
+  DominatorTree* DT = nullptr;
 
   while (true) {
     Allocas.clear();
@@ -905,31 +908,22 @@ promoteMemoryToRegister(Function& F, DominatorTree& DT)
     if (Allocas.empty())
       break;
 
-    PromoteMemToReg(Allocas, DT);
+    if (!DT)
+      DT = &FAM.getResult<DominatorTreeAnalysis>(F);
+    PassStatistics::count("allocas promoted", Allocas.size());
+    PromoteMemToReg(Allocas, *DT);
     Changed = true;
   }
   return Changed;
 }
 
 PreservedAnalyses
-Mem2Reg::run(llvm::Module& mod, llvm::ModuleAnalysisManager& mam)
+Mem2Reg::run(llvm::Function& func, llvm::FunctionAnalysisManager& fam)
 {
-
-  FunctionAnalysisManager fam;
-  PassBuilder pb;
-  pb.registerFunctionAnalyses(fam);
-  bool flag = true;
-  for (Function& func : mod) {
-    if (func.isDeclaration())
-      continue;
-    auto& DT = fam.getResult<DominatorTreeAnalysis>(func);
-    if (promoteMemoryToRegister(func, DT)) {
-      flag = false;
-    }
-  }
-  if (flag) {
+  // 支配树来自共享的FunctionAnalysisManager，只在控制流图改变后重新计算；
+  // 没有可提升的 alloca 时（流水线后续迭代的常见情况）不会请求它
+  if (!promoteMemoryToRegister(func, fam))
     return PreservedAnalyses::all();
-  }
   PreservedAnalyses PA;
   PA.preserveSet<CFGAnalyses>();
   return PA;
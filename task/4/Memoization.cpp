@@ -0,0 +1,130 @@
+#include "Memoization.hpp"
+#include "ChangeSet.hpp"
+#include "FunctionPurity.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/IR/IRBuilder.h>
+
+using namespace llvm;
+
+namespace {
+
+// 每个函数的记忆表最多的项数
+constexpr uint64_t kMaxEntries = 1 << 16;
+// 参数个数上限，更多参数时每一维太小
+constexpr unsigned kMaxParams = 3;
+
+bool isMemoizable(Function &func, const FunctionPurity::Result &purity)
+{
+    if (func.isDeclaration() || func.getName() == "main" || !purity.isPure(&func) || !purity.isRecursive(&func))
+        return false;
+    Type *retType = func.getReturnType();
+    if (!retType->isIntegerTy() || retType->getIntegerBitWidth() > 32)
+        return false;
+    if (func.arg_empty() || func.arg_size() > kMaxParams)
+        return false;
+    return all_of(func.args(), [](Argument &arg) {
+        return arg.getType()->isIntegerTy() && arg.getType()->getIntegerBitWidth() <= 32;
+    });
+}
+
+// 每一维的上限：bound^params 不超过 kMaxEntries
+uint64_t getDimension(unsigned params)
+{
+    uint64_t bound = 1;
+    while (true)
+    {
+        uint64_t entries = 1;
+        for (unsigned i = 0; i < params; ++i)
+            entries *= bound + 1;
+        if (entries > kMaxEntries)
+            return bound;
+        ++bound;
+    }
+}
+
+void memoize(Function &func)
+{
+    Module &mod = *func.getParent();
+    LLVMContext &ctx = func.getContext();
+    uint64_t dim = getDimension(func.arg_size());
+    uint64_t entries = 1;
+    for (unsigned i = 0; i < func.arg_size(); ++i)
+        entries *= dim;
+
+    // 最后一项给超出范围的调用写入，从不读取
+    Type *retType = func.getReturnType();
+    auto *tableType = ArrayType::get(retType, entries + 1);
+    auto *validType = ArrayType::get(Type::getInt8Ty(ctx), entries + 1);
+    auto *table = new GlobalVariable(mod, tableType, false, GlobalValue::InternalLinkage,
+                                     Constant::getNullValue(tableType), func.getName() + ".memo");
+    auto *valid = new GlobalVariable(mod, validType, false, GlobalValue::InternalLinkage,
+                                     Constant::getNullValue(validType), func.getName() + ".memo.valid");
+
+    // 新的入口块：静态 alloca 移到这里，计算下标并查表
+    BasicBlock *body = &func.getEntryBlock();
+    BasicBlock *entry = BasicBlock::Create(ctx, "memo.entry", &func, body);
+    BasicBlock *hit = BasicBlock::Create(ctx, "memo.hit", &func, body);
+    IRBuilder<> builder(entry);
+    for (auto &inst : make_early_inc_range(*body))
+        if (auto *alloca = dyn_cast<AllocaInst>(&inst))
+            if (isa<ConstantInt>(alloca->getArraySize()))
+                alloca->moveBefore(*entry, entry->end());
+
+    Type *i64 = builder.getInt64Ty();
+    Value *inRange = builder.getTrue();
+    Value *index = builder.getInt64(0);
+    for (Argument &arg : func.args())
+    {
+        // 零扩展后的无符号比较同时排除负数
+        Value *value = builder.CreateZExt(&arg, i64);
+        inRange = builder.CreateAnd(inRange, builder.CreateICmpULT(value, builder.getInt64(dim)));
+        index = builder.CreateAdd(builder.CreateMul(index, builder.getInt64(dim)), value);
+    }
+    index = builder.CreateSelect(inRange, index, builder.getInt64(entries), "memo.index");
+    Value *validPtr = builder.CreateInBoundsGEP(validType, valid, {builder.getInt64(0), index});
+    Value *tablePtr = builder.CreateInBoundsGEP(tableType, table, {builder.getInt64(0), index});
+    Value *known = builder.CreateICmpNE(builder.CreateLoad(builder.getInt8Ty(), validPtr), builder.getInt8(0));
+    builder.CreateCondBr(builder.CreateAnd(inRange, known), hit, body);
+
+    builder.SetInsertPoint(hit);
+    builder.CreateRet(builder.CreateLoad(retType, tablePtr, "memo.value"));
+
+    // 每个返回点记下结果
+    for (auto &bb : func)
+        if (auto *ret = dyn_cast<ReturnInst>(bb.getTerminator()))
+        {
+            if (&bb == hit)
+                continue;
+            builder.SetInsertPoint(ret);
+            builder.CreateStore(ret->getReturnValue(), tablePtr);
+            builder.CreateStore(builder.getInt8(1), validPtr);
+        }
+}
+
+} // namespace
+
+PreservedAnalyses Memoization::run(Module &mod, ModuleAnalysisManager &mam)
+{
+    int memoizeTimes = 0;
+    ChangeSet changes(mod, mam);
+    auto &purity = mam.getResult<FunctionPurity>(mod);
+
+    // 先收集再改写，改写后的函数写全局变量，不再是纯函数
+    std::vector<Function *> funcs;
+    for (auto &func : mod)
+        if (isMemoizable(func, purity))
+            funcs.push_back(&func);
+    for (Function *func : funcs)
+    {
+        memoize(*func);
+        changes.changeCFG(*func);
+        ++memoizeTimes;
+    }
+
+    if (!memoizeTimes)
+        return PreservedAnalyses::all();
+    changes.changeModule();
+    PassStatistics::count("functions memoized", memoizeTimes);
+    mOut << "Memoization running...\n\rTo memoize " << memoizeTimes << " functions\n\r";
+    return changes.result();
+}
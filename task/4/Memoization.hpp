@@ -0,0 +1,21 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 递归纯函数的记忆化：FunctionPurity 证明为纯、处在调用环上、参数与返回值都是不超过 32 位整数的函数，
+// 入口处先查一张按实参下标的全局表，命中时直接返回；每个返回点把结果写入表中。
+// 实参都在表的范围内（非负且小于每一维的上限）时才查表，超出范围的调用照常计算。
+// 不在任何预设中，需要用 -passes=O2,memo 显式开启。
+class Memoization : public llvm::PassInfoMixin<Memoization>
+{
+  public:
+    explicit Memoization(llvm::raw_ostream &out) : mOut(out)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+
+  private:
+    llvm::raw_ostream &mOut;
+};
@@ -1,119 +1,369 @@
 #include "PartialEvaluation.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/Transforms/Utils/Local.h>
 
 using namespace llvm;
 
-PreservedAnalyses PartialEvaluation::run(Module &mod, ModuleAnalysisManager &mam)
+namespace {
+
+// 共享（多次使用）的子表达式项数不超过这个值时复制展开，否则作为叶子
+constexpr unsigned kMaxSharedTerms = 8;
+
+// 常量 + Σ系数 × 叶子，系数按模 2^n 计算
+struct LinearForm
+{
+    DenseMap<Value *, APInt> terms;
+    APInt constant;
+    // 重写后可以删除的指令数，即树中被吸收的指令加上根
+    unsigned cost = 0;
+    // 树中每一步都带 nsw，且计算系数时没有有符号溢出
+    bool noSignedWrap = true;
+};
+
+// 按系数的绝对值分组，同组的叶子先相加再乘一次
+struct TermGroup
+{
+    APInt scale;
+    SmallVector<Value *, 4> positive;
+    SmallVector<Value *, 4> negative;
+};
+
+class Reassociator
 {
-    int peTimes = 0;
+  public:
+    explicit Reassociator(Function &func) : mFunc(func)
+    {
+    }
 
-    for (auto &func : mod)
+    int run()
     {
-        // 从变量到变量组成的映射
-        std::unordered_map<Value *, std::vector<std::pair<Value *, int>>> valueMap;
+        for (auto &arg : mFunc.args())
+            getRank(&arg);
+        ReversePostOrderTraversal<Function *> rpot(&mFunc);
+        for (BasicBlock *bb : rpot)
+            for (auto &inst : *bb)
+            {
+                getRank(&inst);
+                if (linearize(inst))
+                    mOrder.push_back(&inst);
+            }
 
-        // 将函数的参数加入到valueMap中
-        for (auto &arg : func.args())
+        // 按定义顺序重写，先被重写的根在之后的树中作为叶子出现时用替换后的值
+        int times = 0;
+        SmallVector<WeakTrackingVH, 16> dead;
+        for (Instruction *root : mOrder)
         {
-            std::vector<std::pair<Value *, int>> vec;
-            vec.push_back(std::make_pair(&arg, 1));
-            valueMap[&arg] = vec;
+            auto it = mForms.find(root);
+            if (it == mForms.end())
+                continue;
+            Value *value = rewrite(root, it->second);
+            if (!value)
+                continue;
+            root->replaceAllUsesWith(value);
+            mReplaced[root] = value;
+            dead.push_back(root);
+            ++times;
         }
+        RecursivelyDeleteTriviallyDeadInstructions(dead);
+        return times;
+    }
+
+  private:
+    unsigned getRank(Value *value)
+    {
+        auto [it, inserted] = mRank.try_emplace(value, mRank.size() + 1);
+        return it->second;
+    }
+
+    LinearForm leafForm(Value *value)
+    {
+        LinearForm form;
+        unsigned bits = value->getType()->getIntegerBitWidth();
+        form.constant = APInt(bits, 0);
+        if (auto *ci = dyn_cast<ConstantInt>(value))
+            form.constant = ci->getValue();
+        else
+            form.terms.try_emplace(value, APInt(bits, 1));
+        return form;
+    }
+
+    const LinearForm *peek(Value *value) const
+    {
+        auto *inst = dyn_cast<Instruction>(value);
+        auto it = inst ? mForms.find(inst) : mForms.end();
+        return it == mForms.end() ? nullptr : &it->second;
+    }
 
-        for (auto &bb : func)
+    bool isConstant(Value *value, Instruction *user) const
+    {
+        return isa<ConstantInt>(value) || (expands(value, user) && peek(value)->terms.empty());
+    }
+
+    // 本块中只使用一次的子树并入当前树，项数不多的共享子树复制一份，其余作为叶子
+    bool expands(Value *value, Instruction *user) const
+    {
+        const LinearForm *form = peek(value);
+        return form && ((value->hasOneUse() && cast<Instruction>(value)->getParent() == user->getParent()) ||
+                        form->terms.size() <= kMaxSharedTerms);
+    }
+
+    LinearForm take(Value *value, Instruction *user)
+    {
+        if (!expands(value, user))
+            return leafForm(value);
+        auto it = mForms.find(cast<Instruction>(value));
+        if (value->hasOneUse() && it->first->getParent() == user->getParent())
         {
-            for (auto &inst : bb)
+            LinearForm form = std::move(it->second);
+            mForms.erase(it);
+            return form;
+        }
+        LinearForm form = it->second;
+        form.cost = 0;
+        return form;
+    }
+
+    // dst += src × scale
+    static void merge(LinearForm &dst, const LinearForm &src, const APInt &scale)
+    {
+        bool overflow = false;
+        auto madd = [&](const APInt &lhs, const APInt &rhs) {
+            bool mulOverflow = false, addOverflow = false;
+            APInt product = rhs.smul_ov(scale, mulOverflow);
+            APInt sum = lhs.sadd_ov(product, addOverflow);
+            overflow = overflow || mulOverflow || addOverflow;
+            return sum;
+        };
+        for (auto &[value, coeff] : src.terms)
+        {
+            auto [it, inserted] = dst.terms.try_emplace(value, APInt(coeff.getBitWidth(), 0));
+            it->second = madd(it->second, coeff);
+            if (it->second.isZero())
+                dst.terms.erase(it);
+        }
+        dst.constant = madd(dst.constant, src.constant);
+        dst.cost += src.cost;
+        dst.noSignedWrap = dst.noSignedWrap && src.noSignedWrap && !overflow;
+    }
+
+    static void scaleInPlace(LinearForm &form, const APInt &scale)
+    {
+        LinearForm scaled;
+        scaled.constant = APInt(scale.getBitWidth(), 0);
+        merge(scaled, form, scale);
+        form = std::move(scaled);
+    }
+
+    // 计算 inst 的线性形式，inst 不能线性化时返回 false
+    bool linearize(Instruction &inst)
+    {
+        auto *bo = dyn_cast<BinaryOperator>(&inst);
+        if (!bo || !inst.getType()->isIntegerTy())
+            return false;
+        Value *lhs = bo->getOperand(0);
+        Value *rhs = bo->getOperand(1);
+        unsigned bits = inst.getType()->getIntegerBitWidth();
+        APInt one(bits, 1);
+        LinearForm form;
+
+        switch (bo->getOpcode())
+        {
+        case Instruction::Add:
+        case Instruction::Sub: {
+            LinearForm a = take(lhs, &inst);
+            LinearForm b = take(rhs, &inst);
+            APInt sign = bo->getOpcode() == Instruction::Add ? one : -one;
+            // 把项少的一边并入项多的一边
+            if (a.terms.size() >= b.terms.size())
             {
-                if (inst.isBinaryOp())
-                {
-                    Value *op1 = inst.getOperand(0);
-                    Value *op2 = inst.getOperand(1);
-                    if (inst.getOpcode() == Instruction::Add)
-                    {
-                        // 将op1和op2在valueMap中的组成部分相加
-                        std::vector<std::pair<Value *, int>> vec;
-                        vec.insert(vec.end(), valueMap[op1].begin(), valueMap[op1].end());
-                        for (auto &pair : valueMap[op2])
-                        {
-                            bool found = false;
-                            for (auto &vecPair : vec)
-                            {
-                                if (vecPair.first == pair.first)
-                                {
-                                    vecPair.second += pair.second;
-                                    found = true;
-                                    break;
-                                }
-                            }
-                            if (!found)
-                            {
-                                vec.push_back(pair);
-                            }
-                        }
-                        valueMap[&inst] = vec;
-                    }
-                    else if (inst.getOpcode() == Instruction::SDiv)
-                    {
-                        if (ConstantInt *ci = dyn_cast<ConstantInt>(op2))
-                        {
-                            bool canDivide = true;
-                            for (auto &pair : valueMap[op1])
-                            {
-                                if (pair.second % ci->getSExtValue() != 0)
-                                {
-                                    canDivide = false;
-                                    break;
-                                }
-                            }
-                            if (canDivide && valueMap[op1].size() > 10)
-                            {
-                                std::vector<std::pair<Value *, int>> vec;
-                                for (auto &pair : valueMap[op1])
-                                {
-                                    vec.push_back(std::make_pair(pair.first, pair.second / ci->getSExtValue()));
-                                }
-                                valueMap[&inst] = vec;
-                                // 创建一堆乘法和加法指令
-                                Value *ans = ConstantInt::get(ci->getType(), 0);
-                                for (auto &pair : vec)
-                                {
-                                    Instruction *mulInst = BinaryOperator::Create(
-                                        Instruction::Mul, pair.first, ConstantInt::get(ci->getType(), pair.second),
-                                        "mul", &inst);
-                                    Instruction *addInst =
-                                        BinaryOperator::Create(Instruction::Add, ans, mulInst, "add", &inst);
-                                    ans = addInst;
-                                }
-                                inst.replaceAllUsesWith(ans);
-                            }
-                        }
-                    }
-                }
+                merge(a, b, sign);
+                form = std::move(a);
             }
+            else
+            {
+                scaleInPlace(b, sign);
+                merge(b, a, one);
+                form = std::move(b);
+            }
+            break;
+        }
+        case Instruction::Mul: {
+            if (!isConstant(lhs, &inst) && !isConstant(rhs, &inst))
+                return false;
+            LinearForm a = take(lhs, &inst);
+            LinearForm b = take(rhs, &inst);
+            if (!a.terms.empty())
+                std::swap(a, b);
+            unsigned cost = a.cost;
+            scaleInPlace(b, a.constant);
+            b.cost += cost;
+            b.noSignedWrap = b.noSignedWrap && a.noSignedWrap;
+            form = std::move(b);
+            break;
+        }
+        case Instruction::Shl: {
+            auto *amount = dyn_cast<ConstantInt>(rhs);
+            if (!amount || amount->getValue().uge(bits))
+                return false;
+            form = take(lhs, &inst);
+            scaleInPlace(form, one.shl(amount->getValue()));
+            break;
+        }
+        case Instruction::SDiv: {
+            // 只在能整除、且原表达式没有溢出时成立
+            auto *divisor = dyn_cast<ConstantInt>(rhs);
+            if (!divisor || divisor->isZero() || divisor->isMinusOne() || !expands(lhs, &inst))
+                return false;
+            const LinearForm *dividend = peek(lhs);
+            if (!dividend->noSignedWrap)
+                return false;
+            const APInt &d = divisor->getValue();
+            if (!dividend->constant.srem(d).isZero())
+                return false;
+            for (auto &[value, coeff] : dividend->terms)
+                if (!coeff.srem(d).isZero())
+                    return false;
+            form = take(lhs, &inst);
+            for (auto &[value, coeff] : form.terms)
+                coeff = coeff.sdiv(d);
+            form.constant = form.constant.sdiv(d);
+            // 商一定比被除数小，不会再溢出
+            mForms[&inst] = std::move(form);
+            mForms[&inst].cost += 1;
+            return true;
+        }
+        default:
+            return false;
+        }
+
+        form.cost += 1;
+        form.noSignedWrap = form.noSignedWrap && bo->hasNoSignedWrap();
+        mForms[&inst] = std::move(form);
+        return true;
+    }
+
+    Value *resolve(Value *value) const
+    {
+        auto it = mReplaced.find(value);
+        return it == mReplaced.end() ? value : it->second;
+    }
+
+    // 叶子按秩排序后分组，组按其中最小的秩排列
+    std::vector<TermGroup> group(const LinearForm &form)
+    {
+        std::vector<std::pair<unsigned, Value *>> leaves;
+        for (auto &[value, coeff] : form.terms)
+            leaves.emplace_back(getRank(value), value);
+        llvm::sort(leaves);
+
+        std::vector<TermGroup> groups;
+        DenseMap<APInt, unsigned> index;
+        for (auto &[rank, value] : leaves)
+        {
+            const APInt &coeff = form.terms.find(value)->second;
+            bool negative = coeff.isNegative();
+            APInt scale = negative ? -coeff : coeff;
+            auto [it, inserted] = index.try_emplace(scale, groups.size());
+            if (inserted)
+                groups.push_back({scale, {}, {}});
+            auto &g = groups[it->second];
+            (negative ? g.negative : g.positive).push_back(resolve(value));
+        }
+        return groups;
+    }
+
+    static unsigned emittedCost(const std::vector<TermGroup> &groups, const APInt &constant)
+    {
+        if (groups.empty())
+            return 0;
+        unsigned cost = groups.size() - 1;
+        bool anyPositive = false;
+        for (auto &g : groups)
+        {
+            cost += g.positive.size() + g.negative.size() - 1 + !g.scale.isOne();
+            anyPositive = anyPositive || !g.positive.empty();
         }
+        return cost + (!anyPositive || !constant.isZero());
     }
 
-    // 在一个基本块中，对一个全局变量的反复读写折叠
-    for (auto &func : mod)
+    // 相邻的两两相加，得到深度为 log n 的树
+    static Value *sumBalanced(IRBuilder<> &builder, SmallVector<Value *, 4> values)
     {
-        for (auto &bb : func)
+        while (values.size() > 1)
         {
-            std::unordered_map<Value *, Value *> valueMap;
-            for (auto &inst : bb)
+            SmallVector<Value *, 4> next;
+            for (size_t i = 0; i + 1 < values.size(); i += 2)
+                next.push_back(builder.CreateAdd(values[i], values[i + 1], "reass"));
+            if (values.size() % 2)
+                next.push_back(values.back());
+            values = std::move(next);
+        }
+        return values.front();
+    }
+
+    // 重写后指令更少时返回新值
+    Value *rewrite(Instruction *root, const LinearForm &form)
+    {
+        std::vector<TermGroup> groups = group(form);
+        if (emittedCost(groups, form.constant) >= form.cost)
+            return nullptr;
+
+        Type *type = root->getType();
+        if (groups.empty())
+            return ConstantInt::get(type, form.constant);
+
+        IRBuilder<> builder(root);
+        SmallVector<Value *, 4> positive, negative;
+        for (auto &g : groups)
+        {
+            Value *value;
+            if (!g.positive.empty())
+            {
+                value = sumBalanced(builder, g.positive);
+                if (!g.negative.empty())
+                    value = builder.CreateSub(value, sumBalanced(builder, g.negative), "reass");
+            }
+            else
             {
-                if (StoreInst *store = dyn_cast<StoreInst>(&inst))
-                {
-                    valueMap[store->getPointerOperand()] = store->getValueOperand();
-                }
-                else if (LoadInst *load = dyn_cast<LoadInst>(&inst))
-                {
-                    if (valueMap.find(load->getPointerOperand()) != valueMap.end())
-                    {
-                        load->replaceAllUsesWith(valueMap[load->getPointerOperand()]);
-                    }
-                }
+                value = sumBalanced(builder, g.negative);
             }
+            if (g.scale.isPowerOf2() && !g.scale.isOne())
+                value = builder.CreateShl(value, g.scale.logBase2(), "reass");
+            else if (!g.scale.isOne())
+                value = builder.CreateMul(value, ConstantInt::get(type, g.scale), "reass");
+            (g.positive.empty() ? negative : positive).push_back(value);
         }
+
+        if (positive.empty())
+            return builder.CreateSub(ConstantInt::get(type, form.constant), sumBalanced(builder, negative), "reass");
+        Value *value = sumBalanced(builder, positive);
+        if (!negative.empty())
+            value = builder.CreateSub(value, sumBalanced(builder, negative), "reass");
+        if (!form.constant.isZero())
+            value = builder.CreateAdd(value, ConstantInt::get(type, form.constant), "reass");
+        return value;
     }
-    mOut << "PartialEvaluation running...\n\rTo evaluate " << peTimes << " instructions\n\r";
-    return PreservedAnalyses::all();
+
+    Function &mFunc;
+    DenseMap<Value *, unsigned> mRank;
+    DenseMap<Instruction *, LinearForm> mForms;
+    std::vector<Instruction *> mOrder;
+    DenseMap<Value *, Value *> mReplaced;
+};
+
+} // namespace
+
+PreservedAnalyses PartialEvaluation::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int peTimes = Reassociator(func).run();
+
+    if (!peTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("expressions reassociated", peTimes);
+    mOut << "PartialEvaluation running on " << func.getName() << "...\n\rTo reassociate " << peTimes
+         << " expressions\n\r";
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
 }
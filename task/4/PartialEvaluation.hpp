@@ -1,8 +1,11 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Support/raw_ostream.h"
-#include "unordered_map"
 
+// 重结合：把整数 add/sub/mul/shl（乘数、移位量为常量）组成的表达式树展开成“常量 + Σ系数 × 叶子”的线性形式，
+// 叶子按秩（参数在前，其余按逆后序的定义顺序）排序、用哈希表合并同类项，
+// 再按系数分组重新生成一棵平衡树，指令数比原来少时替换。
+// 各步都没有有符号溢出（nsw）的表达式除以能整除所有系数的常量时，直接把系数除掉。
 class PartialEvaluation : public llvm::PassInfoMixin<PartialEvaluation>
 {
   public:
@@ -10,7 +13,7 @@ class PartialEvaluation : public llvm::PassInfoMixin<PartialEvaluation>
     {
     }
 
-    llvm::PreservedAnalyses run(llvm::Module &mod, llvm::ModuleAnalysisManager &mam);
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
 
   private:
     llvm::raw_ostream &mOut;
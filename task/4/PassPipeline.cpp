@@ -0,0 +1,133 @@
+#include "PassPipeline.hpp"
+
+#include "BitIdiomRecognition.hpp"
+#include "CommonSubexpressionElimination.hpp"
+#include "ConstantFolding.hpp"
+#include "ConstantPropagation.hpp"
+#include "DeadCodeElimination.hpp"
+#include "DeadGlobalElimination.hpp"
+#include "DeadStoreElimination.hpp"
+#include "FunctionInlining.hpp"
+#include "FunctionPurity.hpp"
+#include "IfCombining.hpp"
+#include "LoopIdiomRecognition.hpp"
+#include "LoopInvariantCodeMotion.hpp"
+#include "LoopNestOptimization.hpp"
+#include "LoopStrengthReduction.hpp"
+#include "LoopUnrollOptimization.hpp"
+#include "LoopVectorization.hpp"
+#include "Mem2Reg.hpp"
+#include "Memoization.hpp"
+#include "PartialEvaluation.hpp"
+#include "SLPVectorization.hpp"
+#include "ScalarReplacement.hpp"
+#include "StrengthReduction.hpp"
+#include "TailRecursionElimination.hpp"
+#include <llvm/ADT/SmallVector.h>
+
+using namespace llvm;
+
+namespace {
+
+// 预设：O0 不做任何优化；O1 只做开销小的标量优化；O2 为完整流水线；size 去掉会让代码膨胀的内联、向量化与循环展开
+struct Preset
+{
+    const char *name;
+    const char *pipeline;
+};
+
+const Preset gPresets[] = {
+    {"O0", ""},
+    {"O1", "sroa,mem2reg,cp,cf,dce,cse,dse,dce,dge"},
+    {"O2", "sroa,mem2reg,cp,cf,dce,bits,sr,cse,dse,ifc,licm,nest,idiom,dce,pe,tre,inline,vec,unroll,slp,dce,dge,lsr"},
+    {"size", "sroa,mem2reg,cp,cf,dce,bits,sr,cse,dse,ifc,licm,nest,idiom,dce,pe,tre,dce,dge,lsr"},
+};
+
+bool addPass(FixpointPassManager &mpm, StringRef name, const PipelineOptions &options, raw_ostream &out)
+{
+    if (name == "mem2reg")
+        mpm.addFunctionPass<Mem2Reg>();
+    else if (name == "sroa")
+        mpm.addFunctionPass<ScalarReplacement>();
+    else if (name == "cp")
+        mpm.addPass(ConstantPropagation(out));
+    else if (name == "cf")
+        mpm.addFunctionPass<ConstantFolding>();
+    else if (name == "dce")
+        mpm.addFunctionPass<DeadCodeElimination>();
+    else if (name == "dse")
+        mpm.addFunctionPass<DeadStoreElimination>();
+    else if (name == "dge")
+        mpm.addPass(DeadGlobalElimination(out));
+    else if (name == "bits")
+        mpm.addFunctionPass<BitIdiomRecognition>();
+    else if (name == "sr")
+        mpm.addFunctionPass<StrengthReduction>();
+    else if (name == "cse" || name == "gvn")
+        mpm.addFunctionPass<CommonSubexpressionElimination>();
+    else if (name == "ifc")
+        mpm.addFunctionPass<IfCombining>();
+    else if (name == "licm")
+    {
+        mpm.addFunctionPass<LoopInvariantCodeMotion>();
+        mpm.requireModuleAnalysis<FunctionPurity>();
+    }
+    else if (name == "nest")
+        mpm.addFunctionPass<LoopNestOptimization>(options.tileSize);
+    else if (name == "idiom")
+        mpm.addFunctionPass<LoopIdiomRecognition>();
+    else if (name == "pe")
+        mpm.addFunctionPass<PartialEvaluation>();
+    else if (name == "tre")
+        mpm.addFunctionPass<TailRecursionElimination>();
+    else if (name == "inline")
+        mpm.addPass(FunctionInlining(out, options.inlineThreshold));
+    else if (name == "memo")
+    {
+        mpm.addPass(Memoization(out));
+        mpm.requireModuleAnalysis<FunctionPurity>();
+    }
+    else if (name == "vec")
+        mpm.addFunctionPass<LoopVectorization>(options.vectorWidth);
+    else if (name == "unroll")
+        mpm.addFunctionPass<LoopUnrollOptimization>();
+    else if (name == "slp")
+        mpm.addFunctionPass<SLPVectorization>(options.vectorWidth);
+    else if (name == "lsr")
+        mpm.addLateFunctionPass<LoopStrengthReduction>();
+    else
+        return false;
+    return true;
+}
+
+} // namespace
+
+bool parsePassPipeline(FixpointPassManager &mpm, StringRef pipeline, const PipelineOptions &options, raw_ostream &out,
+                       raw_ostream &err)
+{
+    SmallVector<StringRef, 16> names;
+    pipeline.split(names, ',', -1, false);
+    for (auto name : names)
+    {
+        name = name.trim();
+        auto preset = std::find_if(std::begin(gPresets), std::end(gPresets),
+                                   [&](const Preset &p) { return name == p.name; });
+        if (preset != std::end(gPresets))
+        {
+            parsePassPipeline(mpm, preset->pipeline, options, out, err);
+            continue;
+        }
+        if (!addPass(mpm, name, options, out))
+        {
+            err << "Error: unknown pass '" << name << "' in pipeline '" << pipeline << "'\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+const char *passPipelineHelp()
+{
+    return "Comma-separated pass pipeline or preset (O0, O1, O2, size). Passes: sroa, mem2reg, cp, cf, dce, dse, "
+           "dge, bits, sr, cse (gvn), ifc, licm, nest, idiom, pe, tre, inline, vec, unroll, slp, lsr, memo";
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "FixpointPassManager.hpp"
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 默认流水线
+constexpr const char *gDefaultPipeline = "O2";
+
+// 可由命令行调整的pass参数
+struct PipelineOptions
+{
+    // FunctionInlining 的指令代价阈值
+    unsigned inlineThreshold = 60;
+    // LoopNestOptimization 分块时每块的迭代次数
+    unsigned tileSize = 64;
+    // LoopVectorization 与 SLPVectorization 的目标向量寄存器宽度（位）
+    unsigned vectorWidth = 128;
+};
+
+// 按文本描述向 mpm 添加pass，例如 "mem2reg,cp,cf,dce" 或预设 "O2"；预设也可以和pass混用，如 "O1,licm"。
+// 名字无法识别时向 err 报告并返回 false。
+bool parsePassPipeline(FixpointPassManager &mpm, llvm::StringRef pipeline, const PipelineOptions &options,
+                       llvm::raw_ostream &out, llvm::raw_ostream &err);
+
+// 所有可用的pass名与预设，用于命令行帮助
+const char *passPipelineHelp();
@@ -0,0 +1,170 @@
+#include "PassStatistics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <llvm/Support/JSON.h>
+#include <sys/resource.h>
+
+using namespace llvm;
+
+thread_local PassRecord *PassStatistics::sCurrent = nullptr;
+
+namespace {
+
+const auto gProcessStart = std::chrono::steady_clock::now();
+
+struct PassSummary
+{
+    std::string pass;
+    unsigned runs = 0;
+    unsigned changedRuns = 0;
+    double wall = 0;
+    double cpu = 0;
+    int64_t instsDelta = 0;
+    std::map<std::string, uint64_t> counters;
+};
+
+} // namespace
+
+double PassStatistics::now()
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - gProcessStart).count();
+}
+
+double PassStatistics::threadCPUTime()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+uint64_t PassStatistics::peakRSS()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // Linux 下 ru_maxrss 的单位是KB
+    return usage.ru_maxrss;
+}
+
+void PassStatistics::count(StringRef name, uint64_t value)
+{
+    if (sCurrent)
+        sCurrent->counters[name.str()] += value;
+}
+
+void PassStatistics::add(PassRecord record)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mRecords.push_back(std::move(record));
+}
+
+void PassStatistics::writeJSON(raw_ostream &out) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // 按pass汇总，耗时最多的排在前面
+    std::vector<PassSummary> summaries;
+    for (auto &record : mRecords)
+    {
+        auto it = std::find_if(summaries.begin(), summaries.end(),
+                               [&](const PassSummary &s) { return s.pass == record.pass; });
+        if (it == summaries.end())
+        {
+            summaries.push_back({record.pass});
+            it = summaries.end() - 1;
+        }
+        it->runs++;
+        it->changedRuns += record.changed;
+        it->wall += record.wall;
+        it->cpu += record.cpu;
+        it->instsDelta += int64_t(record.instsAfter) - int64_t(record.instsBefore);
+        for (auto &[name, value] : record.counters)
+            it->counters[name] += value;
+    }
+    std::stable_sort(summaries.begin(), summaries.end(),
+                     [](const PassSummary &a, const PassSummary &b) { return a.wall > b.wall; });
+
+    auto writeCounters = [](json::OStream &j, const std::map<std::string, uint64_t> &counters) {
+        j.attributeObject("counters", [&] {
+            for (auto &[name, value] : counters)
+                j.attribute(name, int64_t(value));
+        });
+    };
+
+    json::OStream j(out, 2);
+    j.object([&] {
+        j.attribute("total_wall_us", now());
+        j.attribute("peak_rss_kb", int64_t(peakRSS()));
+        j.attributeArray("summary", [&] {
+            for (auto &s : summaries)
+                j.object([&] {
+                    j.attribute("pass", s.pass);
+                    j.attribute("runs", int64_t(s.runs));
+                    j.attribute("changed_runs", int64_t(s.changedRuns));
+                    j.attribute("wall_us", s.wall);
+                    j.attribute("cpu_us", s.cpu);
+                    j.attribute("instructions_delta", s.instsDelta);
+                    writeCounters(j, s.counters);
+                });
+        });
+        j.attributeArray("runs", [&] {
+            for (auto &record : mRecords)
+                j.object([&] {
+                    j.attribute("pass", record.pass);
+                    j.attribute("round", int64_t(record.round));
+                    j.attribute("thread", int64_t(record.thread));
+                    j.attribute("start_us", record.start);
+                    j.attribute("wall_us", record.wall);
+                    j.attribute("cpu_us", record.cpu);
+                    j.attribute("instructions_before", int64_t(record.instsBefore));
+                    j.attribute("instructions_after", int64_t(record.instsAfter));
+                    j.attribute("changed", record.changed);
+                    j.attribute("peak_rss_kb", int64_t(record.peakRSS));
+                    writeCounters(j, record.counters);
+                });
+        });
+    });
+    out << "\n";
+}
+
+void PassStatistics::writeTrace(raw_ostream &out) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // Chrome trace event 格式：每次运行是一个完整事件（ph = "X"），峰值内存是计数器事件（ph = "C"）
+    json::OStream j(out);
+    j.object([&] {
+        j.attribute("displayTimeUnit", "ms");
+        j.attributeArray("traceEvents", [&] {
+            for (auto &record : mRecords)
+            {
+                j.object([&] {
+                    j.attribute("name", record.pass);
+                    j.attribute("cat", record.changed ? "changed" : "unchanged");
+                    j.attribute("ph", "X");
+                    j.attribute("ts", record.start);
+                    j.attribute("dur", record.wall);
+                    j.attribute("pid", 1);
+                    j.attribute("tid", int64_t(record.thread));
+                    j.attributeObject("args", [&] {
+                        j.attribute("round", int64_t(record.round));
+                        j.attribute("cpu_us", record.cpu);
+                        j.attribute("instructions_before", int64_t(record.instsBefore));
+                        j.attribute("instructions_after", int64_t(record.instsAfter));
+                        for (auto &[name, value] : record.counters)
+                            j.attribute(name, int64_t(value));
+                    });
+                });
+                j.object([&] {
+                    j.attribute("name", "peak RSS");
+                    j.attribute("ph", "C");
+                    j.attribute("ts", record.start + record.wall);
+                    j.attribute("pid", 1);
+                    j.attributeObject("args", [&] { j.attribute("KB", int64_t(record.peakRSS)); });
+                });
+            }
+        });
+    });
+    out << "\n";
+}
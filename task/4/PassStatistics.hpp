@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 一个pass在一轮中的一次运行
+struct PassRecord
+{
+    std::string pass;
+    unsigned round = 0;
+    // 0 为主线程，并行模式下工作线程从 1 开始编号
+    unsigned thread = 0;
+    // 相对进程启动时刻的开始时间、墙钟时间与本线程的CPU时间，单位微秒
+    double start = 0;
+    double wall = 0;
+    double cpu = 0;
+    // 运行前后的指令数；并行模式下只统计该线程分到的函数
+    uint64_t instsBefore = 0;
+    uint64_t instsAfter = 0;
+    bool changed = false;
+    // 运行结束时进程的峰值常驻内存，单位KB
+    uint64_t peakRSS = 0;
+    // pass 通过 PassStatistics::count 上报的变换计数
+    std::map<std::string, uint64_t> counters;
+};
+
+// 收集每个pass的计时与统计，并输出为 JSON 或 Chrome trace（chrome://tracing、Perfetto）
+class PassStatistics
+{
+  public:
+    // 计时运行 fn，期间当前线程上 count 的计数都记到返回的记录上
+    template <typename Fn> static PassRecord measure(llvm::StringRef pass, unsigned round, unsigned thread, Fn &&fn)
+    {
+        PassRecord record;
+        record.pass = pass.str();
+        record.round = round;
+        record.thread = thread;
+        PassRecord *outer = sCurrent;
+        sCurrent = &record;
+        double cpuStart = threadCPUTime();
+        record.start = now();
+        fn();
+        record.wall = now() - record.start;
+        record.cpu = threadCPUTime() - cpuStart;
+        record.peakRSS = peakRSS();
+        sCurrent = outer;
+        return record;
+    }
+
+    // 给当前线程正在计时的pass累加计数器；没有pass在计时时忽略
+    static void count(llvm::StringRef name, uint64_t value = 1);
+
+    // 线程安全
+    void add(PassRecord record);
+
+    void writeJSON(llvm::raw_ostream &out) const;
+    void writeTrace(llvm::raw_ostream &out) const;
+
+    static double now();
+    static double threadCPUTime();
+    static uint64_t peakRSS();
+
+  private:
+    static thread_local PassRecord *sCurrent;
+
+    mutable std::mutex mMutex;
+    std::vector<PassRecord> mRecords;
+};
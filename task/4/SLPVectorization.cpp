@@ -0,0 +1,431 @@
+#include "SLPVectorization.hpp"
+#include "AliasOracle.hpp"
+#include "LoopDependence.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+using namespace llvm;
+
+namespace {
+
+// 自底向上打包的最大深度，更深的操作数逐通道插入
+constexpr unsigned kMaxTreeDepth = 12;
+
+bool isVectorizableType(Type *type)
+{
+    return type->isIntegerTy() || type->isFloatTy() || type->isDoubleTy();
+}
+
+// load、store 访问的地址 base + offset
+struct Address
+{
+    Value *base = nullptr;
+    AffineExpr offset;
+};
+
+bool getAddress(Instruction *inst, const DataLayout &DL, Address &address)
+{
+    return decomposeAddress(getLoadStorePointerOperand(inst), DL, address.base, address.offset);
+}
+
+bool isSameArray(const Address &a, const Address &b)
+{
+    if (a.base != b.base || a.offset.terms.size() != b.offset.terms.size())
+        return false;
+    for (auto &[term, coeff] : a.offset.terms)
+        if (b.offset.terms.lookup(term) != coeff)
+            return false;
+    return true;
+}
+
+// 同一个包中各通道的标量；vectorize 为 false 时逐通道插入向量，否则由一条向量指令计算
+struct TreeNode
+{
+    SmallVector<Value *, 16> scalars;
+    bool vectorize;
+    SmallVector<unsigned, 3> operands;
+    Value *vector = nullptr;
+};
+
+// 以 stores 为根的打包树
+class SLPTree
+{
+  public:
+    SLPTree(ArrayRef<StoreInst *> stores, const DataLayout &DL, AliasOracle &alias)
+        : mStores(stores.begin(), stores.end()), mDL(DL), mAlias(alias), mBlock(stores[0]->getParent())
+    {
+        mInsertPoint = mStores[0];
+        for (StoreInst *store : mStores)
+        {
+            if (mInsertPoint->comesBefore(store))
+                mInsertPoint = store;
+            mInTree.insert(store);
+        }
+    }
+
+    // 建树并检查打包是否合法，打包后更便宜时返回 true
+    bool build()
+    {
+        SmallVector<Value *, 16> values;
+        for (StoreInst *store : mStores)
+            values.push_back(store->getValueOperand());
+        mRoot = buildNode(values, 0);
+        return getCost() < 0 && checkExternalUses() && checkMemory();
+    }
+
+    void emit()
+    {
+        IRBuilder<> builder(mInsertPoint);
+        Value *value = emitNode(builder, mRoot);
+        StoreInst *first = mStores[0];
+        builder.CreateAlignedStore(value, castPointer(builder, first->getPointerOperand(), value->getType()),
+                                   first->getAlign());
+        // 打包位置之后的使用者改为从向量中取出
+        for (auto &[scalar, uses] : mExternalUses)
+        {
+            auto [node, lane] = mLanes.lookup(scalar);
+            Value *extract = builder.CreateExtractElement(mNodes[node].vector, lane);
+            for (Use *use : uses)
+                use->set(extract);
+        }
+        for (StoreInst *store : mStores)
+        {
+            Value *stored = store->getValueOperand();
+            store->eraseFromParent();
+            RecursivelyDeleteTriviallyDeadInstructions(stored);
+        }
+    }
+
+  private:
+    // 各通道是同一基本块中操作码、类型都相同的不同指令，load 依次读取相邻的元素
+    bool isIsomorphic(ArrayRef<Value *> scalars)
+    {
+        auto *first = dyn_cast<Instruction>(scalars[0]);
+        if (!first || !isVectorizableType(first->getType()))
+            return false;
+        if (auto *binary = dyn_cast<BinaryOperator>(first))
+        {
+            switch (binary->getOpcode())
+            {
+            case Instruction::SDiv:
+            case Instruction::UDiv:
+            case Instruction::SRem:
+            case Instruction::URem:
+                return false;
+            default:
+                break;
+            }
+        }
+        else if (!isa<LoadInst>(first) && !isa<CmpInst>(first) && !isa<CastInst>(first) && !isa<SelectInst>(first) &&
+                 !isa<UnaryOperator>(first))
+            return false;
+        if (!isa<LoadInst>(first) &&
+            !all_of(first->operands(), [](Value *op) { return isVectorizableType(op->getType()); }))
+            return false;
+
+        SmallPtrSet<Value *, 16> seen;
+        for (Value *scalar : scalars)
+        {
+            auto *inst = dyn_cast<Instruction>(scalar);
+            if (!inst || inst->getParent() != mBlock || inst->getOpcode() != first->getOpcode() ||
+                inst->getType() != first->getType() || mInTree.count(inst) || !seen.insert(inst).second)
+                return false;
+            for (unsigned i = 0; i < inst->getNumOperands(); ++i)
+                if (inst->getOperand(i)->getType() != first->getOperand(i)->getType())
+                    return false;
+            if (auto *cmp = dyn_cast<CmpInst>(inst); cmp && cmp->getPredicate() != cast<CmpInst>(first)->getPredicate())
+                return false;
+        }
+
+        if (!isa<LoadInst>(first))
+            return true;
+        Address firstAddress;
+        if (!mDL.typeSizeEqualsStoreSize(first->getType()) || !getAddress(first, mDL, firstAddress))
+            return false;
+        int64_t size = mDL.getTypeStoreSize(first->getType()).getFixedSize();
+        for (unsigned k = 0; k < scalars.size(); ++k)
+        {
+            auto *load = cast<LoadInst>(scalars[k]);
+            Address address;
+            if (!load->isSimple() || !getAddress(load, mDL, address) || !isSameArray(firstAddress, address) ||
+                address.offset.constant - firstAddress.offset.constant != int64_t(k) * size)
+                return false;
+        }
+        return true;
+    }
+
+    // 可交换的运算中，与第一个通道的操作数不对应而交换后对应的通道交换两个操作数
+    static void reorderOperands(SmallVectorImpl<Value *> &lhs, SmallVectorImpl<Value *> &rhs)
+    {
+        auto key = [](Value *value) -> std::pair<unsigned, const Value *> {
+            if (isa<Constant>(value))
+                return {~0u, nullptr};
+            if (auto *load = dyn_cast<LoadInst>(value))
+                return {Instruction::Load, getUnderlyingObject(load->getPointerOperand())};
+            if (auto *inst = dyn_cast<Instruction>(value))
+                return {inst->getOpcode(), nullptr};
+            return {~1u, value};
+        };
+        for (unsigned k = 1; k < lhs.size(); ++k)
+            if (key(lhs[k]) != key(lhs[0]) && key(rhs[k]) == key(lhs[0]) && key(lhs[k]) == key(rhs[0]))
+                std::swap(lhs[k], rhs[k]);
+    }
+
+    unsigned buildNode(ArrayRef<Value *> scalars, unsigned depth)
+    {
+        // 与已有的包完全相同时直接复用
+        for (unsigned i = 0; i < mNodes.size(); ++i)
+            if (ArrayRef<Value *>(mNodes[i].scalars) == scalars)
+                return i;
+        unsigned index = mNodes.size();
+        bool vectorize = depth < kMaxTreeDepth && isIsomorphic(scalars);
+        mNodes.push_back({SmallVector<Value *, 16>(scalars.begin(), scalars.end()), vectorize, {}, nullptr});
+        if (!vectorize)
+            return index;
+        for (unsigned k = 0; k < scalars.size(); ++k)
+        {
+            mInTree.insert(cast<Instruction>(scalars[k]));
+            mLanes[scalars[k]] = {index, k};
+        }
+        auto *first = cast<Instruction>(scalars[0]);
+        if (isa<LoadInst>(first))
+            return index;
+
+        SmallVector<SmallVector<Value *, 16>, 3> operands(first->getNumOperands());
+        for (Value *scalar : scalars)
+            for (unsigned i = 0; i < operands.size(); ++i)
+                operands[i].push_back(cast<Instruction>(scalar)->getOperand(i));
+        if (first->isCommutative())
+            reorderOperands(operands[0], operands[1]);
+        for (auto &operand : operands)
+        {
+            unsigned child = buildNode(operand, depth + 1);
+            mNodes[index].operands.push_back(child);
+        }
+        return index;
+    }
+
+    // 打包后比原来多出的指令数：一个包一条向量指令，插入每个通道一条指令，取出每个值一条指令
+    int getCost()
+    {
+        int vf = mStores.size();
+        int cost = 1 - vf;
+        for (auto &node : mNodes)
+        {
+            if (node.vectorize)
+                cost += 1 - vf;
+            else if (is_splat(node.scalars))
+                cost += isa<Constant>(node.scalars[0]) ? 0 : 1;
+            else if (!all_of(node.scalars, [](Value *value) { return isa<Constant>(value); }))
+                cost += vf;
+        }
+        for (auto &node : mNodes)
+            if (node.vectorize)
+                for (Value *scalar : node.scalars)
+                    for (Use &use : scalar->uses())
+                        if (!mInTree.count(cast<Instruction>(use.getUser())))
+                            mExternalUses[scalar].push_back(&use);
+        return cost + mExternalUses.size();
+    }
+
+    // 包中的值在打包位置之前还有其它使用者时无法改为从向量中取出
+    bool checkExternalUses()
+    {
+        for (auto &[scalar, uses] : mExternalUses)
+            for (Use *use : uses)
+            {
+                auto *user = cast<Instruction>(use->getUser());
+                if (user->getParent() == mBlock && !mInsertPoint->comesBefore(user))
+                    return false;
+            }
+        return true;
+    }
+
+    bool mayAlias(Instruction *a, Instruction *b)
+    {
+        Address lhs, rhs;
+        int64_t lhsSize = mDL.getTypeStoreSize(getLoadStoreType(a)).getFixedSize();
+        int64_t rhsSize = mDL.getTypeStoreSize(getLoadStoreType(b)).getFixedSize();
+        if (getAddress(a, mDL, lhs) && getAddress(b, mDL, rhs) && isSameArray(lhs, rhs))
+            return lhs.offset.constant < rhs.offset.constant + rhsSize &&
+                   rhs.offset.constant < lhs.offset.constant + lhsSize;
+        return mAlias.mayAlias(getLoadStorePointerOperand(a), getLoadStoreType(a), getLoadStorePointerOperand(b),
+                               getLoadStoreType(b));
+    }
+
+    // 打包的 load 与 store 都移到打包位置：途经的内存访问不能与它们别名。
+    // 向量 load 总在向量 store 之前执行，打包的 load 越过打包的 store 不影响结果
+    bool checkMemory()
+    {
+        SmallVector<Instruction *, 16> moved(mStores.begin(), mStores.end());
+        for (auto &node : mNodes)
+            if (node.vectorize && isa<LoadInst>(node.scalars[0]))
+                for (Value *scalar : node.scalars)
+                    moved.push_back(cast<Instruction>(scalar));
+        for (Instruction *inst : moved)
+        {
+            if (inst == mInsertPoint)
+                continue;
+            for (Instruction *other = inst->getNextNode(); other != mInsertPoint; other = other->getNextNode())
+            {
+                if (!other->mayReadOrWriteMemory())
+                    continue;
+                bool otherMoved = is_contained(moved, other);
+                if (isa<LoadInst>(inst) && (!other->mayWriteToMemory() || otherMoved))
+                    continue;
+                if (isa<StoreInst>(inst) && otherMoved && isa<StoreInst>(other))
+                    continue;
+                if ((!isa<LoadInst>(other) && !isa<StoreInst>(other)) || mayAlias(inst, other))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    Value *castPointer(IRBuilder<> &builder, Value *ptr, Type *type)
+    {
+        return builder.CreateBitCast(ptr, type->getPointerTo(ptr->getType()->getPointerAddressSpace()));
+    }
+
+    Value *emitNode(IRBuilder<> &builder, unsigned index)
+    {
+        if (mNodes[index].vector)
+            return mNodes[index].vector;
+        SmallVector<Value *, 3> operands;
+        for (unsigned child : mNodes[index].operands)
+            operands.push_back(emitNode(builder, child));
+
+        TreeNode &node = mNodes[index];
+        unsigned vf = node.scalars.size();
+        Value *vector;
+        if (!node.vectorize)
+        {
+            if (is_splat(node.scalars))
+                vector = builder.CreateVectorSplat(vf, node.scalars[0]);
+            else
+            {
+                vector = PoisonValue::get(FixedVectorType::get(node.scalars[0]->getType(), vf));
+                for (unsigned k = 0; k < vf; ++k)
+                    vector = builder.CreateInsertElement(vector, node.scalars[k], k);
+            }
+        }
+        else if (auto *load = dyn_cast<LoadInst>(node.scalars[0]))
+        {
+            auto *type = FixedVectorType::get(load->getType(), vf);
+            vector = builder.CreateAlignedLoad(type, castPointer(builder, load->getPointerOperand(), type),
+                                               load->getAlign(), load->getName());
+        }
+        else
+        {
+            auto *first = cast<Instruction>(node.scalars[0]);
+            Instruction *clone = first->clone();
+            for (unsigned i = 0; i < operands.size(); ++i)
+                clone->setOperand(i, operands[i]);
+            clone->mutateType(FixedVectorType::get(first->getType(), vf));
+            // 各通道的 nsw 等标记不一定相同，只保留所有通道都有的
+            for (Value *scalar : node.scalars)
+                clone->andIRFlags(scalar);
+            builder.Insert(clone, first->getName());
+            vector = clone;
+        }
+        node.vector = vector;
+        return vector;
+    }
+
+    SmallVector<StoreInst *, 16> mStores;
+    const DataLayout &mDL;
+    AliasOracle &mAlias;
+    BasicBlock *mBlock;
+    Instruction *mInsertPoint;
+    std::vector<TreeNode> mNodes;
+    unsigned mRoot = 0;
+    // 打包为向量的指令（包括根上的 store）
+    SmallPtrSet<Instruction *, 32> mInTree;
+    // 打包为向量的值所在的包与通道
+    DenseMap<Value *, std::pair<unsigned, unsigned>> mLanes;
+    MapVector<Value *, SmallVector<Use *, 2>> mExternalUses;
+};
+
+// 写入同一数组（基址与非常量的偏移项相同）的同类型 store，按常量偏移排列
+struct StoreGroup
+{
+    Address address;
+    Type *type;
+    SmallVector<std::pair<int64_t, StoreInst *>, 16> stores;
+};
+
+int vectorizeBlock(BasicBlock &bb, unsigned vectorWidth, const DataLayout &DL, AliasOracle &alias)
+{
+    SmallVector<StoreGroup, 8> groups;
+    for (Instruction &inst : bb)
+    {
+        auto *store = dyn_cast<StoreInst>(&inst);
+        Address address;
+        if (!store || !store->isSimple() || !getAddress(store, DL, address))
+            continue;
+        Type *type = store->getValueOperand()->getType();
+        if (!isVectorizableType(type) || !DL.typeSizeEqualsStoreSize(type))
+            continue;
+        auto group = find_if(groups, [&](StoreGroup &group) {
+            return group.type == type && isSameArray(group.address, address);
+        });
+        if (group == groups.end())
+            group = groups.insert(groups.end(), {address, type, {}});
+        group->stores.push_back({address.offset.constant, store});
+    }
+
+    int times = 0;
+    SmallPtrSet<StoreInst *, 16> done;
+    for (auto &group : groups)
+    {
+        auto &stores = group.stores;
+        stable_sort(stores, [](auto &lhs, auto &rhs) { return lhs.first < rhs.first; });
+        int64_t size = DL.getTypeStoreSize(group.type).getFixedSize();
+        for (unsigned vf = PowerOf2Floor(vectorWidth / (size * 8)); vf >= 2; vf /= 2)
+            for (unsigned k = 0; k + vf <= stores.size();)
+            {
+                SmallVector<StoreInst *, 16> bundle;
+                for (unsigned j = 0; j < vf; ++j)
+                    if (!done.count(stores[k + j].second) && stores[k + j].first == stores[k].first + j * size)
+                        bundle.push_back(stores[k + j].second);
+                if (bundle.size() != vf)
+                {
+                    ++k;
+                    continue;
+                }
+                SLPTree tree(bundle, DL, alias);
+                if (!tree.build())
+                {
+                    ++k;
+                    continue;
+                }
+                tree.emit();
+                done.insert(bundle.begin(), bundle.end());
+                ++times;
+                k += vf;
+            }
+    }
+    return times;
+}
+
+} // namespace
+
+PreservedAnalyses SLPVectorization::run(Function &func, FunctionAnalysisManager &fam)
+{
+    int vectorizeTimes = 0;
+    const DataLayout &DL = func.getParent()->getDataLayout();
+    AliasOracle alias(DL);
+    for (BasicBlock &bb : func)
+        vectorizeTimes += vectorizeBlock(bb, mVectorWidth, DL, alias);
+
+    if (!vectorizeTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("store groups vectorized", vectorizeTimes);
+    mOut << "SLPVectorization running on " << func.getName() << "...\n\rTo vectorize " << vectorizeTimes
+         << " store groups\n\r";
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 直线代码的 SLP 向量化：以同一基本块中写入相邻数组元素的 store 为种子，自底向上把各通道上同构的
+// 运算（相同的操作码、类型，load 读取相邻的元素）打包成向量运算，不同构的操作数逐通道插入向量。
+// 打包后的 load 与 store 都移到最后一个 store 处执行，要求途经的内存访问与它们不别名；
+// 包中的值在打包位置之前还有其它使用者时放弃。向量长度为 vectorWidth（位）除以元素位宽，
+// 打包后的指令数（包括插入与提取的指令）少于原来的标量指令数时才变换。
+// 典型的来源是 LoopUnrollOptimization 完全展开后的循环体。
+class SLPVectorization : public llvm::PassInfoMixin<SLPVectorization>
+{
+  public:
+    SLPVectorization(llvm::raw_ostream &out, unsigned vectorWidth) : mOut(out), mVectorWidth(vectorWidth)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+    unsigned mVectorWidth;
+};
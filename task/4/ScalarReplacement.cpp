@@ -0,0 +1,219 @@
+#include "ScalarReplacement.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/Analysis/ConstantFolding.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <map>
+
+using namespace llvm;
+
+namespace {
+
+// 一个聚合类型最多拆出的标量数
+constexpr unsigned kMaxSplitElements = 64;
+
+// 把聚合类型按存储布局展开成标量槽位（偏移 -> 类型），槽位过多时放弃
+bool collectSlots(Type *type, uint64_t offset, const DataLayout &dl, std::map<uint64_t, Type *> &slots)
+{
+    if (auto *array = dyn_cast<ArrayType>(type))
+    {
+        uint64_t size = dl.getTypeAllocSize(array->getElementType());
+        for (uint64_t i = 0; i < array->getNumElements(); ++i)
+            if (!collectSlots(array->getElementType(), offset + i * size, dl, slots))
+                return false;
+        return true;
+    }
+    if (auto *structType = dyn_cast<StructType>(type))
+    {
+        const StructLayout *layout = dl.getStructLayout(structType);
+        for (unsigned i = 0; i < structType->getNumElements(); ++i)
+            if (!collectSlots(structType->getElementType(i), offset + layout->getElementOffset(i), dl, slots))
+                return false;
+        return true;
+    }
+    if (!type->isIntOrPtrTy() && !type->isFloatingPointTy())
+        return false;
+    slots[offset] = type;
+    return slots.size() <= kMaxSplitElements;
+}
+
+// 一次对某个槽位的访问：load/store 改为访问拆出的 alloca，value 非空时在 inst 前插入这个常量的 store
+struct SlotAccess
+{
+    Instruction *inst;
+    uint64_t offset;
+    Constant *value;
+};
+
+class AggregateSplitter
+{
+  public:
+    AggregateSplitter(AllocaInst *alloca, const DataLayout &dl) : mAlloca(alloca), mDL(dl)
+    {
+    }
+
+    bool analyze()
+    {
+        return collectSlots(mAlloca->getAllocatedType(), 0, mDL, mSlots) && collectAccesses(mAlloca, 0);
+    }
+
+    void split()
+    {
+        std::map<uint64_t, AllocaInst *> parts;
+        auto partAt = [&](uint64_t offset) {
+            AllocaInst *&part = parts[offset];
+            if (!part)
+                part = new AllocaInst(mSlots[offset], mAlloca->getAddressSpace(),
+                                      mAlloca->getName() + "." + Twine(offset), mAlloca);
+            return part;
+        };
+
+        for (auto &access : mAccesses)
+        {
+            if (access.value)
+                new StoreInst(access.value, partAt(access.offset), access.inst);
+            else if (auto *load = dyn_cast<LoadInst>(access.inst))
+                load->setOperand(LoadInst::getPointerOperandIndex(), partAt(access.offset));
+            else
+                access.inst->setOperand(StoreInst::getPointerOperandIndex(), partAt(access.offset));
+        }
+        for (auto *intrinsic : mIntrinsics)
+            intrinsic->eraseFromParent();
+        // GEP 按先父后子的顺序收集，倒序删除
+        for (auto it = mGEPs.rbegin(); it != mGEPs.rend(); ++it)
+            (*it)->eraseFromParent();
+        mAlloca->eraseFromParent();
+    }
+
+  private:
+    // 访问必须恰好是一个完整的标量元素
+    bool matchesSlot(uint64_t offset, Type *type) const
+    {
+        auto it = mSlots.find(offset);
+        return it != mSlots.end() && it->second == type;
+    }
+
+    // 收集从 ptr 出发、经过常量下标 GEP 的所有访问，出现其它用法时失败
+    bool collectAccesses(Instruction *ptr, uint64_t offset)
+    {
+        for (auto *user : ptr->users())
+        {
+            if (auto *gep = dyn_cast<GetElementPtrInst>(user))
+            {
+                APInt gepOffset(mDL.getIndexTypeSizeInBits(gep->getType()), 0);
+                if (gep->getPointerOperand() != ptr || !gep->accumulateConstantOffset(mDL, gepOffset) ||
+                    gepOffset.isNegative())
+                    return false;
+                mGEPs.push_back(gep);
+                if (!collectAccesses(gep, offset + gepOffset.getZExtValue()))
+                    return false;
+            }
+            else if (auto *load = dyn_cast<LoadInst>(user))
+            {
+                if (load->isVolatile() || !matchesSlot(offset, load->getType()))
+                    return false;
+                mAccesses.push_back({load, offset, nullptr});
+            }
+            else if (auto *store = dyn_cast<StoreInst>(user))
+            {
+                if (store->isVolatile() || store->getValueOperand() == ptr ||
+                    !matchesSlot(offset, store->getValueOperand()->getType()))
+                    return false;
+                mAccesses.push_back({store, offset, nullptr});
+            }
+            else if (auto *intrinsic = dyn_cast<MemIntrinsic>(user))
+            {
+                if (!collectInitializer(intrinsic, ptr, offset))
+                    return false;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // memset 常量字节、或从常量全局变量 memcpy：覆盖到的每个槽位都必须完整，逐个算出写入的常量
+    bool collectInitializer(MemIntrinsic *intrinsic, Instruction *ptr, uint64_t offset)
+    {
+        auto *length = dyn_cast<ConstantInt>(intrinsic->getLength());
+        if (intrinsic->isVolatile() || intrinsic->getRawDest() != ptr || !length)
+            return false;
+        uint64_t end = offset + length->getZExtValue();
+
+        auto *memset = dyn_cast<MemSetInst>(intrinsic);
+        auto *byte = memset ? dyn_cast<ConstantInt>(memset->getValue()) : nullptr;
+        GlobalVariable *source = nullptr;
+        if (auto *transfer = dyn_cast<MemTransferInst>(intrinsic))
+        {
+            source = dyn_cast<GlobalVariable>(transfer->getRawSource()->stripPointerCasts());
+            if (!source || !source->isConstant() || !source->hasDefinitiveInitializer())
+                return false;
+        }
+        else if (!byte)
+        {
+            return false;
+        }
+
+        for (auto it = mSlots.lower_bound(offset); it != mSlots.end() && it->first < end; ++it)
+        {
+            auto [slotOffset, type] = *it;
+            if (slotOffset + mDL.getTypeStoreSize(type) > end)
+                return false;
+            Constant *value = nullptr;
+            if (source)
+                value = ConstantFoldLoadFromConst(source->getInitializer(), type,
+                                                  APInt(64, slotOffset - offset), mDL);
+            else if (type->isIntegerTy())
+                value = ConstantInt::get(type, APInt::getSplat(type->getIntegerBitWidth(), byte->getValue()));
+            else if (byte->isZero())
+                value = Constant::getNullValue(type);
+            if (!value)
+                return false;
+            mAccesses.push_back({intrinsic, slotOffset, value});
+        }
+        // 写入范围之内如果有槽位之间的填充也没关系，但不能越过 alloca
+        if (end > mDL.getTypeAllocSize(mAlloca->getAllocatedType()))
+            return false;
+        mIntrinsics.push_back(intrinsic);
+        return true;
+    }
+
+    AllocaInst *mAlloca;
+    const DataLayout &mDL;
+    std::map<uint64_t, Type *> mSlots;
+    std::vector<SlotAccess> mAccesses;
+    SmallVector<GetElementPtrInst *, 16> mGEPs;
+    SmallVector<MemIntrinsic *, 2> mIntrinsics;
+};
+
+} // namespace
+
+PreservedAnalyses ScalarReplacement::run(Function &func, FunctionAnalysisManager &fam)
+{
+    const DataLayout &dl = func.getParent()->getDataLayout();
+    std::vector<AllocaInst *> aggregates;
+    for (auto &inst : func.getEntryBlock())
+        if (auto *alloca = dyn_cast<AllocaInst>(&inst))
+            if (alloca->isStaticAlloca() && alloca->getAllocatedType()->isAggregateType())
+                aggregates.push_back(alloca);
+
+    int splitTimes = 0;
+    for (auto *alloca : aggregates)
+    {
+        AggregateSplitter splitter(alloca, dl);
+        if (!splitter.analyze())
+            continue;
+        splitter.split();
+        ++splitTimes;
+    }
+
+    if (!splitTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("allocas split", splitTimes);
+    mOut << "ScalarReplacement running on " << func.getName() << "...\n\rTo split " << splitTimes
+         << " allocas\n\r";
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
+}
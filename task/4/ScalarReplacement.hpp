@@ -0,0 +1,20 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 聚合类型的标量替换（SROA）：入口块中的局部数组、结构体如果只通过常量下标访问，
+// 每个被访问的标量元素拆成一个单独的 alloca，之后由 Mem2Reg 提升为寄存器。
+// 常量长度的 memset 与从常量全局变量的 memcpy（clang 生成的数组初始化）拆成逐元素的 store。
+class ScalarReplacement : public llvm::PassInfoMixin<ScalarReplacement>
+{
+  public:
+    explicit ScalarReplacement(llvm::raw_ostream &out) : mOut(out)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+};
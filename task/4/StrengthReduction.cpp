@@ -1,161 +1,379 @@
 #include "StrengthReduction.hpp"
+#include "PassStatistics.hpp"
 
 using namespace llvm;
 
-PreservedAnalyses StrengthReduction::run(Module &mod, ModuleAnalysisManager &mam)
+namespace {
+
+// 有符号除以常数 d 的魔数：q = ((x * m) >> (W + shift)) 再做符号修正（Hacker's Delight 10-1）
+struct SignedMagic
+{
+    APInt multiplier;
+    unsigned shift;
+};
+
+// 无符号除以常数 d 的魔数；add 为真时乘数需要 W + 1 位，要用 (x - t) / 2 + t 的形式修正
+struct UnsignedMagic
+{
+    APInt multiplier;
+    unsigned shift;
+    bool add;
+};
+
+SignedMagic computeSignedMagic(const APInt &d)
+{
+    unsigned bits = d.getBitWidth();
+    APInt ad = d.abs();
+    APInt signedMin = APInt::getSignedMinValue(bits);
+    APInt t = signedMin + d.lshr(bits - 1);
+    APInt anc = t - 1 - t.urem(ad);
+    unsigned p = bits - 1;
+    APInt q1 = signedMin.udiv(anc), r1 = signedMin - q1 * anc;
+    APInt q2 = signedMin.udiv(ad), r2 = signedMin - q2 * ad;
+    APInt delta;
+    do
+    {
+        ++p;
+        q1 <<= 1;
+        r1 <<= 1;
+        if (r1.uge(anc))
+        {
+            ++q1;
+            r1 -= anc;
+        }
+        q2 <<= 1;
+        r2 <<= 1;
+        if (r2.uge(ad))
+        {
+            ++q2;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1.ult(delta) || (q1 == delta && r1 == 0));
+
+    APInt m = q2 + 1;
+    if (d.isNegative())
+        m.negate();
+    return {m, p - bits};
+}
+
+UnsignedMagic computeUnsignedMagic(const APInt &d)
+{
+    unsigned bits = d.getBitWidth();
+    APInt signedMin = APInt::getSignedMinValue(bits);
+    APInt signedMax = APInt::getSignedMaxValue(bits);
+    APInt nc = APInt::getAllOnes(bits) - (-d).urem(d);
+    unsigned p = bits - 1;
+    bool add = false;
+    APInt q1 = signedMin.udiv(nc), r1 = signedMin - q1 * nc;
+    APInt q2 = signedMax.udiv(d), r2 = signedMax - q2 * d;
+    APInt delta;
+    do
+    {
+        ++p;
+        if (r1.uge(nc - r1))
+        {
+            q1 = q1 + q1 + 1;
+            r1 = r1 + r1 - nc;
+        }
+        else
+        {
+            q1 = q1 + q1;
+            r1 = r1 + r1;
+        }
+        if ((r2 + 1).uge(d - r2))
+        {
+            if (q2.uge(signedMax))
+                add = true;
+            q2 = q2 + q2 + 1;
+            r2 = r2 + r2 + 1 - d;
+        }
+        else
+        {
+            if (q2.uge(signedMin))
+                add = true;
+            q2 = q2 + q2;
+            r2 = r2 + r2 + 1;
+        }
+        delta = d - 1 - r2;
+    } while (p < 2 * bits && (q1.ult(delta) || (q1 == delta && r1 == 0)));
+
+    return {q2 + 1, p - bits, add};
+}
+
+// 乘积的高 W 位：扩展到 2W 位相乘后右移 W 位
+Value *createMulHigh(IRBuilder<> &builder, Value *x, const APInt &m, bool isSigned)
+{
+    unsigned bits = m.getBitWidth();
+    Type *wide = builder.getIntNTy(bits * 2);
+    Value *wx = isSigned ? builder.CreateSExt(x, wide) : builder.CreateZExt(x, wide);
+    Value *wm = ConstantInt::get(wide, isSigned ? m.sext(bits * 2) : m.zext(bits * 2));
+    Value *product = builder.CreateMul(wx, wm);
+    Value *high = isSigned ? builder.CreateAShr(product, bits) : builder.CreateLShr(product, bits);
+    return builder.CreateTrunc(high, x->getType());
+}
+
+// x / d（有符号），d 不为 0
+Value *createSDiv(IRBuilder<> &builder, Value *x, const APInt &d)
+{
+    unsigned bits = d.getBitWidth();
+    if (d == 1)
+        return x;
+    if (d.isAllOnes())
+        return builder.CreateNeg(x);
+
+    APInt ad = d.abs();
+    if (ad.isPowerOf2())
+    {
+        // 负数先加上 |d| - 1，使右移向零取整
+        unsigned k = ad.logBase2();
+        Value *sign = k > 1 ? builder.CreateAShr(x, k - 1) : x;
+        Value *bias = builder.CreateLShr(sign, bits - k);
+        Value *q = builder.CreateAShr(builder.CreateAdd(x, bias), k);
+        return d.isNegative() ? builder.CreateNeg(q) : q;
+    }
+
+    SignedMagic magic = computeSignedMagic(d);
+    Value *q = createMulHigh(builder, x, magic.multiplier, true);
+    if (d.isStrictlyPositive() && magic.multiplier.isNegative())
+        q = builder.CreateAdd(q, x);
+    else if (d.isNegative() && magic.multiplier.isStrictlyPositive())
+        q = builder.CreateSub(q, x);
+    if (magic.shift)
+        q = builder.CreateAShr(q, magic.shift);
+    // 商为负时加一，向零取整
+    return builder.CreateAdd(q, builder.CreateLShr(q, bits - 1));
+}
+
+// x / d（无符号），d 不为 0
+Value *createUDiv(IRBuilder<> &builder, Value *x, const APInt &d)
+{
+    if (d == 1)
+        return x;
+    if (d.isPowerOf2())
+        return builder.CreateLShr(x, d.logBase2());
+    // 除数不小于 2^(W-1) 时商只能是 0 或 1
+    if (d.isNegative())
+        return builder.CreateZExt(builder.CreateICmpUGE(x, ConstantInt::get(x->getType(), d)), x->getType());
+
+    UnsignedMagic magic = computeUnsignedMagic(d);
+    Value *q = createMulHigh(builder, x, magic.multiplier, false);
+    if (!magic.add)
+        return magic.shift ? builder.CreateLShr(q, magic.shift) : q;
+    Value *t = builder.CreateLShr(builder.CreateSub(x, q), 1);
+    return builder.CreateLShr(builder.CreateAdd(t, q), magic.shift - 1);
+}
+
+// x - (x / d) * d
+Value *createRem(IRBuilder<> &builder, Value *x, Value *q, const APInt &d)
+{
+    APInt ad = d.abs();
+    Value *product = ad.isPowerOf2() && !d.isNegative()
+                         ? builder.CreateShl(q, ad.logBase2())
+                         : builder.CreateMul(q, ConstantInt::get(x->getType(), d));
+    return builder.CreateSub(x, product);
+}
+
+// 除数是可以展开的常数：非零，且位宽不超过 64 以免乘法过宽
+const APInt *getDivisor(Value *rhs)
+{
+    auto *constRhs = dyn_cast<ConstantInt>(rhs);
+    if (!constRhs || constRhs->isZero() || constRhs->getBitWidth() > 64)
+        return nullptr;
+    return &constRhs->getValue();
+}
+
+} // namespace
+
+PreservedAnalyses StrengthReduction::run(Function &func, FunctionAnalysisManager &fam)
 {
     int strengthReductionTimes = 0;
 
-    for (auto &func : mod)
+    for (auto &bb : func)
     {
-        for (auto &bb : func)
+        for (auto &inst : bb)
         {
-            for (auto &inst : bb)
+            if (auto *binOp = dyn_cast<BinaryOperator>(&inst))
             {
-                if (auto *binOp = dyn_cast<BinaryOperator>(&inst))
+                // 已经没有使用者的指令留给死代码消除
+                if (binOp->use_empty())
+                    continue;
+                auto *lhs = binOp->getOperand(0);
+                auto *rhs = binOp->getOperand(1);
+                switch (binOp->getOpcode())
                 {
-                    auto *lhs = binOp->getOperand(0);
-                    auto *rhs = binOp->getOperand(1);
-                    switch (binOp->getOpcode())
+                case Instruction::UDiv: {
+                    // a = a / a -> a = 1
+                    if (lhs == rhs)
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::get(binOp->getType(), 1));
+                        ++strengthReductionTimes;
+                    }
+                    // a = x / c -> 乘以魔数后取高位再右移
+                    else if (auto *divisor = getDivisor(rhs))
+                    {
+                        IRBuilder<> builder(binOp);
+                        binOp->replaceAllUsesWith(createUDiv(builder, lhs, *divisor));
+                        ++strengthReductionTimes;
+                    }
+                    break;
+                }
+                case Instruction::SDiv: {
+                    if (lhs == rhs)
+                    {
+                        binOp->replaceAllUsesWith(ConstantInt::get(binOp->getType(), 1));
+                        ++strengthReductionTimes;
+                    }
+                    else if (auto *divisor = getDivisor(rhs))
+                    {
+                        IRBuilder<> builder(binOp);
+                        binOp->replaceAllUsesWith(createSDiv(builder, lhs, *divisor));
+                        ++strengthReductionTimes;
+                    }
+                    break;
+                }
+                // a = a * x -> a = a << log2(x)
+                case Instruction::Mul: {
+                    if (auto *constRhs = dyn_cast<ConstantInt>(rhs))
                     {
-                    case Instruction::UDiv: {
-                        // a = a / a -> a = 1
-                        if (lhs == rhs)
+                        APInt multiplierValue = constRhs->getValue();
+                        if (multiplierValue.isPowerOf2())
                         {
-                            binOp->replaceAllUsesWith(ConstantInt::get(binOp->getType(), 1));
+                            int shift = multiplierValue.logBase2();
+                            Value *newInst = BinaryOperator::Create(
+                                Instruction::Shl, lhs, ConstantInt::get(constRhs->getType(), shift), "", binOp);
+                            binOp->replaceAllUsesWith(newInst);
                             ++strengthReductionTimes;
                         }
-                        break;
                     }
-                    case Instruction::SDiv: {
-                        if (lhs == rhs)
+                    break;
+                }
+                // a = a % x -> a = a & (x - 1)
+                case Instruction::URem: {
+                    if (auto *constRhs = dyn_cast<ConstantInt>(rhs))
+                    {
+                        APInt divisorValue = constRhs->getValue();
+                        if (divisorValue == 1)
                         {
-                            binOp->replaceAllUsesWith(ConstantInt::get(binOp->getType(), 1));
+                            binOp->replaceAllUsesWith(ConstantInt::get(constRhs->getType(), 0));
                             ++strengthReductionTimes;
                         }
-                        break;
-                    }
-                    // a = a * x -> a = a << log2(x)
-                    case Instruction::Mul: {
-                        if (auto *constRhs = dyn_cast<ConstantInt>(rhs))
+                        else if (divisorValue.isPowerOf2())
                         {
-                            APInt multiplierValue = constRhs->getValue();
-                            if (multiplierValue.isPowerOf2())
-                            {
-                                int shift = multiplierValue.logBase2();
-                                Value *newInst = BinaryOperator::Create(
-                                    Instruction::Shl, lhs, ConstantInt::get(constRhs->getType(), shift), "", binOp);
-                                binOp->replaceAllUsesWith(newInst);
-                                ++strengthReductionTimes;
-                            }
+                            binOp->replaceAllUsesWith(BinaryOperator::Create(
+                                Instruction::And, lhs, ConstantInt::get(constRhs->getType(), divisorValue - 1), "",
+                                binOp));
+                            ++strengthReductionTimes;
                         }
-                        break;
-                    }
-                    // a = a % x -> a = a & (x - 1)
-                    case Instruction::URem: {
-                        if (auto *constRhs = dyn_cast<ConstantInt>(rhs))
+                        // a = x % c -> a = x - x / c * c
+                        else if (auto *divisor = getDivisor(rhs))
                         {
-                            APInt divisorValue = constRhs->getValue();
-                            if (divisorValue == 1)
-                            {
-                                binOp->replaceAllUsesWith(ConstantInt::get(constRhs->getType(), 0));
-                                ++strengthReductionTimes;
-                            }
-                            else if (divisorValue.isPowerOf2())
-                            {
-                                binOp->replaceAllUsesWith(BinaryOperator::Create(
-                                    Instruction::And, lhs, ConstantInt::get(constRhs->getType(), divisorValue - 1), "",
-                                    binOp));
-                                ++strengthReductionTimes;
-                            }
+                            IRBuilder<> builder(binOp);
+                            binOp->replaceAllUsesWith(
+                                createRem(builder, lhs, createUDiv(builder, lhs, *divisor), *divisor));
+                            ++strengthReductionTimes;
                         }
-                        break;
                     }
-                    case Instruction::SRem: {
-                        if (auto *constRhs = dyn_cast<ConstantInt>(rhs))
+                    break;
+                }
+                case Instruction::SRem: {
+                    if (auto *constRhs = dyn_cast<ConstantInt>(rhs))
+                    {
+                        APInt divisorValue = constRhs->getValue();
+                        if (divisorValue == 1 || divisorValue.isAllOnes())
                         {
-                            APInt divisorValue = constRhs->getValue();
-                            if (divisorValue == 1)
-                            {
-                                binOp->replaceAllUsesWith(ConstantInt::get(constRhs->getType(), 0));
-                                ++strengthReductionTimes;
-                            }
+                            binOp->replaceAllUsesWith(ConstantInt::get(constRhs->getType(), 0));
+                            ++strengthReductionTimes;
                         }
-                        break;
-                    }
-                    // a = b / x + c / x -> a = (b + c) / x
-                    case Instruction::Add: {
-                        if (lhs == rhs)
+                        // 余数的符号与被除数相同，与除数的符号无关：x % c == x % |c|
+                        else if (auto *divisor = getDivisor(rhs))
                         {
-                            Value *newInst = BinaryOperator::Create(Instruction::Mul, lhs,
-                                                                    ConstantInt::get(binOp->getType(), 2), "", binOp);
-                            binOp->replaceAllUsesWith(newInst);
+                            APInt ad = divisor->abs();
+                            IRBuilder<> builder(binOp);
+                            binOp->replaceAllUsesWith(createRem(builder, lhs, createSDiv(builder, lhs, ad), ad));
                             ++strengthReductionTimes;
                         }
-                        else if (auto *addOp = dyn_cast<BinaryOperator>(lhs))
+                    }
+                    break;
+                }
+                // a = b / x + c / x -> a = (b + c) / x
+                case Instruction::Add: {
+                    if (lhs == rhs)
+                    {
+                        Value *newInst = BinaryOperator::Create(Instruction::Mul, lhs,
+                                                                ConstantInt::get(binOp->getType(), 2), "", binOp);
+                        binOp->replaceAllUsesWith(newInst);
+                        ++strengthReductionTimes;
+                    }
+                    else if (auto *addOp = dyn_cast<BinaryOperator>(lhs))
+                    {
+                        switch (addOp->getOpcode())
                         {
-                            switch (addOp->getOpcode())
+                        // a = b * x, c = a + b -> c = b * (x + 1)
+                        case Instruction::Mul: {
+                            if (auto *constRhs = dyn_cast<ConstantInt>(addOp->getOperand(1)))
                             {
-                            // a = b * x, c = a + b -> c = b * (x + 1)
-                            case Instruction::Mul: {
-                                if (auto *constRhs = dyn_cast<ConstantInt>(addOp->getOperand(1)))
+                                if (rhs == addOp->getOperand(0))
                                 {
-                                    if (rhs == addOp->getOperand(0))
-                                    {
-                                        Value *newInst = BinaryOperator::Create(
-                                            Instruction::Mul, addOp->getOperand(0),
-                                            ConstantInt::get(constRhs->getType(), constRhs->getValue() + 1), "", binOp);
-                                        binOp->replaceAllUsesWith(newInst);
-                                        ++strengthReductionTimes;
-                                    }
+                                    Value *newInst = BinaryOperator::Create(
+                                        Instruction::Mul, addOp->getOperand(0),
+                                        ConstantInt::get(constRhs->getType(), constRhs->getValue() + 1), "", binOp);
+                                    binOp->replaceAllUsesWith(newInst);
+                                    ++strengthReductionTimes;
                                 }
-                                break;
                             }
-                            // 位移改为乘法之后再进行强度削减
-                            case Instruction::Shl: {
-                                if (auto *constRhs = dyn_cast<ConstantInt>(addOp->getOperand(1)))
+                            break;
+                        }
+                        // 位移改为乘法之后再进行强度削减
+                        case Instruction::Shl: {
+                            if (auto *constRhs = dyn_cast<ConstantInt>(addOp->getOperand(1)))
+                            {
+                                if (rhs == addOp->getOperand(0))
                                 {
-                                    if (rhs == addOp->getOperand(0))
-                                    {
-                                        int shift = constRhs->getValue().getLimitedValue();
-                                        int mul = 1;
-                                        for (int i = 0; i < shift; ++i)
-                                            mul *= 2;
-                                        Value *newInst = BinaryOperator::Create(
-                                            Instruction::Mul, addOp->getOperand(0),
-                                            ConstantInt::get(constRhs->getType(), mul + 1), "", binOp);
-                                        binOp->replaceAllUsesWith(newInst);
-                                        ++strengthReductionTimes;
-                                    }
-                                    else if (lhs == addOp->getOperand(0))
-                                    {
-                                        int shift = constRhs->getValue().getLimitedValue();
-                                        int mul = 1;
-                                        for (int i = 0; i < shift; ++i)
-                                            mul *= 2;
-                                        Value *newInst = BinaryOperator::Create(
-                                            Instruction::Mul, addOp->getOperand(0),
-                                            ConstantInt::get(constRhs->getType(), mul + 1), "", binOp);
-                                        binOp->replaceAllUsesWith(newInst);
-                                        ++strengthReductionTimes;
-                                    }
+                                    int shift = constRhs->getValue().getLimitedValue();
+                                    int mul = 1;
+                                    for (int i = 0; i < shift; ++i)
+                                        mul *= 2;
+                                    Value *newInst = BinaryOperator::Create(
+                                        Instruction::Mul, addOp->getOperand(0),
+                                        ConstantInt::get(constRhs->getType(), mul + 1), "", binOp);
+                                    binOp->replaceAllUsesWith(newInst);
+                                    ++strengthReductionTimes;
+                                }
+                                else if (lhs == addOp->getOperand(0))
+                                {
+                                    int shift = constRhs->getValue().getLimitedValue();
+                                    int mul = 1;
+                                    for (int i = 0; i < shift; ++i)
+                                        mul *= 2;
+                                    Value *newInst = BinaryOperator::Create(
+                                        Instruction::Mul, addOp->getOperand(0),
+                                        ConstantInt::get(constRhs->getType(), mul + 1), "", binOp);
+                                    binOp->replaceAllUsesWith(newInst);
+                                    ++strengthReductionTimes;
                                 }
-                                break;
-                            }
-                            default:
-                                break;
                             }
+                            break;
+                        }
+                        default:
+                            break;
                         }
-                        break;
-                    }
-                    default:
-                        break;
                     }
+                    break;
+                }
+                default:
+                    break;
                 }
             }
         }
     }
 
-    mOut << "StrengthReduction running...\n\rTo reduce " << strengthReductionTimes << " instructions\n\r";
-    return PreservedAnalyses::all();
+    if (!strengthReductionTimes)
+        return PreservedAnalyses::all();
+    PassStatistics::count("instructions reduced", strengthReductionTimes);
+    mOut << "StrengthReduction running on " << func.getName() << "...\n\rTo reduce " << strengthReductionTimes
+         << " instructions\n\r";
+    PreservedAnalyses pa;
+    pa.preserveSet<CFGAnalyses>();
+    return pa;
 }
@@ -0,0 +1,206 @@
+#include "TailRecursionElimination.hpp"
+#include "PassStatistics.hpp"
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+
+using namespace llvm;
+
+namespace {
+
+// 可以换成回边的自调用：call 之后紧跟 ret call，或 acc = op(call, x) 后紧跟 ret acc
+struct TailCall
+{
+    CallInst *call;
+    ReturnInst *ret;
+    BinaryOperator *acc;
+};
+
+bool isSelfCall(Instruction *inst, Function &func)
+{
+    auto *call = dyn_cast_or_null<CallInst>(inst);
+    if (!call || call->getCalledFunction() != &func || call->getFunctionType() != func.getFunctionType())
+        return false;
+    // 栈帧被下一轮循环复用，被调用者不能再访问调用者的栈变量
+    return none_of(call->args(), [](Value *arg) {
+        return arg->getType()->isPointerTy() && isa<AllocaInst>(getUnderlyingObject(arg));
+    });
+}
+
+bool matchTailCall(ReturnInst *ret, Function &func, TailCall &tail)
+{
+    Value *value = ret->getReturnValue();
+    auto *prev = ret->getPrevNode();
+    if (!value || (value == prev && isa<CallInst>(prev)))
+    {
+        if (!isSelfCall(prev, func) || (value && !prev->hasOneUse()))
+            return false;
+        tail = {cast<CallInst>(prev), ret, nullptr};
+        return true;
+    }
+
+    auto *acc = dyn_cast<BinaryOperator>(value);
+    if (!acc || acc != prev || !acc->hasOneUse() || !acc->getType()->isIntegerTy() ||
+        (acc->getOpcode() != Instruction::Add && acc->getOpcode() != Instruction::Mul))
+        return false;
+    Instruction *call = acc->getPrevNode();
+    if (!isSelfCall(call, func) || !call->hasOneUse())
+        return false;
+    if (acc->getOperand(0) == acc->getOperand(1))
+        return false;
+    tail = {cast<CallInst>(call), ret, acc};
+    return true;
+}
+
+// 返回块只有 phi 与 ret 时，把它复制到以无条件分支进入的前驱中，使前驱末尾的自调用成为尾调用
+int foldReturnBlocks(Function &func)
+{
+    int foldTimes = 0;
+    SmallVector<ReturnInst *, 4> rets;
+    for (auto &bb : func)
+        if (auto *ret = dyn_cast<ReturnInst>(bb.getTerminator()))
+            rets.push_back(ret);
+
+    for (ReturnInst *ret : rets)
+    {
+        BasicBlock *exit = ret->getParent();
+        // 入口块没有前驱，不能复制到前驱中
+        if (exit == &func.getEntryBlock())
+            continue;
+        auto *phi = dyn_cast_or_null<PHINode>(ret->getReturnValue());
+        bool onlyPhi = phi && &exit->front() == phi && phi->getNextNode() == ret && phi->hasOneUse();
+        if (&exit->front() != ret && !onlyPhi)
+            continue;
+        if (!onlyPhi)
+            phi = nullptr;
+        int exitTimes = 0;
+        SmallVector<BasicBlock *, 4> preds(predecessors(exit));
+        for (BasicBlock *pred : preds)
+        {
+            auto *br = dyn_cast<BranchInst>(pred->getTerminator());
+            if (!br || br->isConditional())
+                continue;
+            Value *value = phi ? phi->getIncomingValueForBlock(pred) : ret->getReturnValue();
+            // 只复制到以自调用（或对自调用结果的一次运算）结尾的前驱，避免无谓地增加返回点
+            Instruction *last = br->getPrevNode();
+            if (!last || (value && value != last))
+                continue;
+            if (!isSelfCall(last, func) && !(isa<BinaryOperator>(last) && isSelfCall(last->getPrevNode(), func)))
+                continue;
+            ReturnInst::Create(func.getContext(), value, br);
+            br->eraseFromParent();
+            exit->removePredecessor(pred, true);
+            ++exitTimes;
+        }
+        foldTimes += exitTimes;
+        // 只删除前驱都被复制走的返回块，原本就不可达的块留给死代码消除
+        if (exitTimes && pred_empty(exit))
+            exit->eraseFromParent();
+    }
+    return foldTimes;
+}
+
+} // namespace
+
+PreservedAnalyses TailRecursionElimination::run(Function &func, FunctionAnalysisManager &fam)
+{
+    if (func.isDeclaration() || func.isVarArg())
+        return PreservedAnalyses::all();
+
+    int foldTimes = foldReturnBlocks(func);
+
+    // 所有累加的尾调用必须使用同一种运算
+    SmallVector<TailCall, 4> tails;
+    // 没有累加的尾调用时为空
+    BinaryOperator *firstAcc = nullptr;
+    for (auto &bb : func)
+    {
+        auto *ret = dyn_cast<ReturnInst>(bb.getTerminator());
+        TailCall tail;
+        if (!ret || !matchTailCall(ret, func, tail))
+            continue;
+        if (tail.acc)
+        {
+            if (firstAcc && firstAcc->getOpcode() != tail.acc->getOpcode())
+                continue;
+            if (!firstAcc)
+                firstAcc = tail.acc;
+        }
+        tails.push_back(tail);
+    }
+
+    if (tails.empty())
+    {
+        if (!foldTimes)
+            return PreservedAnalyses::all();
+        mOut << "TailRecursionElimination running on " << func.getName() << "...\n\rTo fold " << foldTimes
+             << " return blocks\n\r";
+        return PreservedAnalyses::none();
+    }
+
+    // 原入口块成为循环头，新的入口块只保留静态的 alloca
+    BasicBlock *header = &func.getEntryBlock();
+    header->setName("tailrecurse");
+    BasicBlock *entry = BasicBlock::Create(func.getContext(), "entry", &func, header);
+    BranchInst *entryBr = BranchInst::Create(header, entry);
+    for (auto &inst : make_early_inc_range(*header))
+        if (auto *alloca = dyn_cast<AllocaInst>(&inst))
+            if (isa<ConstantInt>(alloca->getArraySize()))
+                alloca->moveBefore(entryBr);
+
+    IRBuilder<> builder(header, header->getFirstInsertionPt());
+    SmallVector<PHINode *, 4> params;
+    for (Argument &arg : func.args())
+    {
+        PHINode *phi = builder.CreatePHI(arg.getType(), tails.size() + 1, arg.getName() + ".tr");
+        arg.replaceAllUsesWith(phi);
+        phi->addIncoming(&arg, entry);
+        params.push_back(phi);
+    }
+    PHINode *accumulator = nullptr;
+    Instruction::BinaryOps accOpcode = firstAcc ? firstAcc->getOpcode() : Instruction::Add;
+    if (firstAcc)
+    {
+        Type *type = func.getReturnType();
+        accumulator = builder.CreatePHI(type, tails.size() + 1, "accumulator.tr");
+        accumulator->addIncoming(ConstantInt::get(type, accOpcode == Instruction::Add ? 0 : 1), entry);
+    }
+
+    for (TailCall &tail : tails)
+    {
+        BasicBlock *bb = tail.ret->getParent();
+        builder.SetInsertPoint(tail.ret);
+        for (unsigned i = 0; i < params.size(); ++i)
+            params[i]->addIncoming(tail.call->getArgOperand(i), bb);
+        if (accumulator)
+        {
+            Value *next = accumulator;
+            // 形参已经换成 phi，从 acc 上重新取另一个操作数
+            if (tail.acc)
+                next = builder.CreateBinOp(accOpcode, accumulator,
+                                           tail.acc->getOperand(tail.acc->getOperand(0) == tail.call ? 1 : 0));
+            accumulator->addIncoming(next, bb);
+        }
+        builder.CreateBr(header);
+        tail.ret->eraseFromParent();
+        if (tail.acc)
+            tail.acc->eraseFromParent();
+        tail.call->eraseFromParent();
+    }
+
+    // 其余返回点在返回值上合并累加器
+    if (accumulator)
+        for (auto &bb : func)
+            if (auto *ret = dyn_cast<ReturnInst>(bb.getTerminator()))
+            {
+                builder.SetInsertPoint(ret);
+                ret->setOperand(0, builder.CreateBinOp(accOpcode, accumulator, ret->getReturnValue()));
+            }
+
+    int tailCallTimes = tails.size();
+    PassStatistics::count("tail calls eliminated", tailCallTimes);
+    PassStatistics::count("return blocks folded", foldTimes);
+    mOut << "TailRecursionElimination running on " << func.getName() << "...\n\rTo eliminate " << tailCallTimes
+         << " tail calls" << (accumulator ? " with an accumulator" : "") << "\n\r";
+    return PreservedAnalyses::none();
+}
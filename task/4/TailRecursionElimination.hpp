@@ -0,0 +1,21 @@
+#pragma once
+
+#include <llvm/IR/PassManager.h>
+#include <llvm/Support/raw_ostream.h>
+
+// 尾递归消除：紧接着 ret 的自调用改为带 phi 的回边，跳回函数开头，形参换成头块中的 phi。
+// 返回值是 op(自调用, x)（op 为整数 add 或 mul）时做累加器变换：x 累积到一个 phi 上，
+// 其它 ret 返回 op(累加器, 原返回值)，因此 fib(n - 1) + fib(n - 2) 也能消去后一次调用。
+// 只有 phi 与 ret 的公共返回块先复制到调用所在的块中；实参指向本函数栈变量的调用不处理。
+class TailRecursionElimination : public llvm::PassInfoMixin<TailRecursionElimination>
+{
+  public:
+    explicit TailRecursionElimination(llvm::raw_ostream &out) : mOut(out)
+    {
+    }
+
+    llvm::PreservedAnalyses run(llvm::Function &func, llvm::FunctionAnalysisManager &fam);
+
+  private:
+    llvm::raw_ostream &mOut;
+};
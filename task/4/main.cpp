@@ -4,22 +4,43 @@
 #include <llvm/IR/Verifier.h>
 #include <llvm/IRReader/IRReader.h>
 #include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 
-#include "CommonSubexpressionElimination.hpp"
-#include "ConstantFolding.hpp"
-#include "ConstantPropagation.hpp"
-#include "DeadCodeElimination.hpp"
-#include "FunctionInlining.hpp"
-#include "LoopInvariantCodeMotion.hpp"
-#include "LoopUnrollOptimization.hpp"
-#include "Mem2Reg.hpp"
+#include "FixpointPassManager.hpp"
+#include "FunctionPurity.hpp"
+#include "PassPipeline.hpp"
 #include "StaticCallCounter.hpp"
 #include "StaticCallCounterPrinter.hpp"
-#include "StrengthReduction.hpp"
-#include "PartialEvaluation.hpp"
+#include "PassStatistics.hpp"
 
-void opt(llvm::Module &mod)
+static llvm::cl::opt<std::string> gInputPath(llvm::cl::Positional, llvm::cl::desc("<input>"), llvm::cl::Required);
+static llvm::cl::opt<std::string> gOutputPath(llvm::cl::Positional, llvm::cl::desc("<output>"), llvm::cl::Required);
+static llvm::cl::opt<unsigned> gMaxIterations("max-iterations",
+                                              llvm::cl::desc("Maximum rounds of the optimization pipeline"),
+                                              llvm::cl::init(50));
+static llvm::cl::opt<unsigned> gJobs("jobs",
+                                     llvm::cl::desc("Worker threads for function passes (1 runs serially)"),
+                                     llvm::cl::init(1));
+static llvm::cl::opt<std::string> gPipeline("passes", llvm::cl::desc(passPipelineHelp()),
+                                            llvm::cl::init(gDefaultPipeline));
+static llvm::cl::opt<unsigned> gInlineBudget("inline-budget",
+                                              llvm::cl::desc("Instruction cost threshold of the function inliner"),
+                                              llvm::cl::init(PipelineOptions().inlineThreshold));
+static llvm::cl::opt<unsigned> gTileSize("tile-size",
+                                         llvm::cl::desc("Iterations per tile of the loop-nest optimizer"),
+                                         llvm::cl::init(PipelineOptions().tileSize));
+static llvm::cl::opt<unsigned> gVectorWidth("vector-width",
+                                            llvm::cl::desc("Vector register width in bits for the vectorizers"),
+                                            llvm::cl::init(PipelineOptions().vectorWidth));
+static llvm::cl::opt<std::string> gStatsPath("pass-stats",
+                                             llvm::cl::desc("Write per-pass timing and statistics as JSON"),
+                                             llvm::cl::value_desc("file"));
+static llvm::cl::opt<std::string> gTracePath("pass-trace",
+                                             llvm::cl::desc("Write per-pass timing as a Chrome trace"),
+                                             llvm::cl::value_desc("file"));
+
+bool opt(llvm::Module &mod)
 {
     using namespace llvm;
 
@@ -28,7 +49,6 @@ void opt(llvm::Module &mod)
     FunctionAnalysisManager fam;
     CGSCCAnalysisManager cgam;
     ModuleAnalysisManager mam;
-    ModulePassManager mpm;
 
     // 注册分析pass的管理器
     PassBuilder pb;
@@ -40,56 +60,75 @@ void opt(llvm::Module &mod)
 
     // 添加分析pass到管理器中
     mam.registerPass([]() { return StaticCallCounter(); });
+    mam.registerPass([]() { return FunctionPurity(); });
+
+    // 静态分析结果只打印一次
+    ModulePassManager printer;
+    printer.addPass(StaticCallCounterPrinter(llvm::errs()));
+    printer.run(mod, mam);
+
+    // 按 -passes 添加优化pass到管理器中
+    FixpointPassManager mpm(llvm::errs(), gMaxIterations, gJobs);
+    PipelineOptions options;
+    options.inlineThreshold = gInlineBudget;
+    options.tileSize = gTileSize;
+    options.vectorWidth = gVectorWidth;
+    if (!parsePassPipeline(mpm, gPipeline, options, llvm::errs(), llvm::errs()))
+        return false;
 
-    // 添加优化pass到管理器中
-    mpm.addPass(StaticCallCounterPrinter(llvm::errs()));
-    mpm.addPass(Mem2Reg());
-    mpm.addPass(ConstantPropagation(llvm::errs()));
-    mpm.addPass(ConstantFolding(llvm::errs()));
-    mpm.addPass(DeadCodeElimination(llvm::errs()));
-    mpm.addPass(StrengthReduction(llvm::errs()));
-    mpm.addPass(CommonSubexpressionElimination(llvm::errs()));
-    mpm.addPass(DeadCodeElimination(llvm::errs()));
-    // mpm.addPass(LoopInvariantCodeMotion(llvm::errs()));
-    mpm.addPass(PartialEvaluation(llvm::errs()));
-    mpm.addPass(FunctionInlining(llvm::errs()));
-    // mpm.addPass(DeadCodeElimination(llvm::errs()));
-    mpm.addPass(LoopUnrollOptimization(llvm::errs()));
-    mpm.addPass(DeadCodeElimination(llvm::errs()));
-    // 运行优化pass
-    for (int i = 0; i < 50; ++i)
-        mpm.run(mod, mam);
+    PassStatistics stats;
+    if (!gStatsPath.empty() || !gTracePath.empty())
+        mpm.setStatistics(&stats);
+
+    // 运行优化pass，直到模块不再变化
+    mpm.run(mod, mam);
+
+    std::error_code ec;
+    if (!gStatsPath.empty())
+    {
+        llvm::raw_fd_ostream out(gStatsPath, ec);
+        if (ec)
+            llvm::errs() << "Error: unable to open statistics file: " << gStatsPath << '\n';
+        else
+            stats.writeJSON(out);
+    }
+    if (!gTracePath.empty())
+    {
+        llvm::raw_fd_ostream out(gTracePath, ec);
+        if (ec)
+            llvm::errs() << "Error: unable to open trace file: " << gTracePath << '\n';
+        else
+            stats.writeTrace(out);
+    }
+    return true;
 }
 
 int main(int argc, char **argv)
 {
-    if (argc != 3)
-    {
-        std::cout << "Usage: " << argv[0] << " <input> <output>\n";
-        return -1;
-    }
+    llvm::cl::ParseCommandLineOptions(argc, argv, "SYsU-lang task4 optimizer\n");
 
     llvm::LLVMContext ctx;
 
     llvm::SMDiagnostic err;
-    auto mod = llvm::parseIRFile(argv[1], err, ctx);
+    auto mod = llvm::parseIRFile(gInputPath, err, ctx);
     if (!mod)
     {
-        std::cout << "Error: unable to parse input file: " << argv[1] << '\n';
+        std::cout << "Error: unable to parse input file: " << gInputPath << '\n';
         err.print(argv[0], llvm::errs());
         return -2;
     }
 
     std::error_code ec;
-    llvm::StringRef outPath(argv[2]);
+    llvm::StringRef outPath(gOutputPath);
     llvm::raw_fd_ostream outFile(outPath, ec);
     if (ec)
     {
-        std::cout << "Error: unable to open output file: " << argv[2] << '\n';
+        std::cout << "Error: unable to open output file: " << gOutputPath << '\n';
         return -3;
     }
 
-    opt(*mod); // IR的优化发生在这里
+    if (!opt(*mod)) // IR的优化发生在这里
+        return -4;
 
     mod->print(outFile, nullptr, false, true);
     if (llvm::verifyModule(*mod, &llvm::outs()))
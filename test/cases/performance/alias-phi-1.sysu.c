@@ -0,0 +1,21 @@
+#include <sysy/sylib.h>
+// 尾递归消除后 x 与 y 成为交替指向 a、b 的 phi，z 始终指向 a：
+// 每隔一轮 x[0] 的写入覆盖 z[0]，z[0] 的读取不能直接取前面写入的 s
+int walk(int x[], int y[], int z[], int n, int s)
+{
+    if (n == 0)
+        return s;
+    z[0] = s;
+    x[0] = n;
+    s = s + z[0];
+    return walk(y, x, z, n - 1, s);
+}
+
+int main()
+{
+    int a[1];
+    int b[1];
+    putint(walk(a, b, a, getint(), 1));
+    putch(10);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <sysy/sylib.h>
+// k、i、j 三层嵌套，中间一层在 A[i][k] == 0 时 continue：外层按块分开并移到中间一层之内，
+// n 不是块大小的整数倍，最后一块不满
+#define N 160
+
+int A[N][N];
+int B[N][N];
+int C[N][N];
+
+void mm(int n, int A[][N], int B[][N], int C[][N])
+{
+    int i = 0;
+    while (i < n)
+    {
+        int j = 0;
+        while (j < n)
+        {
+            C[i][j] = 0;
+            j = j + 1;
+        }
+        i = i + 1;
+    }
+    int k = 0;
+    while (k < n)
+    {
+        i = 0;
+        while (i < n)
+        {
+            if (A[i][k] == 0)
+            {
+                i = i + 1;
+                continue;
+            }
+            int j = 0;
+            while (j < n)
+            {
+                C[i][j] = C[i][j] + A[i][k] * B[k][j];
+                j = j + 1;
+            }
+            i = i + 1;
+        }
+        k = k + 1;
+    }
+}
+
+int main()
+{
+    int n = getint();
+    int i = 0;
+    while (i < n)
+    {
+        int j = 0;
+        while (j < n)
+        {
+            A[i][j] = (i * 7 + j * 3) % 5 - 1;
+            B[i][j] = (i * 5 + j * 11) % 7;
+            j = j + 1;
+        }
+        i = i + 1;
+    }
+    mm(n, A, B, C);
+    mm(n, A, C, B);
+    int ans = 0;
+    i = 0;
+    while (i < n)
+    {
+        int j = 0;
+        while (j < n)
+        {
+            ans = (ans * 31 + B[i][j]) % 1000003;
+            j = j + 1;
+        }
+        i = i + 1;
+    }
+    putint(ans);
+    putch(10);
+    return 0;
+}
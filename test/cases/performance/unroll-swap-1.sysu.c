@@ -0,0 +1,24 @@
+#include <sysy/sylib.h>
+// 尾递归消除后 x、y 成为互相交换的 phi，完全展开后循环外对 x 的使用要取最后一轮的值
+int pingpong(int x[], int y[], int n)
+{
+    if (n == 0)
+        return x[0];
+    x[0] = x[0] + n;
+    return pingpong(y, x, n - 1);
+}
+
+int main()
+{
+    int a[1];
+    int b[1];
+    a[0] = 1;
+    b[0] = 2;
+    putint(pingpong(a, b, 5));
+    putch(32);
+    putint(a[0]);
+    putch(32);
+    putint(b[0]);
+    putch(10);
+    return 0;
+}